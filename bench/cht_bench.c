@@ -0,0 +1,144 @@
+#define _POSIX_C_SOURCE 200112L
+#include "../src/vlib.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * measures how reads scale with the number of threads. cht_get takes no lock
+ * and writes no shared memory, so its throughput should grow with the
+ * threads, while an ht behind a single reader writer lock makes every reader
+ * write the lock's cache line. Each run is read only, and another with one
+ * thread writing to the table while the others read
+ */
+
+#define NUM_KEYS 65536
+#define READS_PER_THREAD 2000000
+#define MAX_THREADS 8
+
+typedef struct {
+    ht ht;
+    pthread_rwlock_t lock;
+} locked_ht;
+
+typedef struct {
+    bool use_cht;
+    bool writer;
+    size_t id;
+    cht* cht;
+    locked_ht* locked;
+    volatile bool* stop;
+} bench_thread;
+
+static volatile uint64_t sink;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9) + (double)ts.tv_nsec;
+}
+
+static void locked_get(locked_ht* l, uint64_t key, uint64_t* out) {
+    void* value;
+    pthread_rwlock_rdlock(&(l->lock));
+    value = ht_get(&(l->ht), &key, sizeof key);
+    if (value) {
+        memcpy(out, value, sizeof *out);
+    }
+    pthread_rwlock_unlock(&(l->lock));
+}
+
+static void locked_insert(locked_ht* l, uint64_t key, uint64_t value) {
+    pthread_rwlock_wrlock(&(l->lock));
+    ht_insert(&(l->ht), &key, sizeof key, &value, NULL);
+    pthread_rwlock_unlock(&(l->lock));
+}
+
+static void* bench_run(void* arg) {
+    bench_thread* t = arg;
+    uint64_t i, sum = 0, key = t->id * 7919;
+    if (t->writer) {
+        for (i = 0; !*(t->stop); ++i) {
+            key = (key + 40503) % NUM_KEYS;
+            if (t->use_cht) {
+                cht_insert(t->cht, &key, sizeof key, &i, NULL);
+            } else {
+                locked_insert(t->locked, key, i);
+            }
+        }
+        return NULL;
+    }
+    for (i = 0; i < READS_PER_THREAD; ++i) {
+        uint64_t out = 0;
+        key = (key + 40503) % NUM_KEYS;
+        if (t->use_cht) {
+            cht_get(t->cht, &key, sizeof key, &out);
+        } else {
+            locked_get(t->locked, key, &out);
+        }
+        sum += out;
+    }
+    sink += sum;
+    return NULL;
+}
+
+static void bench_reads(cht* cht, locked_ht* locked, bool use_cht,
+                        size_t num_threads, bool with_writer) {
+    pthread_t threads[MAX_THREADS + 1];
+    bench_thread args[MAX_THREADS + 1];
+    volatile bool stop = false;
+    size_t i, total = num_threads + (with_writer ? 1 : 0);
+    double start, ns;
+    start = now_ns();
+    for (i = 0; i < total; ++i) {
+        args[i].use_cht = use_cht;
+        args[i].writer = i == num_threads;
+        args[i].id = i;
+        args[i].cht = cht;
+        args[i].locked = locked;
+        args[i].stop = &stop;
+        pthread_create(&threads[i], NULL, bench_run, &args[i]);
+    }
+    for (i = 0; i < num_threads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    ns = now_ns() - start;
+    stop = true;
+    if (with_writer) {
+        pthread_join(threads[num_threads], NULL);
+    }
+    printf("%-14s %-12s %zu threads %8.2f Mreads/s\n",
+           use_cht ? "cht_get" : "rwlock ht_get",
+           with_writer ? "+1 writer" : "read only", num_threads,
+           ((double)(num_threads * READS_PER_THREAD) / ns) * 1e3);
+}
+
+int main(void) {
+    cht cht = cht_new(0, sizeof(uint64_t), NULL);
+    locked_ht locked;
+    uint64_t i;
+    size_t threads;
+    locked.ht = ht_new(sizeof(uint64_t), NULL);
+    if (pthread_rwlock_init(&(locked.lock), NULL) != 0) {
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < NUM_KEYS; ++i) {
+        cht_insert(&cht, &i, sizeof i, &i, NULL);
+        locked_insert(&locked, i, i);
+    }
+    for (threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        bench_reads(&cht, &locked, true, threads, false);
+        bench_reads(&cht, &locked, false, threads, false);
+    }
+    for (threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        bench_reads(&cht, &locked, true, threads, true);
+        bench_reads(&cht, &locked, false, threads, true);
+    }
+    cht_free(&cht, NULL, NULL);
+    ht_free(&(locked.ht), NULL, NULL);
+    pthread_rwlock_destroy(&(locked.lock));
+    return EXIT_SUCCESS;
+}
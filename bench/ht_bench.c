@@ -0,0 +1,281 @@
+#define _POSIX_C_SOURCE 199309L
+#include "../src/vlib.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+/**
+ * measures the cost per operation of ht and set on the key mixes we use:
+ * 8 byte integers, 16 byte uuids and short strings. It also measures
+ * reducing a hash to a bucket index with a division versus with a mask,
+ * which is what ht and set do now that their capacity is always a power of
+ * two, sequential lookups against the batched ht_get_many and
+ * set_has_many, and counting keys with ht_get followed by ht_insert against
+ * the single probe ht_update
+ */
+
+#define NUM_KEYS 1000000
+#define STR_KEY_MAX 24
+/* the number of keys resolved per ht_get_many/set_has_many call */
+#define BATCH_SIZE 256
+
+typedef struct {
+    struct timespec ts;
+    uint64_t cycles;
+} bench_clock;
+
+typedef struct {
+    const char* name;
+    size_t key_len; /* 0 for variable length string keys */
+} key_mix;
+
+static unsigned char* keys;
+static size_t key_lens[NUM_KEYS];
+static volatile uint64_t sink;
+
+static bench_clock bench_now(void) {
+    bench_clock c;
+    clock_gettime(CLOCK_MONOTONIC, &c.ts);
+#ifdef HAVE_RDTSC
+    c.cycles = __rdtsc();
+#else
+    c.cycles = 0;
+#endif
+    return c;
+}
+
+static void bench_report(const char* name, const char* mix, bench_clock start,
+                         size_t ops) {
+    bench_clock end = bench_now();
+    double ns = ((double)(end.ts.tv_sec - start.ts.tv_sec) * 1e9) +
+                (double)(end.ts.tv_nsec - start.ts.tv_nsec);
+    printf("%-22s %-8s %8.2f ns/op %8.2f cycles/op\n", name, mix, ns / ops,
+           (double)(end.cycles - start.cycles) / ops);
+}
+
+static uint64_t rng_next(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static void* key_at(size_t i) { return keys + (i * STR_KEY_MAX); }
+
+/* collect the keys of lookups [i, i + n) in the order the lookups use */
+static void batch_keys(size_t i, size_t n, void** batch, size_t* lens) {
+    size_t j;
+    for (j = 0; j < n; ++j) {
+        size_t k = ((i + j) * 7919) % NUM_KEYS;
+        batch[j] = key_at(k);
+        lens[j] = key_lens[k];
+    }
+}
+
+static void make_keys(key_mix* mix) {
+    size_t i, j;
+    uint64_t state = 42;
+    for (i = 0; i < NUM_KEYS; ++i) {
+        unsigned char* key = key_at(i);
+        if (mix->key_len == sizeof(uint64_t)) {
+            uint64_t k = i;
+            memcpy(key, &k, sizeof k);
+            key_lens[i] = sizeof k;
+            continue;
+        }
+        for (j = 0; j < STR_KEY_MAX; j += sizeof(uint64_t)) {
+            uint64_t r = rng_next(&state);
+            memcpy(key + j, &r, sizeof r);
+        }
+        if (mix->key_len) {
+            key_lens[i] = mix->key_len;
+            continue;
+        }
+        for (j = 0; j < STR_KEY_MAX; ++j) {
+            key[j] = 'a' + (key[j] % 26);
+        }
+        key_lens[i] = 8 + (i % (STR_KEY_MAX - 8 + 1));
+    }
+}
+
+static void bench_reduce(void) {
+    size_t i, n = NUM_KEYS * 10;
+    volatile size_t vcap = 1 << 20;
+    size_t cap = vcap;
+    uint64_t state = 7, acc = 0;
+    uint64_t* hashes = malloc(NUM_KEYS * sizeof(uint64_t));
+    bench_clock start;
+    if (hashes == NULL) {
+        return;
+    }
+    for (i = 0; i < NUM_KEYS; ++i) {
+        hashes[i] = rng_next(&state);
+    }
+    start = bench_now();
+    for (i = 0; i < n; ++i) {
+        acc += hashes[i % NUM_KEYS] % cap;
+    }
+    bench_report("reduce modulo", "-", start, n);
+    start = bench_now();
+    for (i = 0; i < n; ++i) {
+        acc += hashes[i % NUM_KEYS] & (cap - 1);
+    }
+    bench_report("reduce mask", "-", start, n);
+    sink = acc;
+    free(hashes);
+}
+
+/* a null hash_fn benchmarks a fixed key table of mix->key_len keys */
+static void bench_ht(key_mix* mix, HashFn* hash_fn, const char* name) {
+    size_t i, lens[BATCH_SIZE];
+    void* batch[BATCH_SIZE];
+    void* out[BATCH_SIZE];
+    uint64_t acc = 0;
+    bench_clock start;
+    ht ht = hash_fn ? ht_new_with_hash(sizeof(size_t), NULL, hash_fn)
+                    : ht_new_fixed(mix->key_len, sizeof(size_t));
+    start = bench_now();
+    for (i = 0; i < NUM_KEYS; ++i) {
+        ht_insert(&ht, key_at(i), key_lens[i], &i, NULL);
+    }
+    bench_report(name, mix->name, start, NUM_KEYS);
+    start = bench_now();
+    for (i = 0; i < NUM_KEYS; ++i) {
+        size_t* v = ht_get(&ht, key_at((i * 7919) % NUM_KEYS),
+                           key_lens[(i * 7919) % NUM_KEYS]);
+        acc += v ? *v : 0;
+    }
+    bench_report("  ht_get", mix->name, start, NUM_KEYS);
+    start = bench_now();
+    for (i = 0; i < NUM_KEYS; i += BATCH_SIZE) {
+        size_t j, n = (NUM_KEYS - i) < BATCH_SIZE ? (NUM_KEYS - i) : BATCH_SIZE;
+        batch_keys(i, n, batch, lens);
+        ht_get_many(&ht, batch, lens, n, out);
+        for (j = 0; j < n; ++j) {
+            acc += out[j] ? *((size_t*)out[j]) : 0;
+        }
+    }
+    bench_report("  ht_get_many", mix->name, start, NUM_KEYS);
+    sink = acc;
+    ht_free(&ht, NULL, NULL);
+}
+
+static void bench_count_one(void* value, bool inserted, void* ctx) {
+    (void)ctx;
+    if (inserted) {
+        *((size_t*)value) = 0;
+    }
+    (*((size_t*)value))++;
+}
+
+/* count how often each key occurs, with every key occurring 4 times */
+static void bench_count(key_mix* mix) {
+    size_t i, n = NUM_KEYS * 4;
+    bench_clock start;
+    ht ht = ht_new_with_hash(sizeof(size_t), NULL, hash_wyhash);
+    start = bench_now();
+    for (i = 0; i < n; ++i) {
+        size_t k = (i * 7919) % NUM_KEYS;
+        size_t* v = ht_get(&ht, key_at(k), key_lens[k]);
+        if (v) {
+            (*v)++;
+        } else {
+            size_t one = 1;
+            ht_insert(&ht, key_at(k), key_lens[k], &one, NULL);
+        }
+    }
+    bench_report("count get+insert", mix->name, start, n);
+    ht_free(&ht, NULL, NULL);
+    ht = ht_new_with_hash(sizeof(size_t), NULL, hash_wyhash);
+    start = bench_now();
+    for (i = 0; i < n; ++i) {
+        size_t k = (i * 7919) % NUM_KEYS;
+        ht_update(&ht, key_at(k), key_lens[k], bench_count_one, NULL);
+    }
+    bench_report("count ht_update", mix->name, start, n);
+    ht_free(&ht, NULL, NULL);
+}
+
+/* a bulk load into a table that grows on the way, then into a reserved one */
+static void bench_reserve(key_mix* mix) {
+    size_t i;
+    bench_clock start;
+    ht ht = ht_new_with_hash(sizeof(size_t), NULL, hash_wyhash);
+    start = bench_now();
+    for (i = 0; i < NUM_KEYS; ++i) {
+        ht_insert(&ht, key_at(i), key_lens[i], &i, NULL);
+    }
+    bench_report("load growing", mix->name, start, NUM_KEYS);
+    ht_free(&ht, NULL, NULL);
+    ht = ht_new_with_hash(sizeof(size_t), NULL, hash_wyhash);
+    start = bench_now();
+    ht_reserve(&ht, NUM_KEYS);
+    for (i = 0; i < NUM_KEYS; ++i) {
+        ht_insert(&ht, key_at(i), key_lens[i], &i, NULL);
+    }
+    bench_report("load ht_reserve", mix->name, start, NUM_KEYS);
+    ht_free(&ht, NULL, NULL);
+}
+
+static void bench_set(key_mix* mix, bool fixed, const char* name) {
+    size_t i, lens[BATCH_SIZE];
+    void* batch[BATCH_SIZE];
+    uint64_t acc = 0;
+    bench_clock start;
+    set s = fixed ? set_new_fixed(mix->key_len, NULL) : set_new(NULL);
+    start = bench_now();
+    for (i = 0; i < NUM_KEYS; ++i) {
+        set_insert(&s, key_at(i), key_lens[i]);
+    }
+    bench_report(name, mix->name, start, NUM_KEYS);
+    start = bench_now();
+    for (i = 0; i < NUM_KEYS; ++i) {
+        acc += set_has(&s, key_at((i * 7919) % NUM_KEYS),
+                       key_lens[(i * 7919) % NUM_KEYS]);
+    }
+    bench_report("  set_has", mix->name, start, NUM_KEYS);
+    start = bench_now();
+    for (i = 0; i < NUM_KEYS; i += BATCH_SIZE) {
+        size_t n = (NUM_KEYS - i) < BATCH_SIZE ? (NUM_KEYS - i) : BATCH_SIZE;
+        batch_keys(i, n, batch, lens);
+        acc += set_has_many(&s, batch, lens, n, NULL);
+    }
+    bench_report("  set_has_many", mix->name, start, NUM_KEYS);
+    sink = acc;
+    set_free(&s, NULL);
+}
+
+int main(void) {
+    key_mix mixes[] = {{"u64", sizeof(uint64_t)}, {"uuid", 16}, {"str", 0}};
+    size_t i;
+    keys = malloc(NUM_KEYS * STR_KEY_MAX);
+    if (keys == NULL) {
+        return EXIT_FAILURE;
+    }
+    bench_reduce();
+    for (i = 0; i < sizeof mixes / sizeof mixes[0]; ++i) {
+        make_keys(&mixes[i]);
+        bench_ht(&mixes[i], hash_siphash, "ht_insert siphash");
+        bench_ht(&mixes[i], hash_wyhash, "ht_insert wyhash");
+        if (mixes[i].key_len == sizeof(uint64_t)) {
+            bench_ht(&mixes[i], hash_int, "ht_insert int");
+        }
+        if (mixes[i].key_len) {
+            bench_ht(&mixes[i], NULL, "ht_insert fixed");
+        }
+        bench_count(&mixes[i]);
+        bench_reserve(&mixes[i]);
+        bench_set(&mixes[i], false, "set_insert");
+        if (mixes[i].key_len) {
+            bench_set(&mixes[i], true, "set_insert fixed");
+        }
+    }
+    free(keys);
+    return EXIT_SUCCESS;
+}
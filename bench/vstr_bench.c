@@ -0,0 +1,179 @@
+#define _POSIX_C_SOURCE 199309L
+#include "../src/vlib.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * measures building strings a piece at a time, the way log lines are built:
+ * char by char, a field at a time, a field at a time into a vstr that
+ * reserved its final length up front, and a field at a time with the field
+ * length known, so nothing calls strlen. Large strings double their capacity
+ * when they are full, so each string is reallocated O(log n) times.
+ *
+ * It also compares vstr_find, vstr_find_char and vstr_casecmp against plain
+ * byte loops, on a short and on a long haystack
+ */
+
+#define NUM_STRINGS 20000
+#define NUM_FIELDS 64
+
+static volatile uint64_t sink;
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9) + (double)ts.tv_nsec;
+}
+
+static void bench_report(const char* name, double start, size_t ops,
+                         size_t len) {
+    double ns = bench_now() - start;
+    printf("%-24s %6zu bytes %10.2f ns/op %6.2f ns/byte\n", name, len,
+           ns / ops, ns / ((double)ops * (double)len));
+}
+
+static void bench_push_char(size_t len) {
+    size_t i, j;
+    double start = bench_now();
+    for (i = 0; i < NUM_STRINGS; ++i) {
+        vstr s = vstr_new();
+        for (j = 0; j < len; ++j) {
+            vstr_push_char(&s, (char)('a' + (j % 26)));
+        }
+        sink += (uint64_t)vstr_data(&s)[len - 1];
+        vstr_free(&s);
+    }
+    bench_report("vstr_push_char", start, NUM_STRINGS, len);
+}
+
+static void bench_push_string(const char* field, bool reserve) {
+    size_t i, j, len = strlen(field) * NUM_FIELDS;
+    double start = bench_now();
+    for (i = 0; i < NUM_STRINGS; ++i) {
+        vstr s = vstr_new();
+        if (reserve) {
+            vstr_reserve(&s, len);
+        }
+        for (j = 0; j < NUM_FIELDS; ++j) {
+            vstr_push_string(&s, field);
+        }
+        sink += (uint64_t)vstr_data(&s)[len - 1];
+        vstr_free(&s);
+    }
+    bench_report(reserve ? "vstr_push_string reserve" : "vstr_push_string",
+                 start, NUM_STRINGS, len);
+}
+
+static void bench_push_len(const char* field) {
+    size_t i, j, field_len = strlen(field), len = field_len * NUM_FIELDS;
+    double start = bench_now();
+    for (i = 0; i < NUM_STRINGS; ++i) {
+        vstr s = vstr_new();
+        for (j = 0; j < NUM_FIELDS; ++j) {
+            vstr_push_len(&s, field, field_len);
+        }
+        sink += (uint64_t)vstr_data(&s)[len - 1];
+        vstr_free(&s);
+    }
+    bench_report("vstr_push_len", start, NUM_STRINGS, len);
+}
+
+/* the byte loops that callers used before vstr_find and vstr_casecmp */
+static size_t loop_find(const char* s, size_t len, const char* needle,
+                        size_t needle_len) {
+    size_t i, j;
+    for (i = 0; (i + needle_len) <= len; ++i) {
+        for (j = 0; (j < needle_len) && (s[i + j] == needle[j]); ++j) {
+        }
+        if (j == needle_len) {
+            return i;
+        }
+    }
+    return len;
+}
+
+static int loop_casecmp(const char* a, const char* b, size_t len) {
+    size_t i;
+    for (i = 0; i < len; ++i) {
+        int ca = tolower((unsigned char)a[i]);
+        int cb = tolower((unsigned char)b[i]);
+        if (ca != cb) {
+            return ca - cb;
+        }
+    }
+    return 0;
+}
+
+/* search for a needle at the end of a haystack of len bytes */
+static void bench_search(size_t len) {
+    size_t i, reps = (NUM_STRINGS * 100) / len;
+    char* buf = malloc(len);
+    vstr hay, upper;
+    double start;
+    if (buf == NULL) {
+        return;
+    }
+    for (i = 0; i < len; ++i) {
+        buf[i] = "GET /index.html HTTP/1.1\r\nhost: x\r\n"[i % 36];
+    }
+    memcpy(buf + len - 8, "boundary", 8);
+    hay = vstr_from_len(buf, len);
+    for (i = 0; i < len; ++i) {
+        buf[i] = (char)toupper((unsigned char)buf[i]);
+    }
+    upper = vstr_from_len(buf, len);
+    start = bench_now();
+    for (i = 0; i < reps; ++i) {
+        sink += loop_find(vstr_data(&hay), len, "boundary", 8);
+    }
+    bench_report("loop find", start, reps, len);
+    start = bench_now();
+    for (i = 0; i < reps; ++i) {
+        sink += (uint64_t)vstr_find(&hay, "boundary", 8);
+    }
+    bench_report("vstr_find", start, reps, len);
+    start = bench_now();
+    for (i = 0; i < reps; ++i) {
+        sink += loop_find(vstr_data(&hay), len, "b", 1);
+    }
+    bench_report("loop find char", start, reps, len);
+    start = bench_now();
+    for (i = 0; i < reps; ++i) {
+        sink += (uint64_t)vstr_find_char(&hay, 'b');
+    }
+    bench_report("vstr_find_char", start, reps, len);
+    start = bench_now();
+    for (i = 0; i < reps; ++i) {
+        sink += (uint64_t)loop_casecmp(vstr_data(&hay), vstr_data(&upper), len);
+    }
+    bench_report("loop casecmp", start, reps, len);
+    start = bench_now();
+    for (i = 0; i < reps; ++i) {
+        sink += (uint64_t)vstr_casecmp(&hay, &upper);
+    }
+    bench_report("vstr_casecmp", start, reps, len);
+    vstr_free(&hay);
+    vstr_free(&upper);
+    free(buf);
+}
+
+int main(void) {
+    const char* fields[] = {"k=v ", "level=info ts=1700000000 ",
+                            "msg=\"request served\" path=/api/v1/items "};
+    size_t i;
+    bench_push_char(100);
+    bench_push_char(1000);
+    bench_push_char(10000);
+    for (i = 0; i < sizeof fields / sizeof fields[0]; ++i) {
+        bench_push_string(fields[i], false);
+        bench_push_string(fields[i], true);
+        bench_push_len(fields[i]);
+    }
+    bench_search(64);
+    bench_search(4096);
+    return EXIT_SUCCESS;
+}
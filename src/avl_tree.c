@@ -11,32 +11,39 @@ typedef struct avl_node {
 } avl_node;
 
 static avl_node* insert(avl_node* root, void* key, size_t key_size, CmpFn* fn,
-                        int* success);
+                        varena* arena, int* success);
 static avl_node* right_rotate(avl_node* y);
 static avl_node* left_rotate(avl_node* y);
 static avl_node* delete_node(avl_node* root, void* key, size_t key_size,
-                             CmpFn* cmp_fn, FreeFn* free_fn, int* success);
+                             CmpFn* cmp_fn, FreeFn* free_fn, varena* arena,
+                             int* success);
 static avl_node* min_value_node(avl_node* node);
 static ssize_t height(avl_node* node);
 static ssize_t get_balance(avl_node* node);
-static void free_walk(avl_node* node, FreeFn* fn);
+static void free_walk(avl_node* node, FreeFn* fn, varena* arena);
 static void avl_pre_walk(avl_node* node, vec** vec);
 static void avl_in_walk(avl_node* node, vec** vec);
 static void avl_post_walk(avl_node* node, vec** vec);
-static avl_node* avl_node_new(void* data, size_t data_size);
-static void avl_node_free(avl_node* node, FreeFn* fn);
+static avl_node* avl_node_new(void* data, size_t data_size, varena* arena);
+static void avl_node_free(avl_node* node, FreeFn* fn, varena* arena);
 
 avl_tree avl_tree_new(size_t key_size) {
+    return avl_tree_new_with_arena(key_size, NULL);
+}
+
+avl_tree avl_tree_new_with_arena(size_t key_size, varena* arena) {
     avl_tree tree = {0};
     tree.key_size = key_size;
     tree.root = NULL;
     tree.num_el = 0;
+    tree.arena = arena;
     return tree;
 }
 
 int avl_insert(avl_tree* tree, void* key, CmpFn* fn) {
     int success = -1;
-    void* root = insert(tree->root, key, tree->key_size, fn, &success);
+    void* root =
+        insert(tree->root, key, tree->key_size, fn, tree->arena, &success);
     if (success == -1) {
         return -1;
     }
@@ -47,8 +54,8 @@ int avl_insert(avl_tree* tree, void* key, CmpFn* fn) {
 
 int avl_delete(avl_tree* tree, void* key, CmpFn* cmp_fn, FreeFn* free_fn) {
     int success = -1;
-    tree->root =
-        delete_node(tree->root, key, tree->key_size, cmp_fn, free_fn, &success);
+    tree->root = delete_node(tree->root, key, tree->key_size, cmp_fn, free_fn,
+                             tree->arena, &success);
     if (success == 0) {
         tree->num_el--;
     }
@@ -83,16 +90,16 @@ vec* avl_post_order(avl_tree* tree) {
 }
 
 void avl_tree_free(avl_tree* tree, FreeFn* fn) {
-    free_walk(tree->root, fn);
+    free_walk(tree->root, fn, tree->arena);
     tree->num_el = 0;
 }
 
 static avl_node* insert(avl_node* root, void* key, size_t key_size, CmpFn* fn,
-                        int* success) {
+                        varena* arena, int* success) {
     int cmp;
     ssize_t balance;
     if (root == NULL) {
-        avl_node* tmp = avl_node_new(key, key_size);
+        avl_node* tmp = avl_node_new(key, key_size, arena);
         if (tmp == NULL) {
             *success = -1;
         } else {
@@ -102,9 +109,9 @@ static avl_node* insert(avl_node* root, void* key, size_t key_size, CmpFn* fn,
     }
     cmp = fn(key, root->key);
     if (cmp < 0) {
-        root->left = insert(root->left, key, key_size, fn, success);
+        root->left = insert(root->left, key, key_size, fn, arena, success);
     } else if (cmp > 0) {
-        root->right = insert(root->right, key, key_size, fn, success);
+        root->right = insert(root->right, key, key_size, fn, arena, success);
     } else {
         return root;
     }
@@ -134,7 +141,8 @@ static avl_node* insert(avl_node* root, void* key, size_t key_size, CmpFn* fn,
 }
 
 static avl_node* delete_node(avl_node* root, void* key, size_t key_size,
-                             CmpFn* cmp_fn, FreeFn* free_fn, int* success) {
+                             CmpFn* cmp_fn, FreeFn* free_fn, varena* arena,
+                             int* success) {
     int cmp;
     ssize_t balance;
     if (root == NULL) {
@@ -142,11 +150,11 @@ static avl_node* delete_node(avl_node* root, void* key, size_t key_size,
     }
     cmp = cmp_fn(key, root->key);
     if (cmp < 0) {
-        root->left =
-            delete_node(root->left, key, key_size, cmp_fn, free_fn, success);
+        root->left = delete_node(root->left, key, key_size, cmp_fn, free_fn,
+                                 arena, success);
     } else if (cmp > 0) {
-        root->right =
-            delete_node(root->right, key, key_size, cmp_fn, free_fn, success);
+        root->right = delete_node(root->right, key, key_size, cmp_fn, free_fn,
+                                  arena, success);
     } else {
         if ((root->left == NULL) || (root->right == NULL)) {
             avl_node* tmp = root->left ? root->left : root->right;
@@ -156,14 +164,14 @@ static avl_node* delete_node(avl_node* root, void* key, size_t key_size,
             } else {
                 size_t needed = sizeof(avl_node) + key_size;
                 memcpy(root, tmp, needed);
-                avl_node_free(tmp, free_fn);
+                avl_node_free(tmp, free_fn, arena);
                 *success = 0;
             }
         } else {
             avl_node* tmp = min_value_node(root->right);
             memcpy(root->key, tmp->key, key_size);
             root->right = delete_node(root->right, tmp->key, key_size, cmp_fn,
-                                      free_fn, success);
+                                      free_fn, arena, success);
         }
     }
 
@@ -239,14 +247,14 @@ static ssize_t get_balance(avl_node* node) {
     return height(node->left) - height(node->right);
 }
 
-static void free_walk(avl_node* node, FreeFn* fn) {
+static void free_walk(avl_node* node, FreeFn* fn, varena* arena) {
     if (!node) {
         return;
     }
 
-    free_walk(node->left, fn);
-    free_walk(node->right, fn);
-    avl_node_free(node, fn);
+    free_walk(node->left, fn, arena);
+    free_walk(node->right, fn, arena);
+    avl_node_free(node, fn, arena);
 }
 
 static void avl_pre_walk(avl_node* node, vec** vec) {
@@ -276,10 +284,10 @@ static void avl_post_walk(avl_node* node, vec** vec) {
     vec_push(vec, node->key);
 }
 
-static avl_node* avl_node_new(void* key, size_t key_size) {
+static avl_node* avl_node_new(void* key, size_t key_size, varena* arena) {
     avl_node* node;
     size_t needed = (sizeof *node) + key_size;
-    node = malloc(needed);
+    node = varena_alloc(arena, needed);
     if (node == NULL) {
         return NULL;
     }
@@ -291,9 +299,9 @@ static avl_node* avl_node_new(void* key, size_t key_size) {
     return node;
 }
 
-static void avl_node_free(avl_node* node, FreeFn* fn) {
+static void avl_node_free(avl_node* node, FreeFn* fn, varena* arena) {
     if (fn) {
         fn(node->key);
     }
-    free(node);
+    varena_dealloc(arena, node);
 }
@@ -2,9 +2,14 @@
 #include <memory.h>
 
 binary_node* binary_node_new(void* data, size_t data_size) {
+    return binary_node_new_with_arena(data, data_size, NULL);
+}
+
+binary_node* binary_node_new_with_arena(void* data, size_t data_size,
+                                        varena* arena) {
     binary_node* node;
     size_t needed = (sizeof *node) + data_size;
-    node = malloc(needed);
+    node = varena_alloc(arena, needed);
     if (node == NULL) {
         return NULL;
     }
@@ -1,20 +1,20 @@
 #include "vlib.h"
 
-static void free_walk(binary_node* node, FreeFn* fn);
+static void free_walk(binary_node* node, FreeFn* fn, varena* arena);
 
 void binary_tree_free(binary_tree* tree, FreeFn* fn) {
-    free_walk(tree->root, fn);
+    free_walk(tree->root, fn, tree->arena);
     tree->num_el = 0;
 }
 
-static void free_walk(binary_node* node, FreeFn* fn) {
+static void free_walk(binary_node* node, FreeFn* fn, varena* arena) {
     if (!node) {
         return;
     }
-    free_walk(node->left, fn);
-    free_walk(node->right, fn);
+    free_walk(node->left, fn, arena);
+    free_walk(node->right, fn, arena);
     if (fn) {
         fn(node->data);
     }
-    free(node);
+    varena_dealloc(arena, node);
 }
@@ -0,0 +1,244 @@
+#define _POSIX_C_SOURCE 200112L
+#include "vlib.h"
+#include <assert.h>
+#include <memory.h>
+#include <pthread.h>
+
+/**
+ * each shard is an ht whose writers are serialized by a mutex and published
+ * through a sequence number. The number is odd while a write is in progress,
+ * so a reader that saw the same even number before and after its lookup knows
+ * the lookup wasn't torn, and reads never write to memory that is shared with
+ * another thread. Entries and tables a writer removes are retired to the
+ * epoch domain of the cht instead of being freed, so a reader that raced with
+ * the write never follows a dangling pointer. A reader that keeps losing the
+ * race falls back to the mutex. Every shard hashes with the seed of the cht,
+ * so the hash that picks the shard is also the one the shard probes with
+ */
+typedef struct cht_shard {
+    uint64_t seq;         /* odd while a writer is modifying ht */
+    pthread_mutex_t lock; /* serializes the writers */
+    ht ht;
+    vepoch* epoch;        /* the epoch domain of the cht */
+    vepoch_list retired;  /* memory ht removed that readers may still see */
+} cht_shard;
+
+/* shards are padded to a cache line so writers don't share one */
+#define CHT_CACHE_LINE 64
+#define CHT_SHARD_STRIDE                                                       \
+    (((sizeof(cht_shard) + CHT_CACHE_LINE - 1) / CHT_CACHE_LINE) *             \
+     CHT_CACHE_LINE)
+
+/* the number of optimistic reads tried before a reader takes the lock */
+#define CHT_READ_RETRIES 8
+
+/* the shard is picked with the high half of the hash */
+#define cht_shard_idx(cht, hash) (((hash) >> 32) & ((cht)->num_shards - 1))
+#define cht_shard_at(cht, i)                                                   \
+    ((cht_shard*)((unsigned char*)(cht)->shards + ((i)*CHT_SHARD_STRIDE)))
+
+static uint64_t cht_hash(cht* cht, void* key, size_t key_len);
+static cht_shard* cht_shard_of(cht* cht, uint64_t hash);
+static size_t cht_round_shards(size_t num_shards);
+static bool cht_read(cht* cht, void* key, size_t key_len, void* out);
+static void cht_write_lock(cht_shard* shard);
+static void cht_write_unlock(cht_shard* shard);
+static void cht_retire(void* ptr, void* ctx);
+
+cht cht_new(size_t num_shards, size_t data_size, CmpFn* cmp_key) {
+    return cht_new_with_hash(num_shards, data_size, cmp_key, NULL);
+}
+
+cht cht_new_with_hash(size_t num_shards, size_t data_size, CmpFn* cmp_key,
+                      HashFn* hash_fn) {
+    cht cht = {0};
+    size_t i;
+    void* shards;
+    int alloc_res;
+    cht.num_shards = cht_round_shards(num_shards);
+    cht.data_size = data_size;
+    cht.hash_fn = hash_fn ? hash_fn : hash_siphash;
+    get_random_bytes(cht.seed, HT_SEED_SIZE);
+    cht.epoch = malloc(sizeof *cht.epoch);
+    assert(cht.epoch != NULL);
+    *cht.epoch = vepoch_new();
+    alloc_res = posix_memalign(&shards, CHT_CACHE_LINE,
+                               cht.num_shards * CHT_SHARD_STRIDE);
+    assert(alloc_res == 0);
+    (void)alloc_res;
+    cht.shards = shards;
+    for (i = 0; i < cht.num_shards; ++i) {
+        cht_shard* shard = cht_shard_at(&cht, i);
+        int init_res = pthread_mutex_init(&(shard->lock), NULL);
+        assert(init_res == 0);
+        (void)init_res;
+        shard->seq = 0;
+        shard->epoch = cht.epoch;
+        shard->retired = vepoch_list_new();
+        shard->ht = ht_new_with_hash(data_size, cmp_key, hash_fn);
+        memcpy(shard->ht.seed, cht.seed, HT_SEED_SIZE);
+        ht_set_retire(&(shard->ht), cht_retire, shard);
+    }
+    return cht;
+}
+
+size_t cht_len(cht* cht) {
+    size_t i, len = 0;
+    for (i = 0; i < cht->num_shards; ++i) {
+        cht_shard* shard = cht_shard_at(cht, i);
+        pthread_mutex_lock(&(shard->lock));
+        len += ht_len(&(shard->ht));
+        pthread_mutex_unlock(&(shard->lock));
+    }
+    return len;
+}
+
+bool cht_has(cht* cht, void* key, size_t key_len) {
+    return cht_read(cht, key, key_len, NULL);
+}
+
+int cht_get(cht* cht, void* key, size_t key_len, void* out) {
+    return cht_read(cht, key, key_len, out) ? 0 : -1;
+}
+
+int cht_insert(cht* cht, void* key, size_t key_len, void* value, FreeFn* fn) {
+    bool inserted;
+    void* ptr;
+    ht_entry* entry;
+    uint64_t hash = cht_hash(cht, key, key_len);
+    cht_shard* shard = cht_shard_of(cht, hash);
+    cht_write_lock(shard);
+    entry = ht_entry_find_or_insert_hashed(&(shard->ht), key, key_len, hash,
+                                           &inserted);
+    if (entry == NULL) {
+        cht_write_unlock(shard);
+        return -1;
+    }
+    ptr = ht_entry_value(entry);
+    if (!inserted && fn) {
+        fn(ptr);
+    }
+    memcpy(ptr, value, cht->data_size);
+    cht_write_unlock(shard);
+    return 0;
+}
+
+int cht_try_insert(cht* cht, void* key, size_t key_len, void* value) {
+    bool inserted;
+    ht_entry* entry;
+    uint64_t hash = cht_hash(cht, key, key_len);
+    cht_shard* shard = cht_shard_of(cht, hash);
+    cht_write_lock(shard);
+    entry = ht_entry_find_or_insert_hashed(&(shard->ht), key, key_len, hash,
+                                           &inserted);
+    if ((entry == NULL) || !inserted) {
+        cht_write_unlock(shard);
+        return -1;
+    }
+    memcpy(ht_entry_value(entry), value, cht->data_size);
+    cht_write_unlock(shard);
+    return 0;
+}
+
+int cht_delete(cht* cht, void* key, size_t key_len, FreeFn* free_key,
+               FreeFn* free_val) {
+    int res;
+    uint64_t hash = cht_hash(cht, key, key_len);
+    cht_shard* shard = cht_shard_of(cht, hash);
+    cht_write_lock(shard);
+    res = ht_delete_hashed(&(shard->ht), key, key_len, hash, free_key,
+                           free_val);
+    cht_write_unlock(shard);
+    return res;
+}
+
+void cht_free(cht* cht, FreeFn* free_key, FreeFn* free_val) {
+    size_t i;
+    for (i = 0; i < cht->num_shards; ++i) {
+        cht_shard* shard = cht_shard_at(cht, i);
+        ht_free(&(shard->ht), free_key, free_val);
+        vepoch_list_free(&(shard->retired));
+        pthread_mutex_destroy(&(shard->lock));
+    }
+    free(cht->shards);
+    cht->shards = NULL;
+    cht->num_shards = 0;
+    if (cht->epoch) {
+        vepoch_free(cht->epoch);
+        free(cht->epoch);
+        cht->epoch = NULL;
+    }
+}
+
+static uint64_t cht_hash(cht* cht, void* key, size_t key_len) {
+    return cht->hash_fn(key, key_len, cht->seed);
+}
+
+static cht_shard* cht_shard_of(cht* cht, uint64_t hash) {
+    return cht_shard_at(cht, cht_shard_idx(cht, hash));
+}
+
+/**
+ * look key up without the lock. The lookup is retried while it overlaps a
+ * write, and the reader leaves its epoch before it falls back to the lock, so
+ * a writer that waits for the readers of an epoch never waits on itself
+ */
+static bool cht_read(cht* cht, void* key, size_t key_len, void* out) {
+    bool found = false, done = false;
+    int i;
+    uint64_t hash = cht_hash(cht, key, key_len);
+    cht_shard* shard = cht_shard_of(cht, hash);
+    vepoch_reader* reader = vepoch_enter(cht->epoch);
+    for (i = 0; reader && (i < CHT_READ_RETRIES); ++i) {
+        uint64_t seq = __atomic_load_n(&(shard->seq), __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        found = ht_read_hashed(&(shard->ht), key, key_len, hash, out);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&(shard->seq), __ATOMIC_RELAXED) == seq) {
+            done = true;
+            break;
+        }
+    }
+    if (reader) {
+        vepoch_exit(reader);
+    }
+    if (done) {
+        return found;
+    }
+    pthread_mutex_lock(&(shard->lock));
+    found = ht_read_hashed(&(shard->ht), key, key_len, hash, out);
+    pthread_mutex_unlock(&(shard->lock));
+    return found;
+}
+
+static void cht_write_lock(cht_shard* shard) {
+    pthread_mutex_lock(&(shard->lock));
+    __atomic_store_n(&(shard->seq), shard->seq + 1, __ATOMIC_RELAXED);
+    /* readers that see any write of this section must see the odd number */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void cht_write_unlock(cht_shard* shard) {
+    __atomic_store_n(&(shard->seq), shard->seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&(shard->lock));
+}
+
+/* called with the lock of the shard held, so its list needs no lock */
+static void cht_retire(void* ptr, void* ctx) {
+    cht_shard* shard = ctx;
+    vepoch_retire(shard->epoch, &(shard->retired), ptr);
+}
+
+/* the number of shards is rounded up to a power of two so it can be masked */
+static size_t cht_round_shards(size_t num_shards) {
+    size_t res = 1;
+    if (num_shards == 0) {
+        return CHT_DEFAULT_SHARDS;
+    }
+    while (res < num_shards) {
+        res <<= 1;
+    }
+    return res;
+}
@@ -0,0 +1,328 @@
+#define _POSIX_C_SOURCE 200112L
+#include "vlib.h"
+#include <assert.h>
+#include <memory.h>
+#include <pthread.h>
+
+/**
+ * each shard is a fixed array of slots evicted with the CLOCK algorithm. A hit
+ * only sets the reference bit of its slot, and lookups take no lock: like the
+ * shards of cht, writers are serialized by a mutex and count their writes
+ * with a sequence number, so a lookup that overlapped a write is retried, and
+ * the entries and tables the lookup table removes are retired to the epoch
+ * domain of the cache. On a miss the clock hand sweeps the slots, clearing
+ * reference bits until it finds a slot that has not been used since the last
+ * sweep, and evicts it. The lookup tables of the shards use the seed of the
+ * cache, so the hash that picks the shard is also the one the lookup probes
+ * with, and the one eviction deletes the key with
+ */
+typedef struct {
+    unsigned char* key; /* copy of the key, NULL if the slot is unused */
+    size_t key_len;
+    uint64_t hash; /* the hash of the key */
+    uint8_t ref;   /* set by hits, cleared by the clock hand */
+} clru_slot;
+
+typedef struct clru_shard {
+    uint64_t seq;          /* odd while a writer is modifying the shard */
+    pthread_mutex_t lock;  /* serializes the writers */
+    vepoch* epoch;         /* the epoch domain of the cache */
+    vepoch_list retired;   /* memory lookup removed that readers may see */
+    ht lookup;             /* key -> index of the key's slot */
+    size_t len;            /* the number of used slots */
+    size_t cap;            /* the number of slots */
+    size_t hand;           /* the next slot the clock hand looks at */
+    clru_slot* slots;      /* the slots of the shard */
+    unsigned char* values; /* the value of each slot */
+} clru_shard;
+
+/* the shard is picked with the high half of the hash */
+#define clru_shard_idx(l, hash) (((hash) >> 32) & ((l)->num_shards - 1))
+
+#define clru_value(l, shard, idx) ((shard)->values + ((idx) * (l)->data_size))
+
+/* the number of optimistic reads tried before a reader takes the lock */
+#define CLRU_READ_RETRIES 8
+
+static uint64_t clru_hash(clru* l, void* key, size_t key_len);
+static clru_shard* clru_shard_of(clru* l, uint64_t hash);
+static int clru_shard_init(clru* l, clru_shard* shard, size_t cap,
+                           CmpFn* cmp_keys);
+static size_t clru_evict(clru* l, clru_shard* shard, FreeFn* fn);
+static bool clru_read(clru* l, clru_shard* shard, void* key, size_t key_len,
+                      uint64_t hash, void* out);
+static void clru_write_lock(clru_shard* shard);
+static void clru_write_unlock(clru_shard* shard);
+static void clru_retire(void* ptr, void* ctx);
+
+clru clru_new(size_t cap, size_t num_shards, size_t data_size,
+              CmpFn* cmp_keys) {
+    return clru_new_with_hash(cap, num_shards, data_size, cmp_keys, NULL);
+}
+
+clru clru_new_with_hash(size_t cap, size_t num_shards, size_t data_size,
+                        CmpFn* cmp_keys, HashFn* hash_fn) {
+    clru l = {0};
+    size_t i;
+    l.num_shards = 1;
+    if (num_shards == 0) {
+        num_shards = CLRU_DEFAULT_SHARDS;
+    }
+    while (l.num_shards < num_shards) {
+        l.num_shards <<= 1;
+    }
+    /* every shard holds at least one entry */
+    while ((l.num_shards > 1) && (l.num_shards > cap)) {
+        l.num_shards >>= 1;
+    }
+    l.cap = cap;
+    l.data_size = data_size;
+    l.hash_fn = hash_fn ? hash_fn : hash_siphash;
+    get_random_bytes(l.seed, HT_SEED_SIZE);
+    l.epoch = malloc(sizeof *l.epoch);
+    assert(l.epoch != NULL);
+    *l.epoch = vepoch_new();
+    l.shards = malloc(l.num_shards * sizeof(clru_shard));
+    assert(l.shards != NULL);
+    for (i = 0; i < l.num_shards; ++i) {
+        /* the shard caps add up to cap exactly */
+        size_t shard_cap =
+            (cap / l.num_shards) + (i < (cap % l.num_shards) ? 1 : 0);
+        int init_res =
+            clru_shard_init(&l, &(l.shards[i]), shard_cap, cmp_keys);
+        assert(init_res == 0);
+        (void)init_res;
+    }
+    return l;
+}
+
+size_t clru_len(clru* l) {
+    size_t i, len = 0;
+    for (i = 0; i < l->num_shards; ++i) {
+        clru_shard* shard = &(l->shards[i]);
+        pthread_mutex_lock(&(shard->lock));
+        len += shard->len;
+        pthread_mutex_unlock(&(shard->lock));
+    }
+    return len;
+}
+
+int clru_update(clru* l, void* key, size_t key_len, void* value, FreeFn* fn) {
+    bool inserted;
+    size_t idx;
+    unsigned char* key_copy;
+    ht_entry* entry;
+    uint64_t hash = clru_hash(l, key, key_len);
+    clru_shard* shard = clru_shard_of(l, hash);
+    clru_write_lock(shard);
+    if (shard->cap == 0) {
+        clru_write_unlock(shard);
+        return -1;
+    }
+    entry = ht_entry_find_or_insert_hashed(&(shard->lookup), key, key_len,
+                                           hash, &inserted);
+    if (entry == NULL) {
+        clru_write_unlock(shard);
+        return -1;
+    }
+    if (!inserted) {
+        idx = *((size_t*)ht_entry_value(entry));
+        if (fn) {
+            fn(clru_value(l, shard, idx));
+        }
+        memcpy(clru_value(l, shard, idx), value, l->data_size);
+        __atomic_store_n(&(shard->slots[idx].ref), 1, __ATOMIC_RELAXED);
+        clru_write_unlock(shard);
+        return 0;
+    }
+    /**
+     * only evict once the key is in the lookup and copied, so a failure
+     * leaves the cache as it was. Evicting deletes a different key, which
+     * does not free the entry of this one
+     */
+    key_copy = malloc(key_len ? key_len : 1);
+    if (key_copy == NULL) {
+        ht_delete_hashed(&(shard->lookup), key, key_len, hash, NULL, NULL);
+        clru_write_unlock(shard);
+        return -1;
+    }
+    memcpy(key_copy, key, key_len);
+    idx = clru_evict(l, shard, fn);
+    memcpy(ht_entry_value(entry), &idx, sizeof(size_t));
+    shard->slots[idx].key = key_copy;
+    shard->slots[idx].key_len = key_len;
+    shard->slots[idx].hash = hash;
+    __atomic_store_n(&(shard->slots[idx].ref), 0, __ATOMIC_RELAXED);
+    memcpy(clru_value(l, shard, idx), value, l->data_size);
+    shard->len++;
+    clru_write_unlock(shard);
+    return 0;
+}
+
+int clru_get(clru* l, void* key, size_t key_len, void* out) {
+    uint64_t hash = clru_hash(l, key, key_len);
+    clru_shard* shard = clru_shard_of(l, hash);
+    return clru_read(l, shard, key, key_len, hash, out) ? 0 : -1;
+}
+
+void clru_free(clru* l, FreeFn* free_key, FreeFn* free_val) {
+    size_t i, j;
+    for (i = 0; i < l->num_shards; ++i) {
+        clru_shard* shard = &(l->shards[i]);
+        for (j = 0; j < shard->cap; ++j) {
+            clru_slot* slot = &(shard->slots[j]);
+            if (slot->key == NULL) {
+                continue;
+            }
+            if (free_key) {
+                free_key(slot->key);
+            }
+            if (free_val) {
+                free_val(clru_value(l, shard, j));
+            }
+            free(slot->key);
+        }
+        ht_free(&(shard->lookup), NULL, NULL);
+        vepoch_list_free(&(shard->retired));
+        free(shard->slots);
+        free(shard->values);
+        pthread_mutex_destroy(&(shard->lock));
+    }
+    free(l->shards);
+    l->shards = NULL;
+    l->num_shards = 0;
+    if (l->epoch) {
+        vepoch_free(l->epoch);
+        free(l->epoch);
+        l->epoch = NULL;
+    }
+}
+
+static uint64_t clru_hash(clru* l, void* key, size_t key_len) {
+    return l->hash_fn(key, key_len, l->seed);
+}
+
+static clru_shard* clru_shard_of(clru* l, uint64_t hash) {
+    return &(l->shards[clru_shard_idx(l, hash)]);
+}
+
+static int clru_shard_init(clru* l, clru_shard* shard, size_t cap,
+                           CmpFn* cmp_keys) {
+    if (pthread_mutex_init(&(shard->lock), NULL) != 0) {
+        return -1;
+    }
+    shard->slots = calloc(cap ? cap : 1, sizeof(clru_slot));
+    if (shard->slots == NULL) {
+        return -1;
+    }
+    shard->values = malloc((cap ? cap : 1) * (l->data_size ? l->data_size : 1));
+    if (shard->values == NULL) {
+        free(shard->slots);
+        return -1;
+    }
+    shard->lookup = ht_new_with_hash(sizeof(size_t), cmp_keys, l->hash_fn);
+    memcpy(shard->lookup.seed, l->seed, HT_SEED_SIZE);
+    ht_set_retire(&(shard->lookup), clru_retire, shard);
+    shard->seq = 0;
+    shard->epoch = l->epoch;
+    shard->retired = vepoch_list_new();
+    shard->len = 0;
+    shard->cap = cap;
+    shard->hand = 0;
+    return 0;
+}
+
+/**
+ * find a free slot, evicting one if the shard is full. Slots that were hit
+ * since the hand last passed them get a second chance, so the sweep ends
+ * after at most two passes over the shard
+ */
+static size_t clru_evict(clru* l, clru_shard* shard, FreeFn* fn) {
+    for (;;) {
+        size_t idx = shard->hand;
+        clru_slot* slot = &(shard->slots[idx]);
+        shard->hand = (shard->hand + 1) == shard->cap ? 0 : shard->hand + 1;
+        if (slot->key == NULL) {
+            return idx;
+        }
+        /* readers set the bit without the lock */
+        if (__atomic_load_n(&(slot->ref), __ATOMIC_RELAXED)) {
+            __atomic_store_n(&(slot->ref), 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        ht_delete_hashed(&(shard->lookup), slot->key, slot->key_len,
+                         slot->hash, NULL, NULL);
+        if (fn) {
+            fn(clru_value(l, shard, idx));
+        }
+        free(slot->key);
+        slot->key = NULL;
+        shard->len--;
+        return idx;
+    }
+}
+
+/**
+ * look key up without the lock, the way cht does. The index is checked
+ * against the shard before the value is copied, since a torn read may have
+ * loaded any index. The reference bit is only set once the read is known to
+ * be consistent
+ */
+static bool clru_read(clru* l, clru_shard* shard, void* key, size_t key_len,
+                      uint64_t hash, void* out) {
+    bool found = false, done = false;
+    size_t idx = 0;
+    int i;
+    vepoch_reader* reader = vepoch_enter(l->epoch);
+    for (i = 0; reader && (i < CLRU_READ_RETRIES); ++i) {
+        uint64_t seq = __atomic_load_n(&(shard->seq), __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        found = ht_read_hashed(&(shard->lookup), key, key_len, hash, &idx) &&
+                (idx < shard->cap);
+        if (found) {
+            memcpy(out, clru_value(l, shard, idx), l->data_size);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&(shard->seq), __ATOMIC_RELAXED) == seq) {
+            done = true;
+            break;
+        }
+    }
+    if (reader) {
+        vepoch_exit(reader);
+    }
+    if (!done) {
+        pthread_mutex_lock(&(shard->lock));
+        found = ht_read_hashed(&(shard->lookup), key, key_len, hash, &idx);
+        if (found) {
+            memcpy(out, clru_value(l, shard, idx), l->data_size);
+        }
+        pthread_mutex_unlock(&(shard->lock));
+    }
+    /* only write the bit when it changes so hot keys don't bounce the line */
+    if (found &&
+        (__atomic_load_n(&(shard->slots[idx].ref), __ATOMIC_RELAXED) == 0)) {
+        __atomic_store_n(&(shard->slots[idx].ref), 1, __ATOMIC_RELAXED);
+    }
+    return found;
+}
+
+static void clru_write_lock(clru_shard* shard) {
+    pthread_mutex_lock(&(shard->lock));
+    __atomic_store_n(&(shard->seq), shard->seq + 1, __ATOMIC_RELAXED);
+    /* readers that see any write of this section must see the odd number */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void clru_write_unlock(clru_shard* shard) {
+    __atomic_store_n(&(shard->seq), shard->seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&(shard->lock));
+}
+
+/* called with the lock of the shard held, so its list needs no lock */
+static void clru_retire(void* ptr, void* ctx) {
+    clru_shard* shard = ctx;
+    vepoch_retire(shard->epoch, &(shard->retired), ptr);
+}
@@ -0,0 +1,150 @@
+#include "siphash.h"
+#include "vlib.h"
+#include <memory.h>
+#include <stdint.h>
+
+/**
+ * hash functions that can be used by ht and set.
+ *
+ * hash_wyhash follows the structure of wyhash (final version 4) by Wang Yi,
+ * which is in the public domain. hash_int uses the finalizer from murmurhash3
+ */
+
+static const uint64_t wyp[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+                                0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+static uint64_t hash_seed64(const uint8_t* seed);
+static void wymum(uint64_t* a, uint64_t* b);
+static uint64_t wymix(uint64_t a, uint64_t b);
+static uint64_t wyr8(const uint8_t* p);
+static uint64_t wyr4(const uint8_t* p);
+static uint64_t wyr3(const uint8_t* p, size_t k);
+
+uint64_t hash_siphash(const void* key, size_t key_len, const uint8_t* seed) {
+    return siphash(key, key_len, seed);
+}
+
+uint64_t hash_wyhash(const void* key, size_t key_len, const uint8_t* seed) {
+    const uint8_t* p = key;
+    uint64_t a, b, s = hash_seed64(seed);
+    s ^= wymix(s ^ wyp[0], wyp[1]);
+    if (key_len <= 16) {
+        if (key_len >= 4) {
+            a = (wyr4(p) << 32) | wyr4(p + ((key_len >> 3) << 2));
+            b = (wyr4(p + key_len - 4) << 32) |
+                wyr4(p + key_len - 4 - ((key_len >> 3) << 2));
+        } else if (key_len > 0) {
+            a = wyr3(p, key_len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = key_len;
+        if (i > 48) {
+            uint64_t see1 = s, see2 = s;
+            do {
+                s = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ s);
+                see1 = wymix(wyr8(p + 16) ^ wyp[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ wyp[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            s ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            s = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ s);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+    a ^= wyp[1];
+    b ^= s;
+    wymum(&a, &b);
+    return wymix(a ^ wyp[0] ^ key_len, b ^ wyp[1]);
+}
+
+uint64_t hash_int(const void* key, size_t key_len, const uint8_t* seed) {
+    uint64_t x;
+    switch (key_len) {
+    case 8:
+        x = wyr8(key);
+        break;
+    case 4:
+        x = wyr4(key);
+        break;
+    case 2: {
+        uint16_t v;
+        memcpy(&v, key, sizeof v);
+        x = v;
+        break;
+    }
+    case 1:
+        x = *((const uint8_t*)key);
+        break;
+    default:
+        return hash_wyhash(key, key_len, seed);
+    }
+    x ^= hash_seed64(seed);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t hash_seed64(const uint8_t* seed) {
+    uint64_t hi = wyr8(seed + 8);
+    return wyr8(seed) ^ ((hi << 32) | (hi >> 32));
+}
+
+#if defined(__SIZEOF_INT128__)
+
+__extension__ typedef unsigned __int128 hash_u128;
+
+static void wymum(uint64_t* a, uint64_t* b) {
+    hash_u128 r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+
+#else
+
+static void wymum(uint64_t* a, uint64_t* b) {
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl, lo, hi;
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+    *b = hi;
+}
+
+#endif
+
+static uint64_t wymix(uint64_t a, uint64_t b) {
+    wymum(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t wyr8(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static uint64_t wyr4(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static uint64_t wyr3(const uint8_t* p, size_t k) {
+    return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
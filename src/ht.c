@@ -1,423 +1,882 @@
-#include "siphash.h"
 #include "vlib.h"
 #include <assert.h>
 #include <memory.h>
 #include <stdint.h>
 #include <stdlib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define ht_padding(size)                                                       \
     ((sizeof(void*) - ((size + 8) % sizeof(void*))) & (sizeof(void*) - 1))
 
+/**
+ * control bytes. A full slot stores the low 7 bits of the hash (h2), so the
+ * high bit is only ever set for empty and deleted slots
+ */
+#define HT_CTRL_EMPTY ((uint8_t)0x80)
+#define HT_CTRL_DELETED ((uint8_t)0xFE)
+#define ht_ctrl_is_full(c) (((c)&0x80) == 0)
+
+#define ht_value_of(entry)                                                     \
+    ((entry)->data + (entry)->key_len + ht_padding((entry)->key_len))
+
+/**
+ * fixed key tables store their entries in the slots, laid out like an
+ * ht_entry, so the entry of a slot is found without following a pointer and
+ * the key is only stored once. Entries are a multiple of 8 bytes so the hash
+ * of every one stays aligned
+ */
+#define ht_round8(n) (((n) + 7) & ~((size_t)7))
+#define ht_inline_size(ht)                                                     \
+    ((ht)->key_size ? ht_round8(sizeof(ht_entry) + (ht)->key_size +            \
+                                ht_padding((ht)->key_size) + (ht)->data_size)  \
+                    : 0)
+#define ht_slot(ht, table, idx)                                                \
+    ((table)->entries                                                          \
+         ? (ht_entry*)((table)->entries + ((idx)*ht_inline_size(ht)))         \
+         : (table)->slots[idx])
+
+#define ht_h1(hash) ((hash) >> 7)
+#define ht_h2(hash) ((uint8_t)((hash)&0x7F))
+
+/* the table is grown once it is 7/8 full, counting tombstones */
+#define ht_max_load(cap) ((cap) - ((cap) >> 3))
+
+/* the number of slots migrated from the old table per write operation */
+#define HT_REHASH_STEP HT_GROUP_WIDTH
+
+#define ht_is_rehashing(ht) ((ht)->rehash_idx != -1)
+
+/* the number of keys ht_get_many hashes and prefetches before resolving */
+#define HT_BATCH_SIZE 16
+
+/**
+ * the allocation of a table starts with its capacity, so a reader that only
+ * loaded the control bytes pointer knows how far it can probe. The header is
+ * 16 bytes so the control bytes keep the alignment of the allocation
+ */
+#define HT_BLOCK_HEADER 16
+#define ht_block_of(ctrl) ((ctrl) ? (ctrl)-HT_BLOCK_HEADER : NULL)
+#define ht_block_cap(ctrl) (*((size_t*)ht_block_of(ctrl)))
+
 static uint64_t ht_hash(ht* ht, void* key, size_t key_len);
 static int ht_resize(ht* ht);
-static int ht_init_bucket(ht_bucket* bucket);
-static int ht_realloc_bucket(ht_bucket* bucket);
-static void ht_bucket_remove(ht_bucket* bucket, size_t idx, FreeFn* free_key,
+static int ht_rehash_to(ht* ht, size_t cap);
+static size_t ht_cap_for(size_t n);
+static void ht_rehash_step(ht* ht, size_t n);
+static ht ht_init(size_t data_size, size_t key_size, size_t cap,
+                  CmpFn* cmp_key, HashFn* hash_fn);
+static int ht_table_init(ht_table* table, size_t cap, size_t inline_size);
+static bool ht_lookup(ht* ht, void* key, size_t key_len, uint64_t hash,
+                      ht_table** table, size_t* idx, size_t* insert_idx);
+static bool ht_find(ht* ht, ht_table* table, void* key, size_t key_len,
+                    uint64_t hash, size_t* idx, size_t* insert_idx);
+static size_t ht_find_insert_slot(ht_table* table, uint64_t hash);
+static bool ht_read_table(ht* ht, ht_table* table, void* key, size_t key_len,
+                          uint64_t hash, void* out);
+static void ht_release_entry(ht* ht, ht_entry* entry, FreeFn* free_key,
                              FreeFn* free_val);
-static void ht_bucket_free(ht_bucket* bucket, FreeFn* free_key,
-                           FreeFn* free_val);
+static void ht_release_table(ht* ht, ht_table* table);
+static void ht_table_remove(ht_table* table, size_t idx);
+static void ht_table_insert(ht* ht, ht_table* table, size_t idx,
+                            ht_entry* entry, uint64_t hash);
+static ht_entry* ht_insert_new(ht* ht, void* key, size_t key_len,
+                               uint64_t hash, size_t idx);
+static size_t ht_scan_group(ht* ht, ht_table* table, size_t home,
+                            ScanFn* fn, void* ctx);
+static void ht_prefetch_group(ht_table* table, uint64_t hash);
+static void ht_prefetch_entries(ht* ht, ht_table* table, uint64_t hash);
+static void ht_entry_release_data(ht_entry* entry, FreeFn* free_key,
+                                  FreeFn* free_val);
+static uint32_t ht_group_match(const uint8_t* group, uint8_t h2);
+static uint32_t ht_group_match_empty(const uint8_t* group);
+static uint32_t ht_group_match_empty_or_deleted(const uint8_t* group);
 
 ht ht_new(size_t data_size, CmpFn* cmp_key) {
-    ht ht = {0};
-    ht.buckets = calloc(HT_INITIAL_CAP, sizeof(ht_bucket));
-    assert(ht.buckets != NULL);
-    ht.cap = HT_INITIAL_CAP;
-    ht.len = 0;
-    ht.data_size = data_size;
-    ht.cmp_key = cmp_key;
-    get_random_bytes(ht.seed, HT_SEED_SIZE);
+    return ht_new_with_hash(data_size, cmp_key, NULL);
+}
+
+ht ht_new_with_hash(size_t data_size, CmpFn* cmp_key, HashFn* hash_fn) {
+    return ht_init(data_size, 0, 0, cmp_key, hash_fn);
+}
+
+ht ht_new_with_capacity(size_t data_size, CmpFn* cmp_key, size_t cap) {
+    return ht_init(data_size, 0, cap, cmp_key, NULL);
+}
+
+ht ht_new_fixed(size_t key_size, size_t data_size) {
+    assert(key_size > 0);
+    return ht_init(data_size, key_size, 0, NULL, NULL);
+}
+
+ht ht_new_with_arena(size_t data_size, CmpFn* cmp_key, varena* arena) {
+    ht ht = ht_new_with_hash(data_size, cmp_key, NULL);
+    ht.arena = arena;
     return ht;
 }
 
+void ht_set_retire(ht* ht, RetireFn* fn, void* ctx) {
+    assert((ht->arena == NULL) && (ht->key_size == 0));
+    ht->retire = fn;
+    ht->retire_ctx = ctx;
+}
+
 size_t ht_len(ht* ht) { return ht->len; }
 
-bool ht_has(ht* ht, void* key, size_t key_len) {
-    uint64_t hash = ht_hash(ht, key, key_len);
-    ht_bucket bucket = ht->buckets[hash];
-    size_t i, len = bucket.len, cap = bucket.cap;
-    if (cap == 0) {
-        return false;
-    }
-    for (i = 0; i < len; ++i) {
-        ht_entry* cur = bucket.entries[i];
-        if (ht->cmp_key) {
-            int cmp = ht->cmp_key(key, cur->data);
-            if (cmp == 0) {
-                return true;
-            }
-        } else {
-            size_t cur_key_len = cur->key_len;
-            if ((cur_key_len == key_len) &&
-                (memcmp(key, cur->data, key_len) == 0)) {
-                return true;
-            }
-        }
+int ht_reserve(ht* ht, size_t n) {
+    ht_table* table = &(ht->tables[ht_is_rehashing(ht) ? 1 : 0]);
+    if (n <= ht_max_load(table->cap)) {
+        return 0;
     }
-    return false;
+    return ht_rehash_to(ht, ht_cap_for(n));
 }
 
-int ht_insert(ht* ht, void* key, size_t key_len, void* value, FreeFn* fn) {
-    uint64_t hash;
-    ht_bucket* bucket;
-    ht_entry* entry;
-    size_t i, len, cap, data_size = ht->data_size;
-    if (ht->len >= ht->cap) {
-        if (ht_resize(ht) == -1) {
-            return -1;
-        }
+int ht_shrink_to_fit(ht* ht) {
+    size_t cap = ht_cap_for(ht->len);
+    if (ht_is_rehashing(ht)) {
+        ht_rehash_step(ht, ht->tables[0].cap);
     }
-    hash = ht_hash(ht, key, key_len);
-    bucket = &(ht->buckets[hash]);
-    len = bucket->len;
-    cap = bucket->cap;
-    if (cap == 0) {
-        int init_res = ht_init_bucket(bucket);
-        if (init_res == -1) {
-            return -1;
-        }
-        entry = ht_entry_new(key, key_len, value, data_size);
-        if (entry == NULL) {
-            return -1;
-        }
-        bucket->entries[0] = entry;
-        bucket->len++;
-        ht->len++;
+    if ((cap >= ht->tables[0].cap) && (ht->tables[0].deleted == 0)) {
         return 0;
     }
-
-    if (len == 0) {
-        entry = ht_entry_new(key, key_len, value, data_size);
-        if (entry == NULL) {
-            return -1;
-        }
-        bucket->entries[0] = entry;
-        bucket->len++;
-        ht->len++;
-        return 0;
-    }
-
-    for (i = 0; i < len; ++i) {
-        ht_entry* cur = bucket->entries[i];
-        if (ht->cmp_key) {
-            int cmp = ht->cmp_key(cur->data, key);
-            if (cmp == 0) {
-                size_t offset = key_len + ht_padding(key_len);
-                if (fn) {
-                    void* ptr = cur->data + offset;
-                    fn(ptr);
-                }
-                memcpy(cur->data + offset, value, data_size);
-                return 0;
-            }
-        } else {
-            size_t cur_key_len = cur->key_len;
-            if ((key_len == cur_key_len) &&
-                (memcmp(key, cur->data, key_len) == 0)) {
-                size_t offset = key_len + ht_padding(key_len);
-                void* ptr = cur->data + offset;
-                if (fn) {
-                    fn(ptr);
-                }
-                memcpy(cur->data + offset, value, data_size);
-                return 0;
-            }
-        }
+    if (ht_rehash_to(ht, cap) == -1) {
+        return -1;
     }
+    /**
+     * inserts only check the load of the new table, which would not leave
+     * room for the entries still in the old one, so shrinking is not spread
+     * over later operations
+     */
+    ht_rehash_step(ht, ht->tables[0].cap);
+    return 0;
+}
 
-    if (len == cap) {
-        int realloc_bucket_res = ht_realloc_bucket(bucket);
-        if (realloc_bucket_res == -1) {
-            return -1;
-        }
-    }
+bool ht_has(ht* ht, void* key, size_t key_len) {
+    ht_table* table;
+    size_t idx;
+    uint64_t hash = ht_hash(ht, key, key_len);
+    return ht_lookup(ht, key, key_len, hash, &table, &idx, NULL);
+}
 
-    entry = ht_entry_new(key, key_len, value, data_size);
+int ht_insert(ht* ht, void* key, size_t key_len, void* value, FreeFn* fn) {
+    bool inserted;
+    void* ptr;
+    ht_entry* entry = ht_entry_find_or_insert(ht, key, key_len, &inserted);
     if (entry == NULL) {
         return -1;
     }
-
-    bucket->entries[len] = entry;
-    bucket->len++;
-    ht->len++;
+    ptr = ht_value_of(entry);
+    if (!inserted && fn) {
+        fn(ptr);
+    }
+    memcpy(ptr, value, ht->data_size);
     return 0;
 }
 
 int ht_try_insert(ht* ht, void* key, size_t key_len, void* value) {
-    uint64_t hash;
-    ht_bucket* bucket;
-    ht_entry* entry;
-    size_t i, len, cap, data_size = ht->data_size;
-    if (ht->len >= ht->cap) {
-        if (ht_resize(ht) == -1) {
-            return -1;
-        }
-    }
-    hash = ht_hash(ht, key, key_len);
-    bucket = &(ht->buckets[hash]);
-    len = bucket->len;
-    cap = bucket->cap;
-    if (cap == 0) {
-        int init_res = ht_init_bucket(bucket);
-        if (init_res == -1) {
-            return -1;
-        }
-        entry = ht_entry_new(key, key_len, value, data_size);
-        if (entry == NULL) {
-            return -1;
-        }
-        bucket->entries[0] = entry;
-        bucket->len++;
-        ht->len++;
-        return 0;
+    bool inserted;
+    ht_entry* entry = ht_entry_find_or_insert(ht, key, key_len, &inserted);
+    if ((entry == NULL) || !inserted) {
+        return -1;
     }
+    memcpy(ht_value_of(entry), value, ht->data_size);
+    return 0;
+}
 
-    if (len == 0) {
-        entry = ht_entry_new(key, key_len, value, data_size);
-        if (entry == NULL) {
-            return -1;
-        }
-        bucket->entries[0] = entry;
-        bucket->len++;
-        ht->len++;
-        return 0;
-    }
+void* ht_emplace(ht* ht, void* key, size_t key_len) {
+    bool inserted;
+    void* value = ht_get_or_insert_slot(ht, key, key_len, &inserted);
+    return inserted ? value : NULL;
+}
 
-    for (i = 0; i < len; ++i) {
-        ht_entry* cur = bucket->entries[i];
-        if (ht->cmp_key) {
-            int cmp = ht->cmp_key(cur->data, key);
-            if (cmp == 0) {
-                return -1;
-            }
-        } else {
-            size_t cur_key_len = cur->key_len;
-            if ((key_len == cur_key_len) &&
-                (memcmp(key, cur->data, key_len) == 0)) {
-                return -1;
-            }
-        }
-    }
+void* ht_get_or_insert_slot(ht* ht, void* key, size_t key_len,
+                            bool* inserted) {
+    ht_entry* entry = ht_entry_find_or_insert(ht, key, key_len, inserted);
+    return entry ? ht_value_of(entry) : NULL;
+}
 
-    if (len == cap) {
-        int realloc_bucket_res = ht_realloc_bucket(bucket);
-        if (realloc_bucket_res == -1) {
-            return -1;
-        }
+ht_entry* ht_entry_find_or_insert(ht* ht, void* key, size_t key_len,
+                                  bool* inserted) {
+    uint64_t hash = ht_hash(ht, key, key_len);
+    return ht_entry_find_or_insert_hashed(ht, key, key_len, hash, inserted);
+}
+
+ht_entry* ht_entry_find_or_insert_hashed(ht* ht, void* key, size_t key_len,
+                                         uint64_t hash, bool* inserted) {
+    ht_table* table;
+    size_t idx, insert_idx;
+    ht_entry* entry;
+    *inserted = false;
+    if (ht->key_size && (key_len != ht->key_size)) {
+        return NULL;
+    }
+    if (ht_lookup(ht, key, key_len, hash, &table, &idx, &insert_idx)) {
+        return ht_slot(ht, table, idx);
+    }
+    entry = ht_insert_new(ht, key, key_len, hash, insert_idx);
+    if (entry == NULL) {
+        return NULL;
     }
+    /**
+     * only inserts move the rehash along, after the insert so the slot found
+     * by the lookup is still free. Hits don't write to the table at all
+     */
+    if (ht_is_rehashing(ht)) {
+        ht_rehash_step(ht, HT_REHASH_STEP);
+    }
+    *inserted = true;
+    return entry;
+}
 
-    entry = ht_entry_new(key, key_len, value, data_size);
+int ht_update(ht* ht, void* key, size_t key_len, UpdateFn* fn, void* ctx) {
+    bool inserted;
+    ht_entry* entry = ht_entry_find_or_insert(ht, key, key_len, &inserted);
     if (entry == NULL) {
         return -1;
     }
-
-    bucket->entries[len] = entry;
-    bucket->len++;
-    ht->len++;
-
+    fn(ht_value_of(entry), inserted, ctx);
     return 0;
 }
 
 void* ht_get(ht* ht, void* key, size_t key_len) {
     uint64_t hash = ht_hash(ht, key, key_len);
-    ht_bucket bucket = ht->buckets[hash];
-    size_t i, len = bucket.len, cap = bucket.cap;
-    if (cap == 0) {
+    return ht_get_hashed(ht, key, key_len, hash);
+}
+
+void* ht_get_hashed(ht* ht, void* key, size_t key_len, uint64_t hash) {
+    ht_table* table;
+    size_t idx;
+    if (!ht_lookup(ht, key, key_len, hash, &table, &idx, NULL)) {
         return NULL;
     }
-    for (i = 0; i < len; ++i) {
-        ht_entry* cur = bucket.entries[i];
-        if (ht->cmp_key) {
-            int cmp = ht->cmp_key(key, cur->data);
-            if (cmp == 0) {
-                size_t offset = key_len + ht_padding(key_len);
-                void* ptr = cur->data + offset;
-                return ptr;
+    return ht_value_of(ht_slot(ht, table, idx));
+}
+
+bool ht_read_hashed(ht* ht, void* key, size_t key_len, uint64_t hash,
+                    void* out) {
+    ssize_t rehash_idx = __atomic_load_n(&(ht->rehash_idx), __ATOMIC_ACQUIRE);
+    assert(ht->key_size == 0);
+    if (ht_read_table(ht, &(ht->tables[0]), key, key_len, hash, out)) {
+        return true;
+    }
+    return (rehash_idx != -1) &&
+           ht_read_table(ht, &(ht->tables[1]), key, key_len, hash, out);
+}
+
+size_t ht_get_many(ht* ht, void** keys, size_t* key_lens, size_t n,
+                   void** out) {
+    uint64_t hashes[HT_BATCH_SIZE];
+    size_t i, j, found = 0;
+    size_t num_tables = ht_is_rehashing(ht) ? 2 : 1;
+    for (i = 0; i < n; i += HT_BATCH_SIZE) {
+        size_t t, batch = (n - i) < HT_BATCH_SIZE ? (n - i) : HT_BATCH_SIZE;
+        for (j = 0; j < batch; ++j) {
+            hashes[j] = ht_hash(ht, keys[i + j], key_lens[i + j]);
+            for (t = 0; t < num_tables; ++t) {
+                ht_prefetch_group(&(ht->tables[t]), hashes[j]);
+            }
+        }
+        for (j = 0; j < batch; ++j) {
+            for (t = 0; t < num_tables; ++t) {
+                ht_prefetch_entries(ht, &(ht->tables[t]), hashes[j]);
             }
-        } else {
-            size_t cur_key_len = cur->key_len;
-            if ((cur_key_len == key_len) &&
-                (memcmp(key, cur->data, key_len) == 0)) {
-                size_t offset = key_len + ht_padding(key_len);
-                void* ptr = cur->data + offset;
-                return ptr;
+        }
+        for (j = 0; j < batch; ++j) {
+            ht_table* table;
+            size_t idx;
+            if (!ht_lookup(ht, keys[i + j], key_lens[i + j], hashes[j], &table,
+                           &idx, NULL)) {
+                out[i + j] = NULL;
+                continue;
             }
+            out[i + j] = ht_value_of(ht_slot(ht, table, idx));
+            found++;
         }
     }
-    return NULL;
+    return found;
 }
 
 int ht_delete(ht* ht, void* key, size_t key_len, FreeFn* free_key,
               FreeFn* free_val) {
     uint64_t hash = ht_hash(ht, key, key_len);
-    ht_bucket* bucket = &(ht->buckets[hash]);
-    size_t i, len = bucket->len;
-    if (len == 0) {
+    return ht_delete_hashed(ht, key, key_len, hash, free_key, free_val);
+}
+
+int ht_delete_hashed(ht* ht, void* key, size_t key_len, uint64_t hash,
+                     FreeFn* free_key, FreeFn* free_val) {
+    ht_table* table;
+    size_t idx;
+    if (ht_is_rehashing(ht)) {
+        ht_rehash_step(ht, HT_REHASH_STEP);
+    }
+    if (!ht_lookup(ht, key, key_len, hash, &table, &idx, NULL)) {
         return -1;
     }
+    ht_release_entry(ht, ht_slot(ht, table, idx), free_key, free_val);
+    ht_table_remove(table, idx);
+    ht->len--;
+    return 0;
+}
+
+size_t ht_scan(ht* ht, size_t cursor, size_t count, ScanFn* fn, void* ctx) {
+    size_t found = 0;
+    do {
+        ht_table* small = &(ht->tables[0]);
+        ht_table* large = &(ht->tables[1]);
+        size_t small_mask, large_mask;
+        if (!ht_is_rehashing(ht)) {
+            small_mask = (small->cap / HT_GROUP_WIDTH) - 1;
+            found += ht_scan_group(ht, small, cursor & small_mask, fn, ctx);
+            cursor = scan_cursor_next(cursor, small_mask);
+            continue;
+        }
+        if (small->cap > large->cap) {
+            small = &(ht->tables[1]);
+            large = &(ht->tables[0]);
+        }
+        small_mask = (small->cap / HT_GROUP_WIDTH) - 1;
+        large_mask = (large->cap / HT_GROUP_WIDTH) - 1;
+        found += ht_scan_group(ht, small, cursor & small_mask, fn, ctx);
+        /* visit every group of the larger table that the group expands to */
+        do {
+            found += ht_scan_group(ht, large, cursor & large_mask, fn, ctx);
+            cursor = scan_cursor_next(cursor, large_mask);
+        } while (cursor & (small_mask ^ large_mask));
+    } while ((cursor != 0) && (found < count));
+    return cursor;
+}
 
-    for (i = 0; i < len; ++i) {
-        ht_entry* cur = bucket->entries[i];
-        if (ht->cmp_key) {
-            int cmp = ht->cmp_key(key, cur->data);
-            if (cmp == 0) {
-                ht_bucket_remove(bucket, i, free_key, free_val);
-                ht->len--;
-                return 0;
+void ht_free(ht* ht, FreeFn* free_key, FreeFn* free_val) {
+    size_t i, j;
+    for (i = 0; i < 2; ++i) {
+        ht_table* table = &(ht->tables[i]);
+        for (j = 0; j < table->cap; ++j) {
+            if (!ht_ctrl_is_full(table->ctrl[j])) {
+                continue;
             }
-        } else {
-            size_t cur_key_len = cur->key_len;
-            if ((cur_key_len == key_len) &&
-                (memcmp(key, cur->data, key_len) == 0)) {
-                ht_bucket_remove(bucket, i, free_key, free_val);
-                ht->len--;
-                return 0;
+            if (table->entries) {
+                ht_entry_release_data(ht_slot(ht, table, j), free_key,
+                                      free_val);
+                continue;
             }
+            ht_entry_free(table->slots[j], free_key, free_val, ht->arena);
         }
+        free(ht_block_of(table->ctrl));
     }
-    return -1;
 }
 
-void ht_free(ht* ht, FreeFn* free_key, FreeFn* free_val) {
-    size_t i, len = ht->cap;
-    for (i = 0; i < len; ++i) {
-        ht_bucket bucket = ht->buckets[i];
-        ht_bucket_free(&bucket, free_key, free_val);
-    }
-    free(ht->buckets);
+void ht_free_tables(ht* ht) {
+    free(ht_block_of(ht->tables[0].ctrl));
+    free(ht_block_of(ht->tables[1].ctrl));
+}
+
+static ht ht_init(size_t data_size, size_t key_size, size_t cap,
+                  CmpFn* cmp_key, HashFn* hash_fn) {
+    ht ht = {0};
+    int init_res;
+    ht.len = 0;
+    ht.rehash_idx = -1;
+    ht.data_size = data_size;
+    ht.key_size = key_size;
+    init_res =
+        ht_table_init(&ht.tables[0], ht_cap_for(cap), ht_inline_size(&ht));
+    assert(init_res == 0);
+    (void)init_res;
+    ht.cmp_key = cmp_key;
+    ht.hash_fn = hash_fn ? hash_fn : hash_siphash;
+    get_random_bytes(ht.seed, HT_SEED_SIZE);
+    return ht;
 }
 
 static uint64_t ht_hash(ht* ht, void* key, size_t key_len) {
-    return siphash(key, key_len, ht->seed) % ht->cap;
+    return ht->hash_fn(key, key_len, ht->seed);
 }
 
-static int ht_resize(ht* ht) {
-    size_t i, old_cap = ht->cap;
-    size_t new_cap = old_cap << 1;
-    void* tmp = realloc(ht->buckets, new_cap * sizeof(ht_bucket));
-    if (tmp == NULL) {
-        return -1;
+/**
+ * look for key in both tables. While rehashing, entries that have not been
+ * migrated yet are still in tables[0]. If insert_idx is not null and key is
+ * not found, it is set to the slot key would be inserted at in the table new
+ * keys go to, so inserting after a miss doesn't probe again
+ */
+static bool ht_lookup(ht* ht, void* key, size_t key_len, uint64_t hash,
+                      ht_table** table, size_t* idx, size_t* insert_idx) {
+    bool rehashing = ht_is_rehashing(ht);
+    if (ht->key_size && (key_len != ht->key_size)) {
+        return false;
     }
-    ht->buckets = tmp;
-    memset(&(ht->buckets[old_cap]), 0, (new_cap - old_cap) * sizeof(ht_bucket));
-    for (i = 0; i < old_cap; ++i) {
-        ht_bucket* bucket = &(ht->buckets[i]);
-        size_t j, len = bucket->len;
-        for (j = 0; j < len; ++j) {
-            ht_entry* entry = bucket->entries[j];
-            size_t key_len = entry->key_len;
-            uint64_t hash = ht_hash(ht, entry->data, key_len);
-            if (hash == i) {
-                size_t k;
-                for (k = 0; k < j; ++k) {
-                    ht_entry* cur = bucket->entries[k];
-                    if (!cur) {
-                        memmove(&(bucket->entries[k]), &(bucket->entries[j]),
-                                sizeof(ht_entry*));
-                        memset(&(bucket->entries[j]), 0, sizeof(ht_entry*));
-                        goto next;
-                    }
-                }
-                goto next;
-            } else {
-                ht_bucket* new_bucket = &(ht->buckets[hash]);
-                size_t new_bucket_len = new_bucket->len,
-                       new_bucket_cap = new_bucket->cap;
-                if (new_bucket_cap == 0) {
-                    if (ht_init_bucket(new_bucket) == -1) {
-                        return -1;
-                    }
-                    new_bucket_cap = new_bucket->cap;
-                }
-                if (new_bucket->len == 0) {
-                    new_bucket->entries[0] = entry;
-                    memset(&(bucket->entries[j]), 0, sizeof(ht_entry*));
-                    new_bucket->len++;
-                    bucket->len--;
-                    goto next;
+    if (ht_find(ht, &(ht->tables[0]), key, key_len, hash, idx,
+                rehashing ? NULL : insert_idx)) {
+        *table = &(ht->tables[0]);
+        return true;
+    }
+    if (rehashing &&
+        ht_find(ht, &(ht->tables[1]), key, key_len, hash, idx, insert_idx)) {
+        *table = &(ht->tables[1]);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * probe for key. Groups of HT_GROUP_WIDTH control bytes are visited in
+ * triangular order, which touches every group when the number of groups is a
+ * power of two. Only slots whose control byte matches h2 are compared.
+ *
+ * If insert_idx is not null, the first empty or deleted slot on the way is
+ * recorded in it, which is the slot ht_find_insert_slot would return. The
+ * probe of a miss ends at a group with an empty slot, so it is always set
+ * when key is not found
+ */
+static bool ht_find(ht* ht, ht_table* table, void* key, size_t key_len,
+                    uint64_t hash, size_t* idx, size_t* insert_idx) {
+    size_t mask = (table->cap / HT_GROUP_WIDTH) - 1;
+    size_t group = ht_h1(hash) & mask, step = 0;
+    uint8_t h2 = ht_h2(hash);
+    for (;;) {
+        const uint8_t* ctrl = table->ctrl + (group * HT_GROUP_WIDTH);
+        uint32_t match = ht_group_match(ctrl, h2);
+        while (match) {
+            size_t i = (group * HT_GROUP_WIDTH) + __builtin_ctz(match);
+            ht_entry* cur;
+            if (table->entries) {
+                /* fixed size keys are in the slot, compared a word at a time */
+                if (key_eq_fixed(key, ht_slot(ht, table, i)->data,
+                                 ht->key_size)) {
+                    *idx = i;
+                    return true;
                 }
-                if (new_bucket_len == new_bucket_cap) {
-                    if (ht_realloc_bucket(new_bucket) == -1) {
-                        return -1;
-                    }
+                match &= match - 1;
+                continue;
+            }
+            cur = table->slots[i];
+            if (cur->hash != hash) {
+                match &= match - 1;
+                continue;
+            }
+            if (ht->cmp_key) {
+                if (ht->cmp_key(key, cur->data) == 0) {
+                    *idx = i;
+                    return true;
                 }
-                memmove(&(new_bucket->entries[new_bucket_len]),
-                        &(bucket->entries[j]), sizeof(ht_entry*));
-                memset(&(bucket->entries[j]), 0, sizeof(ht_entry*));
-                new_bucket->len++;
-                bucket->len--;
+            } else if ((cur->key_len == key_len) &&
+                       (memcmp(key, cur->data, key_len) == 0)) {
+                *idx = i;
+                return true;
+            }
+            match &= match - 1;
+        }
+        if (insert_idx) {
+            uint32_t free_slots = ht_group_match_empty_or_deleted(ctrl);
+            if (free_slots) {
+                *insert_idx =
+                    (group * HT_GROUP_WIDTH) + __builtin_ctz(free_slots);
+                insert_idx = NULL;
             }
-        next:
-            continue;
         }
+        if (ht_group_match_empty(ctrl)) {
+            return false;
+        }
+        step++;
+        group = (group + step) & mask;
     }
-    return 0;
 }
 
-static int ht_init_bucket(ht_bucket* bucket) {
-    bucket->entries = calloc(HT_BUCKET_INITIAL_CAP, sizeof(ht_entry*));
-    if (bucket->entries == NULL) {
+/**
+ * ht_find for a reader that doesn't hold the lock of the writer. Only the
+ * control bytes pointer is loaded from the table, and the capacity comes from
+ * the allocation it points to, so a table that is being swapped is probed
+ * within its bounds. Memory the writer drops is retired rather than freed, so
+ * every pointer loaded stays valid. A slot's entry is published before its
+ * control byte, so a full control byte means the slot is either set or was
+ * just cleared. The probe is bounded by the number of groups, since a table
+ * that is being written to may not have an empty group on the way
+ */
+static bool ht_read_table(ht* ht, ht_table* table, void* key, size_t key_len,
+                          uint64_t hash, void* out) {
+    uint8_t* block_ctrl = __atomic_load_n(&(table->ctrl), __ATOMIC_ACQUIRE);
+    size_t cap, mask, group, step;
+    ht_entry** slots;
+    uint8_t h2 = ht_h2(hash);
+    if (block_ctrl == NULL) {
+        return false;
+    }
+    cap = ht_block_cap(block_ctrl);
+    slots = (ht_entry**)(block_ctrl + cap);
+    mask = (cap / HT_GROUP_WIDTH) - 1;
+    group = ht_h1(hash) & mask;
+    for (step = 0; step <= mask; ++step) {
+        const uint8_t* ctrl = block_ctrl + (group * HT_GROUP_WIDTH);
+        uint32_t match = ht_group_match(ctrl, h2);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        while (match) {
+            size_t i = (group * HT_GROUP_WIDTH) + __builtin_ctz(match);
+            ht_entry* cur = __atomic_load_n(&(slots[i]), __ATOMIC_ACQUIRE);
+            match &= match - 1;
+            if ((cur == NULL) || (cur->hash != hash)) {
+                continue;
+            }
+            if (ht->cmp_key ? (ht->cmp_key(key, cur->data) != 0)
+                            : ((cur->key_len != key_len) ||
+                               (memcmp(key, cur->data, key_len) != 0))) {
+                continue;
+            }
+            if (out) {
+                memcpy(out, ht_value_of(cur), ht->data_size);
+            }
+            return true;
+        }
+        if (ht_group_match_empty(ctrl)) {
+            return false;
+        }
+        group = (group + step + 1) & mask;
+    }
+    return false;
+}
+
+/**
+ * call fn with every entry whose home is group home. Those entries are all on
+ * the probe sequence that starts at that group, so it is followed the same
+ * way ht_find does
+ */
+static size_t ht_scan_group(ht* ht, ht_table* table, size_t home,
+                            ScanFn* fn, void* ctx) {
+    size_t mask = (table->cap / HT_GROUP_WIDTH) - 1;
+    size_t group = home, step = 0, found = 0;
+    for (;;) {
+        const uint8_t* ctrl = table->ctrl + (group * HT_GROUP_WIDTH);
+        size_t i;
+        for (i = 0; i < HT_GROUP_WIDTH; ++i) {
+            ht_entry* cur;
+            if (!ht_ctrl_is_full(ctrl[i])) {
+                continue;
+            }
+            cur = ht_slot(ht, table, (group * HT_GROUP_WIDTH) + i);
+            if ((ht_h1(cur->hash) & mask) == home) {
+                fn(cur->data, cur->key_len, ht_value_of(cur), ctx);
+                found++;
+            }
+        }
+        if (ht_group_match_empty(ctrl)) {
+            return found;
+        }
+        step++;
+        group = (group + step) & mask;
+    }
+}
+
+/**
+ * prefetch the control bytes and slots of the first group hash probes, so
+ * that the group is in cache by the time ht_prefetch_entries matches it
+ */
+static void ht_prefetch_group(ht_table* table, uint64_t hash) {
+    size_t mask = (table->cap / HT_GROUP_WIDTH) - 1;
+    size_t first = (ht_h1(hash) & mask) * HT_GROUP_WIDTH;
+    prefetch(table->ctrl + first);
+    if (table->entries) {
+        /* the matching entries are prefetched once the group is matched */
+        return;
+    }
+    prefetch(table->slots + first);
+    prefetch(table->slots + first + (HT_GROUP_WIDTH / 2));
+}
+
+/**
+ * prefetch the entries in the first group whose control byte matches hash.
+ * Most lookups are resolved by one of these entries
+ */
+static void ht_prefetch_entries(ht* ht, ht_table* table, uint64_t hash) {
+    size_t mask = (table->cap / HT_GROUP_WIDTH) - 1;
+    size_t first = (ht_h1(hash) & mask) * HT_GROUP_WIDTH;
+    uint32_t match = ht_group_match(table->ctrl + first, ht_h2(hash));
+    while (match) {
+        prefetch(ht_slot(ht, table, first + __builtin_ctz(match)));
+        match &= match - 1;
+    }
+}
+
+static size_t ht_find_insert_slot(ht_table* table, uint64_t hash) {
+    size_t mask = (table->cap / HT_GROUP_WIDTH) - 1;
+    size_t group = ht_h1(hash) & mask, step = 0;
+    for (;;) {
+        uint32_t match = ht_group_match_empty_or_deleted(
+            table->ctrl + (group * HT_GROUP_WIDTH));
+        if (match) {
+            return (group * HT_GROUP_WIDTH) + __builtin_ctz(match);
+        }
+        step++;
+        group = (group + step) & mask;
+    }
+}
+
+/**
+ * put entry in slot idx. Inline entries are copied into the slot, unless they
+ * were written there in place
+ */
+static void ht_table_insert(ht* ht, ht_table* table, size_t idx,
+                            ht_entry* entry, uint64_t hash) {
+    if (table->ctrl[idx] == HT_CTRL_DELETED) {
+        table->deleted--;
+    }
+    if (table->entries) {
+        ht_entry* slot = ht_slot(ht, table, idx);
+        if (slot != entry) {
+            memcpy(slot, entry, ht_inline_size(ht));
+        }
+    } else {
+        /* readers that see the control byte must see the entry */
+        __atomic_store_n(&(table->slots[idx]), entry, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&(table->ctrl[idx]), ht_h2(hash), __ATOMIC_RELEASE);
+    table->len++;
+}
+
+static void ht_table_remove(ht_table* table, size_t idx) {
+    size_t group = idx & ~((size_t)HT_GROUP_WIDTH - 1);
+    if (table->slots) {
+        table->slots[idx] = NULL;
+    }
+    table->len--;
+    /**
+     * a probe only stops at a group that has an empty slot, so if this group
+     * already has one, no probe sequence can run through this slot and it
+     * can be marked empty rather than deleted
+     */
+    if (ht_group_match_empty(table->ctrl + group)) {
+        table->ctrl[idx] = HT_CTRL_EMPTY;
+        return;
+    }
+    table->ctrl[idx] = HT_CTRL_DELETED;
+    table->deleted++;
+}
+
+/**
+ * insert a key that is not in the table at idx, the slot found by the lookup
+ * that missed it. The slot is looked up again if the table has to grow. The
+ * value of the new entry is left uninitialized
+ */
+static ht_entry* ht_insert_new(ht* ht, void* key, size_t key_len,
+                               uint64_t hash, size_t idx) {
+    ht_entry* entry;
+    ht_table* table = &(ht->tables[ht_is_rehashing(ht) ? 1 : 0]);
+    if ((table->len + table->deleted) >= ht_max_load(table->cap)) {
+        if (ht_resize(ht) == -1) {
+            return NULL;
+        }
+        table = &(ht->tables[ht_is_rehashing(ht) ? 1 : 0]);
+        idx = ht_find_insert_slot(table, hash);
+    }
+    if (table->entries) {
+        /* the entry is written in the slot it goes to */
+        entry = ht_slot(ht, table, idx);
+        entry->hash = hash;
+        entry->key_len = key_len;
+        memcpy(entry->data, key, key_len);
+    } else {
+        entry =
+            ht_entry_new(key, key_len, hash, NULL, ht->data_size, ht->arena);
+        if (entry == NULL) {
+            return NULL;
+        }
+    }
+    ht_table_insert(ht, table, idx, entry, hash);
+    ht->len++;
+    return entry;
+}
+
+/**
+ * start growing the table. A new table is allocated in tables[1], and the
+ * entries are migrated a few slots at a time by the write operations that
+ * follow, so no single insert pays for rehashing the whole table. If most of
+ * the load is tombstones, the new table has the same capacity
+ */
+static int ht_resize(ht* ht) {
+    size_t new_cap;
+    if (ht_is_rehashing(ht)) {
+        ht_rehash_step(ht, ht->tables[0].cap);
+    }
+    new_cap = ht->tables[0].cap << 1;
+    if (ht->len < (ht_max_load(ht->tables[0].cap) >> 1)) {
+        new_cap = ht->tables[0].cap;
+    }
+    return ht_rehash_to(ht, new_cap);
+}
+
+/**
+ * start migrating the entries to a new table of cap slots, after finishing
+ * the migration in progress, if any
+ */
+static int ht_rehash_to(ht* ht, size_t cap) {
+    if (ht_is_rehashing(ht)) {
+        ht_rehash_step(ht, ht->tables[0].cap);
+    }
+    if (ht_table_init(&(ht->tables[1]), cap, ht_inline_size(ht)) == -1) {
         return -1;
     }
-    bucket->cap = HT_BUCKET_INITIAL_CAP;
+    __atomic_store_n(&(ht->rehash_idx), 0, __ATOMIC_RELEASE);
+    /* there is nothing to spread out when the table is empty */
+    ht_rehash_step(ht, ht->len ? HT_REHASH_STEP : ht->tables[0].cap);
     return 0;
 }
 
-static int ht_realloc_bucket(ht_bucket* bucket) {
-    size_t len = bucket->len, new_cap = bucket->cap << 1;
-    void* tmp = realloc(bucket->entries, new_cap * sizeof(ht_entry*));
-    if (tmp == NULL) {
+/* the smallest capacity that holds n entries without growing */
+static size_t ht_cap_for(size_t n) {
+    size_t cap = HT_INITIAL_CAP;
+    while (n > ht_max_load(cap)) {
+        cap <<= 1;
+    }
+    return cap;
+}
+
+/**
+ * migrate up to n slots from tables[0] to tables[1]. Entries carry their hash,
+ * so nothing is rehashed. Inline entries are copied to the new table, which
+ * is why fixed key tables move their values when they grow. Migrated slots
+ * are marked as deleted so that probes for entries still in tables[0] keep
+ * running past them
+ */
+static void ht_rehash_step(ht* ht, size_t n) {
+    ht_table* from = &(ht->tables[0]);
+    ht_table* to = &(ht->tables[1]);
+    size_t i = (size_t)ht->rehash_idx;
+    size_t end = (from->cap - i) < n ? from->cap : i + n;
+    for (; i < end; ++i) {
+        ht_entry* entry;
+        if (!ht_ctrl_is_full(from->ctrl[i])) {
+            continue;
+        }
+        entry = ht_slot(ht, from, i);
+        ht_table_insert(ht, to, ht_find_insert_slot(to, entry->hash), entry,
+                        entry->hash);
+        from->ctrl[i] = HT_CTRL_DELETED;
+        from->len--;
+    }
+    if (i < from->cap) {
+        ht->rehash_idx = (ssize_t)i;
+        return;
+    }
+    ht_release_table(ht, from);
+    from->len = to->len;
+    from->cap = to->cap;
+    from->deleted = to->deleted;
+    from->slots = to->slots;
+    from->entries = to->entries;
+    __atomic_store_n(&(from->ctrl), to->ctrl, __ATOMIC_RELEASE);
+    memset(to, 0, sizeof *to);
+    __atomic_store_n(&(ht->rehash_idx), -1, __ATOMIC_RELEASE);
+}
+
+/**
+ * the control bytes and the slots of a table share a single allocation. The
+ * slots are pointers to entries, or the entries themselves when inline_size
+ * is not 0. cap is a multiple of HT_GROUP_WIDTH, so the slots that follow the
+ * control bytes stay aligned
+ */
+static int ht_table_init(ht_table* table, size_t cap, size_t inline_size) {
+    uint8_t* block;
+    size_t slot_size = inline_size ? inline_size : sizeof(ht_entry*);
+    assert(((cap & (cap - 1)) == 0) && (cap >= HT_GROUP_WIDTH));
+    block = malloc(HT_BLOCK_HEADER + cap + (cap * slot_size));
+    if (block == NULL) {
         return -1;
     }
-    bucket->entries = tmp;
-    memset(&(bucket->entries[len]), 0, (new_cap - len) * sizeof(ht_entry*));
-    bucket->cap = new_cap;
+    *((size_t*)block) = cap;
+    block += HT_BLOCK_HEADER;
+    memset(block, HT_CTRL_EMPTY, cap);
+    table->len = 0;
+    table->cap = cap;
+    table->deleted = 0;
+    table->slots = inline_size ? NULL : (ht_entry**)(block + cap);
+    table->entries = inline_size ? block + cap : NULL;
+    __atomic_store_n(&(table->ctrl), block, __ATOMIC_RELEASE);
     return 0;
 }
 
-static void ht_bucket_remove(ht_bucket* bucket, size_t idx, FreeFn* free_key,
+/**
+ * give the memory the table no longer uses back. Tables that are read
+ * without a lock retire it instead, so readers that still hold a pointer to
+ * it can finish
+ */
+static void ht_release_entry(ht* ht, ht_entry* entry, FreeFn* free_key,
                              FreeFn* free_val) {
-    size_t len;
-    ht_entry* entry = bucket->entries[idx];
-    ht_entry_free(entry, free_key, free_val);
-    bucket->len--;
-    len = bucket->len;
-    if (len == 0) {
-        memset(bucket->entries, 0, sizeof(ht_entry*));
+    if (ht->key_size) {
+        /* inline entries are part of the table */
+        ht_entry_release_data(entry, free_key, free_val);
         return;
     }
-    memmove(&(bucket->entries[idx]), &(bucket->entries[idx + 1]),
-            (len - idx) * sizeof(ht_entry*));
-    memset(&(bucket->entries[len]), 0, sizeof(ht_entry*));
+    if (ht->retire == NULL) {
+        ht_entry_free(entry, free_key, free_val, ht->arena);
+        return;
+    }
+    ht_entry_release_data(entry, free_key, free_val);
+    ht->retire(entry, ht->retire_ctx);
 }
 
-static void ht_bucket_free(ht_bucket* bucket, FreeFn* free_key,
-                           FreeFn* free_val) {
-    size_t i, len = bucket->len, cap = bucket->cap;
-    if (cap == 0) {
+static void ht_release_table(ht* ht, ht_table* table) {
+    if (ht->retire == NULL) {
+        free(ht_block_of(table->ctrl));
         return;
     }
+    ht->retire(ht_block_of(table->ctrl), ht->retire_ctx);
+}
+
+#if defined(__SSE2__)
+
+static uint32_t ht_group_match(const uint8_t* group, uint8_t h2) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    __m128i match = _mm_set1_epi8((char)h2);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, match));
+}
+
+static uint32_t ht_group_match_empty(const uint8_t* group) {
+    return ht_group_match(group, HT_CTRL_EMPTY);
+}
 
-    for (i = 0; i < len; ++i) {
-        ht_entry* entry = bucket->entries[i];
-        ht_entry_free(entry, free_key, free_val);
+static uint32_t ht_group_match_empty_or_deleted(const uint8_t* group) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(ctrl);
+}
+
+#else
+
+static uint32_t ht_group_match(const uint8_t* group, uint8_t h2) {
+    uint32_t i, match = 0;
+    for (i = 0; i < HT_GROUP_WIDTH; ++i) {
+        if (group[i] == h2) {
+            match |= ((uint32_t)1) << i;
+        }
     }
-    if (bucket->entries) {
-        free(bucket->entries);
+    return match;
+}
+
+static uint32_t ht_group_match_empty(const uint8_t* group) {
+    return ht_group_match(group, HT_CTRL_EMPTY);
+}
+
+static uint32_t ht_group_match_empty_or_deleted(const uint8_t* group) {
+    uint32_t i, match = 0;
+    for (i = 0; i < HT_GROUP_WIDTH; ++i) {
+        if (!ht_ctrl_is_full(group[i])) {
+            match |= ((uint32_t)1) << i;
+        }
     }
+    return match;
 }
 
-ht_entry* ht_entry_new(void* key, size_t key_len, void* data,
-                       size_t data_size) {
+#endif
+
+ht_entry* ht_entry_new(void* key, size_t key_len, uint64_t hash, void* data,
+                       size_t data_size, varena* arena) {
     ht_entry* entry;
     size_t needed;
     size_t offset;
-    if (data) {
+    if (data || data_size) {
         offset = key_len + ht_padding(key_len);
         needed = (sizeof *entry) + offset + data_size;
     } else {
         needed = (sizeof *entry) + key_len;
     }
-    entry = malloc(needed);
+    entry = varena_alloc(arena, needed);
     if (entry == NULL) {
         return NULL;
     }
@@ -425,18 +884,26 @@ ht_entry* ht_entry_new(void* key, size_t key_len, void* data,
     if (data) {
         memcpy(entry->data + offset, data, data_size);
     }
+    entry->hash = hash;
     entry->key_len = key_len;
     return entry;
 }
 
-void ht_entry_free(ht_entry* entry, FreeFn* free_key, FreeFn* free_val) {
+void* ht_entry_value(ht_entry* entry) { return ht_value_of(entry); }
+
+void ht_entry_free(ht_entry* entry, FreeFn* free_key, FreeFn* free_val,
+                   varena* arena) {
+    ht_entry_release_data(entry, free_key, free_val);
+    varena_dealloc(arena, entry);
+}
+
+/* call the callbacks that free what the key and value of entry own */
+static void ht_entry_release_data(ht_entry* entry, FreeFn* free_key,
+                                  FreeFn* free_val) {
     if (free_val) {
-        size_t key_len = entry->key_len;
-        size_t offset = key_len + ht_padding(key_len);
-        free_val(entry->data + offset);
+        free_val(ht_value_of(entry));
     }
     if (free_key) {
         free_key(entry->data);
     }
-    free(entry);
 }
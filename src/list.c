@@ -6,12 +6,19 @@
 static node* list_get_at(list* list, size_t idx);
 static void list_remove_node(list* list, node* node, void* out,
                              size_t data_size);
+static node* list_node_new(void* data, size_t data_size, varena* arena);
+static void list_node_free(node* node, FreeFn* fn, varena* arena);
 
 list list_new(size_t data_size) {
+    return list_new_with_arena(data_size, NULL);
+}
+
+list list_new_with_arena(size_t data_size, varena* arena) {
     list l = {0};
     l.data_size = data_size;
     l.head = l.tail = NULL;
     l.len = 0;
+    l.arena = arena;
     return l;
 }
 
@@ -27,7 +34,7 @@ int list_insert_at(list* list, void* data, size_t idx) {
         return list_append(list, data);
     }
 
-    node = node_new(data, list->data_size);
+    node = list_node_new(data, list->data_size, list->arena);
     if (node == NULL) {
         return -1;
     }
@@ -72,7 +79,7 @@ int list_remove_at(list* list, size_t idx, void* out) {
 }
 
 int list_append(list* list, void* data) {
-    node* node = node_new(data, list->data_size);
+    node* node = list_node_new(data, list->data_size, list->arena);
     if (node == NULL) {
         return -1;
     }
@@ -88,7 +95,7 @@ int list_append(list* list, void* data) {
 }
 
 int list_prepend(list* list, void* data) {
-    node* node = node_new(data, list->data_size);
+    node* node = list_node_new(data, list->data_size, list->arena);
     if (node == NULL) {
         return -1;
     }
@@ -118,7 +125,7 @@ void list_free(list* list, FreeFn* fn) {
     cur = list->head;
     for (i = 0; i < len; ++i) {
         node* next = cur->next;
-        node_free(cur, fn);
+        list_node_free(cur, fn, list->arena);
         cur = next;
     }
 }
@@ -138,41 +145,50 @@ static void list_remove_node(list* list, node* node, void* out,
     list->len--;
     memcpy(out, node->data, data_size);
     if (list->len == 0) {
-        node_free(node, NULL);
+        list_node_free(node, NULL, list->arena);
         list->head = list->tail = NULL;
         return;
     }
     if (node == list->head) {
         list->head = node->next;
-        node_free(node, NULL);
+        list_node_free(node, NULL, list->arena);
         list->head->prev = NULL;
         return;
     }
     if (node == list->tail) {
         list->tail = node->prev;
-        node_free(node, NULL);
+        list_node_free(node, NULL, list->arena);
         list->tail->next = NULL;
         return;
     }
 
     node->prev->next = node->next;
     node->next->prev = node->prev;
-    node_free(node, NULL);
+    list_node_free(node, NULL, list->arena);
 }
 
 node* node_new(void* data, size_t data_size) {
+    return list_node_new(data, data_size, NULL);
+}
+
+void node_free(node* node, FreeFn* fn) { list_node_free(node, fn, NULL); }
+
+static node* list_node_new(void* data, size_t data_size, varena* arena) {
     node* node;
     size_t needed = (sizeof *node) + data_size;
-    node = malloc(needed);
+    node = varena_alloc(arena, needed);
+    if (node == NULL) {
+        return NULL;
+    }
     memset(node, 0, needed);
     node->next = node->prev = NULL;
     memcpy(node->data, data, data_size);
     return node;
 }
 
-void node_free(node* node, FreeFn* fn) {
+static void list_node_free(node* node, FreeFn* fn, varena* arena) {
     if (fn) {
         fn(node->data);
     }
-    free(node);
+    varena_dealloc(arena, node);
 }
@@ -2,87 +2,251 @@
 #include <assert.h>
 #include <memory.h>
 
-static void lru_prepend(lru* l, node* node);
-static void lru_detach(lru* l, node* node);
+/**
+ * node in the lists of lru and tlfu. The key is only stored in the node's
+ * entry of the lookup table, which the node points to, so evicting a node
+ * deletes it from the lookup with the hash the entry cached instead of
+ * hashing the key again
+ *
+ * Memory layout:
+ *  -------------------------------------
+ * | prev | next | entry | meta | value |
+ *  -------------------------------------
+ */
+typedef struct lru_node {
+    struct lru_node* prev;
+    struct lru_node* next;
+    ht_entry* entry; /* the entry of the node in the lookup table */
+    union {
+        size_t cost;    /* lru: the cost counted against the budget */
+        size_t segment; /* tlfu: the segment the node is in */
+    } meta;
+    unsigned char data[];
+} lru_node;
+
+#define lru_node_key(node) ((node)->entry->data)
+#define lru_node_key_len(node) ((node)->entry->key_len)
+
+/**
+ * nodes of an lru with ttl are allocated with their timer in front of them,
+ * rounded up to 16 bytes to keep the values aligned
+ */
+#define LRU_TIMER_SIZE ((sizeof(twheel_timer) + 15) & ~((size_t)15))
+#define lru_timer_size(l) ((l)->wheel ? LRU_TIMER_SIZE : 0)
+#define lru_node_timer(node)                                                   \
+    ((twheel_timer*)(((unsigned char*)(node)) - LRU_TIMER_SIZE))
+#define lru_timer_node(timer)                                                  \
+    ((lru_node*)(((unsigned char*)(timer)) + LRU_TIMER_SIZE))
+
+/* passed to the timing wheel so expired nodes can be removed from the lru */
+typedef struct {
+    lru* l;
+    FreeFn* fn;
+} lru_expire_ctx;
+
+/* tlfu segments */
+#define TLFU_WINDOW 0
+#define TLFU_PROBATION 1
+#define TLFU_PROTECTED 2
+
+/* the number of rows in the frequency sketch */
+#define LRU_SKETCH_DEPTH 4
+/**
+ * counters saturate at this value, so they are 4 bit counters as in TinyLFU.
+ * Each is stored in its own byte
+ */
+#define LRU_SKETCH_MAX 15
+
+static void lru_list_prepend(lru_list* list, lru_node* node);
+static void lru_list_detach(lru_list* list, lru_node* node);
 static void lru_trim_cache(lru* l, FreeFn* fn);
-static void node_free_from_lookup(void* ptr);
-static void vstr_free_from_reverse(void* ptr);
+static lru_node* lru_upsert(lru* l, void* key, size_t key_len, void* value,
+                            size_t cost, FreeFn* fn);
+static void lru_remove_node(lru* l, lru_node* node, FreeFn* fn);
+static void lru_expire(twheel_timer* timer, void* ctx);
+static lru_node* lru_node_new(size_t timer_size, size_t data_size,
+                              ht_entry* entry, void* value);
+static void lru_lookup_delete(ht* lookup, lru_node* node);
+static void lru_node_free(lru_node* node, size_t timer_size);
+static void lru_list_free(lru_list* list, FreeFn* free_val, size_t timer_size);
+static int lru_sketch_init(lru_sketch* sketch, size_t cap);
+static void lru_sketch_increment(lru_sketch* sketch, void* key,
+                                 size_t key_len);
+static size_t lru_sketch_frequency(lru_sketch* sketch, void* key,
+                                   size_t key_len);
+static void tlfu_hit(tlfu* c, lru_node* node);
+static void tlfu_evict(tlfu* c, FreeFn* fn);
+static void tlfu_remove(tlfu* c, lru_node* node, FreeFn* fn);
+static lru_list* tlfu_segment(tlfu* c, size_t segment);
 
 lru lru_new(size_t cap, size_t data_size, CmpFn* cmp_keys) {
     lru l = {0};
     l.len = 0;
     l.cap = cap;
     l.data_size = data_size;
-    l.lookup = ht_new(sizeof(node*), cmp_keys);
-    l.reverse_lookup = ht_new(sizeof(vstr), NULL);
+    l.budget = 0;
+    l.bytes = 0;
+    l.wheel = NULL;
+    l.lookup = ht_new(sizeof(lru_node*), cmp_keys);
+    return l;
+}
+
+lru lru_new_with_ttl(size_t cap, size_t data_size, CmpFn* cmp_keys) {
+    lru l = lru_new(cap, data_size, cmp_keys);
+    l.wheel = malloc(sizeof(twheel));
+    assert(l.wheel != NULL);
+    *(l.wheel) = twheel_new();
+    return l;
+}
+
+lru lru_new_weighted(size_t budget, size_t data_size, CmpFn* cmp_keys) {
+    lru l = lru_new(SIZE_MAX, data_size, cmp_keys);
+    l.budget = budget;
     return l;
 }
 
 int lru_update(lru* l, void* key, size_t key_len, void* value, FreeFn* fn) {
-    node** node_ptr = ht_get(&(l->lookup), key, key_len);
-    size_t data_size = l->data_size;
-    if (node_ptr == NULL) {
-        node* new_node = node_new(value, data_size);
-        int insert_node_res;
-        int insert_key_res;
-        vstr key_vstr = vstr_from_len(key, key_len);
-        if (new_node == NULL) {
-            return -1;
-        }
+    return lru_update_cost(l, key, key_len, value, key_len + l->data_size, fn);
+}
 
-        insert_node_res =
-            ht_insert(&(l->lookup), key, key_len, &new_node, NULL);
-        if (insert_node_res == -1) {
-            node_free(new_node, NULL);
-            vstr_free(&key_vstr);
-            return -1;
-        }
-        insert_key_res = ht_insert(&(l->reverse_lookup), &new_node,
-                                   sizeof(node*), &key_vstr, NULL);
-        if (insert_key_res == -1) {
-            vstr_free(&key_vstr);
-            node_free(new_node, NULL);
-            return -1;
-        }
-        l->len++;
-        lru_prepend(l, new_node);
-        lru_trim_cache(l, fn);
-        return 0;
+int lru_update_cost(lru* l, void* key, size_t key_len, void* value,
+                    size_t cost, FreeFn* fn) {
+    if (lru_upsert(l, key, key_len, value, cost, fn) == NULL) {
+        return -1;
     }
-    if (fn) {
-        fn((*node_ptr)->data);
+    lru_trim_cache(l, fn);
+    return 0;
+}
+
+int lru_update_ttl(lru* l, void* key, size_t key_len, void* value,
+                   uint64_t ttl, FreeFn* fn) {
+    lru_node* node;
+    if (l->wheel == NULL) {
+        return -1;
+    }
+    node = lru_upsert(l, key, key_len, value, key_len + l->data_size, fn);
+    if (node == NULL) {
+        return -1;
+    }
+    if (ttl) {
+        twheel_add(l->wheel, lru_node_timer(node), ttl);
+    } else {
+        twheel_remove(l->wheel, lru_node_timer(node));
     }
-    memcpy((*node_ptr)->data, value, data_size);
-    lru_detach(l, *node_ptr);
-    lru_prepend(l, *node_ptr);
+    lru_trim_cache(l, fn);
     return 0;
 }
 
+void lru_tick(lru* l, uint64_t ticks, FreeFn* fn) {
+    lru_expire_ctx ctx;
+    if (l->wheel == NULL) {
+        return;
+    }
+    ctx.l = l;
+    ctx.fn = fn;
+    twheel_advance(l->wheel, ticks, lru_expire, &ctx);
+}
+
+size_t lru_bytes(lru* l) { return l->bytes; }
+
+int lru_reserve(lru* l, size_t n) {
+    return ht_reserve(&(l->lookup), n < l->cap ? n : l->cap);
+}
+
+int lru_shrink_to_fit(lru* l) { return ht_shrink_to_fit(&(l->lookup)); }
+
 void* lru_get(lru* l, void* key, size_t key_len) {
-    node** node_ptr = ht_get(&(l->lookup), key, key_len);
+    lru_node** node_ptr = ht_get(&(l->lookup), key, key_len);
     if (node_ptr == NULL) {
         return NULL;
     }
-    lru_detach(l, *node_ptr);
-    lru_prepend(l, *node_ptr);
+    lru_list_detach(&(l->list), *node_ptr);
+    lru_list_prepend(&(l->list), *node_ptr);
     return (*node_ptr)->data;
 }
 
 void lru_free(lru* l, FreeFn* free_key, FreeFn* free_val) {
-    size_t i, len = l->len;
-    if (free_val) {
-        /* TODO - this is not efficient at all */
-        node* cur = l->head;
-        for (i = 0; i < len; ++i) {
-            free_val(cur->data);
-            cur = cur->next;
+    lru_list_free(&(l->list), free_val, lru_timer_size(l));
+    ht_free(&(l->lookup), free_key, NULL);
+    free(l->wheel);
+    l->wheel = NULL;
+    l->len = 0;
+    l->bytes = 0;
+}
+
+tlfu tlfu_new(size_t cap, size_t data_size, CmpFn* cmp_keys) {
+    tlfu c = {0};
+    size_t main_cap;
+    int init_res = lru_sketch_init(&(c.sketch), cap);
+    assert(init_res == 0);
+    (void)init_res;
+    c.cap = cap;
+    c.data_size = data_size;
+    c.window_cap = cap / 100;
+    if (c.window_cap == 0) {
+        c.window_cap = 1;
+    }
+    main_cap = cap > c.window_cap ? cap - c.window_cap : 0;
+    c.protected_cap = (main_cap * 4) / 5;
+    c.lookup = ht_new(sizeof(lru_node*), cmp_keys);
+    return c;
+}
+
+int tlfu_update(tlfu* c, void* key, size_t key_len, void* value, FreeFn* fn) {
+    bool inserted;
+    lru_node* new_node;
+    ht_entry* entry =
+        ht_entry_find_or_insert(&(c->lookup), key, key_len, &inserted);
+    lru_sketch_increment(&(c->sketch), key, key_len);
+    if (entry == NULL) {
+        return -1;
+    }
+    if (!inserted) {
+        lru_node* node = *((lru_node**)ht_entry_value(entry));
+        if (fn) {
+            fn(node->data);
         }
+        memcpy(node->data, value, c->data_size);
+        tlfu_hit(c, node);
+        return 0;
+    }
+    new_node = lru_node_new(0, c->data_size, entry, value);
+    if (new_node == NULL) {
+        ht_delete_hashed(&(c->lookup), key, key_len, entry->hash, NULL, NULL);
+        return -1;
+    }
+    memcpy(ht_entry_value(entry), &new_node, sizeof(lru_node*));
+    new_node->meta.segment = TLFU_WINDOW;
+    lru_list_prepend(&(c->window), new_node);
+    c->window_len++;
+    c->len++;
+    if (c->window_len > c->window_cap) {
+        tlfu_evict(c, fn);
     }
-    ht_free(&(l->lookup), free_key, node_free_from_lookup);
-    ht_free(&(l->reverse_lookup), NULL, vstr_free_from_reverse);
+    return 0;
+}
+
+void* tlfu_get(tlfu* c, void* key, size_t key_len) {
+    lru_node** node_ptr = ht_get(&(c->lookup), key, key_len);
+    lru_sketch_increment(&(c->sketch), key, key_len);
+    if (node_ptr == NULL) {
+        return NULL;
+    }
+    tlfu_hit(c, *node_ptr);
+    return (*node_ptr)->data;
 }
 
-static void lru_detach(lru* l, node* node) {
+void tlfu_free(tlfu* c, FreeFn* free_key, FreeFn* free_val) {
+    lru_list_free(&(c->window), free_val, 0);
+    lru_list_free(&(c->probation), free_val, 0);
+    lru_list_free(&(c->protected), free_val, 0);
+    ht_free(&(c->lookup), free_key, NULL);
+    free(c->sketch.table);
+    c->sketch.table = NULL;
+    c->len = c->window_len = c->probation_len = c->protected_len = 0;
+}
+
+static void lru_list_detach(lru_list* list, lru_node* node) {
     if (node->prev) {
         node->prev->next = node->next;
     }
@@ -90,53 +254,299 @@ static void lru_detach(lru* l, node* node) {
         node->next->prev = node->prev;
     }
 
-    if (node == l->head) {
-        l->head = node->next;
+    if (node == list->head) {
+        list->head = node->next;
     }
 
-    if (node == l->tail) {
-        l->tail = node->prev;
+    if (node == list->tail) {
+        list->tail = node->prev;
     }
 
     node->prev = node->next = NULL;
 }
 
-static void lru_prepend(lru* l, node* node) {
-    if (l->head == NULL) {
-        l->head = l->tail = node;
+static void lru_list_prepend(lru_list* list, lru_node* node) {
+    if (list->head == NULL) {
+        list->head = list->tail = node;
         return;
     }
 
-    node->next = l->head;
-    l->head->prev = node;
-    l->head = node;
+    node->next = list->head;
+    list->head->prev = node;
+    list->head = node;
+}
+
+static void lru_list_free(lru_list* list, FreeFn* free_val,
+                          size_t timer_size) {
+    lru_node* cur = list->head;
+    while (cur) {
+        lru_node* next = cur->next;
+        if (free_val) {
+            free_val(cur->data);
+        }
+        lru_node_free(cur, timer_size);
+        cur = next;
+    }
+    list->head = list->tail = NULL;
 }
 
+/**
+ * evict the least recently used nodes until the lru is within its capacity
+ * and, when it is weighted, within its budget
+ */
 static void lru_trim_cache(lru* l, FreeFn* fn) {
-    node* tail;
-    vstr* key_vstr;
-    const char* key;
-    size_t key_len;
-    if (l->len <= l->cap) {
+    while ((l->len > l->cap) || (l->budget && (l->bytes > l->budget))) {
+        lru_remove_node(l, l->list.tail, fn);
+    }
+}
+
+/**
+ * insert key or update its value and cost, and make it the most recently
+ * used. Does not trim the cache
+ */
+static lru_node* lru_upsert(lru* l, void* key, size_t key_len, void* value,
+                            size_t cost, FreeFn* fn) {
+    bool inserted;
+    size_t data_size = l->data_size;
+    lru_node* node;
+    ht_entry* entry =
+        ht_entry_find_or_insert(&(l->lookup), key, key_len, &inserted);
+    if (entry == NULL) {
+        return NULL;
+    }
+    if (inserted) {
+        node = lru_node_new(lru_timer_size(l), data_size, entry, value);
+        if (node == NULL) {
+            ht_delete_hashed(&(l->lookup), key, key_len, entry->hash, NULL,
+                             NULL);
+            return NULL;
+        }
+        memcpy(ht_entry_value(entry), &node, sizeof(lru_node*));
+        node->meta.cost = cost;
+        l->bytes += cost;
+        l->len++;
+        lru_list_prepend(&(l->list), node);
+        return node;
+    }
+    node = *((lru_node**)ht_entry_value(entry));
+    if (fn) {
+        fn(node->data);
+    }
+    memcpy(node->data, value, data_size);
+    l->bytes = (l->bytes - node->meta.cost) + cost;
+    node->meta.cost = cost;
+    lru_list_detach(&(l->list), node);
+    lru_list_prepend(&(l->list), node);
+    return node;
+}
+
+static void lru_remove_node(lru* l, lru_node* node, FreeFn* fn) {
+    lru_list_detach(&(l->list), node);
+    lru_lookup_delete(&(l->lookup), node);
+    if (l->wheel) {
+        twheel_remove(l->wheel, lru_node_timer(node));
+    }
+    if (fn) {
+        fn(node->data);
+    }
+    l->bytes -= node->meta.cost;
+    lru_node_free(node, lru_timer_size(l));
+    l->len--;
+}
+
+static void lru_expire(twheel_timer* timer, void* ctx) {
+    lru_expire_ctx* expire_ctx = ctx;
+    lru_remove_node(expire_ctx->l, lru_timer_node(timer), expire_ctx->fn);
+}
+
+static lru_node* lru_node_new(size_t timer_size, size_t data_size,
+                              ht_entry* entry, void* value) {
+    lru_node* node;
+    unsigned char* block = malloc(timer_size + (sizeof *node) + data_size);
+    if (block == NULL) {
+        return NULL;
+    }
+    node = (lru_node*)(block + timer_size);
+    if (timer_size) {
+        twheel_timer_init(lru_node_timer(node));
+    }
+    node->prev = node->next = NULL;
+    node->entry = entry;
+    node->meta.cost = 0;
+    memcpy(node->data, value, data_size);
+    return node;
+}
+
+/**
+ * delete the node's entry from the lookup. The entry holds the key that is
+ * compared against, so the key is passed on from the entry itself
+ */
+static void lru_lookup_delete(ht* lookup, lru_node* node) {
+    ht_entry* entry = node->entry;
+    int delete_res = ht_delete_hashed(lookup, entry->data, entry->key_len,
+                                      entry->hash, NULL, NULL);
+    assert(delete_res == 0);
+    (void)delete_res;
+    node->entry = NULL;
+}
+
+static void lru_node_free(lru_node* node, size_t timer_size) {
+    free(((unsigned char*)node) - timer_size);
+}
+
+/**
+ * a hit in the window moves the node to the front of the window. A hit in
+ * probation promotes the node to protected, which demotes the least recently
+ * used protected node back to probation if protected is full
+ */
+static void tlfu_hit(tlfu* c, lru_node* node) {
+    switch (node->meta.segment) {
+    case TLFU_WINDOW:
+        lru_list_detach(&(c->window), node);
+        lru_list_prepend(&(c->window), node);
+        break;
+    case TLFU_PROBATION:
+        lru_list_detach(&(c->probation), node);
+        c->probation_len--;
+        node->meta.segment = TLFU_PROTECTED;
+        lru_list_prepend(&(c->protected), node);
+        c->protected_len++;
+        if (c->protected_len > c->protected_cap) {
+            lru_node* demoted = c->protected.tail;
+            lru_list_detach(&(c->protected), demoted);
+            c->protected_len--;
+            demoted->meta.segment = TLFU_PROBATION;
+            lru_list_prepend(&(c->probation), demoted);
+            c->probation_len++;
+        }
+        break;
+    default:
+        lru_list_detach(&(c->protected), node);
+        lru_list_prepend(&(c->protected), node);
+        break;
+    }
+}
+
+/**
+ * the window is over capacity, so its least recently used node becomes a
+ * candidate for the main cache. If the main cache is full, the candidate is
+ * only admitted when the sketch has seen it more often than the main cache's
+ * victim, which keeps keys that are touched once (such as a scan) from
+ * flushing keys that are used often
+ */
+static void tlfu_evict(tlfu* c, FreeFn* fn) {
+    lru_node* candidate = c->window.tail;
+    lru_node* victim;
+    size_t candidate_freq, victim_freq;
+    lru_list_detach(&(c->window), candidate);
+    c->window_len--;
+    if (c->len <= c->cap) {
+        candidate->meta.segment = TLFU_PROBATION;
+        lru_list_prepend(&(c->probation), candidate);
+        c->probation_len++;
+        return;
+    }
+    victim = c->probation.tail ? c->probation.tail : c->protected.tail;
+    if (victim == NULL) {
+        tlfu_remove(c, candidate, fn);
         return;
     }
-    tail = l->tail;
-    lru_detach(l, tail);
-    key_vstr = ht_get(&(l->reverse_lookup), &tail, sizeof(node*));
-    assert(key_vstr != NULL);
-    key = vstr_data(key_vstr);
-    key_len = vstr_len(key_vstr);
-    ht_delete(&(l->lookup), (void*)key, key_len, NULL, NULL);
-    ht_delete(&(l->reverse_lookup), &tail, sizeof(node*), NULL, NULL);
-    node_free(tail, fn);
+    candidate_freq = lru_sketch_frequency(
+        &(c->sketch), lru_node_key(candidate), lru_node_key_len(candidate));
+    victim_freq = lru_sketch_frequency(&(c->sketch), lru_node_key(victim),
+                                       lru_node_key_len(victim));
+    if (candidate_freq <= victim_freq) {
+        tlfu_remove(c, candidate, fn);
+        return;
+    }
+    lru_list_detach(tlfu_segment(c, victim->meta.segment), victim);
+    if (victim->meta.segment == TLFU_PROBATION) {
+        c->probation_len--;
+    } else {
+        c->protected_len--;
+    }
+    tlfu_remove(c, victim, fn);
+    candidate->meta.segment = TLFU_PROBATION;
+    lru_list_prepend(&(c->probation), candidate);
+    c->probation_len++;
+}
+
+/* remove a node that is already detached from its list */
+static void tlfu_remove(tlfu* c, lru_node* node, FreeFn* fn) {
+    lru_lookup_delete(&(c->lookup), node);
+    if (fn) {
+        fn(node->data);
+    }
+    lru_node_free(node, 0);
+    c->len--;
 }
 
-static void node_free_from_lookup(void* ptr) {
-    node* n = *((node**)ptr);
-    node_free(n, NULL);
+static lru_list* tlfu_segment(tlfu* c, size_t segment) {
+    switch (segment) {
+    case TLFU_WINDOW:
+        return &(c->window);
+    case TLFU_PROBATION:
+        return &(c->probation);
+    default:
+        return &(c->protected);
+    }
+}
+
+/**
+ * count-min sketch of how often keys are accessed. Each key maps to one
+ * counter per row, and its frequency is the smallest of those counters. All
+ * counters are halved once the number of increments reaches the sample size,
+ * so the sketch follows changes in popularity
+ */
+static int lru_sketch_init(lru_sketch* sketch, size_t cap) {
+    size_t width = 16;
+    while (width < cap) {
+        width <<= 1;
+    }
+    sketch->table = calloc(width * LRU_SKETCH_DEPTH, sizeof(uint8_t));
+    if (sketch->table == NULL) {
+        return -1;
+    }
+    sketch->width = width;
+    sketch->additions = 0;
+    sketch->sample_size = width * 10;
+    get_random_bytes(sketch->seed, HT_SEED_SIZE);
+    return 0;
+}
+
+static void lru_sketch_increment(lru_sketch* sketch, void* key,
+                                 size_t key_len) {
+    uint64_t hash = hash_wyhash(key, key_len, sketch->seed);
+    uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32);
+    size_t i;
+    for (i = 0; i < LRU_SKETCH_DEPTH; ++i) {
+        size_t idx = (h1 + (i * h2)) & (sketch->width - 1);
+        uint8_t* counter = &(sketch->table[(i * sketch->width) + idx]);
+        if (*counter < LRU_SKETCH_MAX) {
+            (*counter)++;
+        }
+    }
+    sketch->additions++;
+    if (sketch->additions == sketch->sample_size) {
+        size_t n = sketch->width * LRU_SKETCH_DEPTH;
+        for (i = 0; i < n; ++i) {
+            sketch->table[i] >>= 1;
+        }
+        sketch->additions /= 2;
+    }
 }
 
-static void vstr_free_from_reverse(void* ptr) {
-    vstr* s = ptr;
-    vstr_free(s);
+static size_t lru_sketch_frequency(lru_sketch* sketch, void* key,
+                                   size_t key_len) {
+    uint64_t hash = hash_wyhash(key, key_len, sketch->seed);
+    uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32);
+    size_t i, min = LRU_SKETCH_MAX;
+    for (i = 0; i < LRU_SKETCH_DEPTH; ++i) {
+        size_t idx = (h1 + (i * h2)) & (sketch->width - 1);
+        uint8_t counter = sketch->table[(i * sketch->width) + idx];
+        if (counter < min) {
+            min = counter;
+        }
+    }
+    return min;
 }
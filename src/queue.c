@@ -6,13 +6,18 @@ typedef struct qnode {
     unsigned char data[];
 } qnode;
 
-static qnode* qnode_new(void* data, size_t data_size);
-static void qnode_free(qnode* node, FreeFn* fn);
+static qnode* qnode_new(void* data, size_t data_size, varena* arena);
+static void qnode_free(qnode* node, FreeFn* fn, varena* arena);
 
 queue queue_new(size_t data_size) {
+    return queue_new_with_arena(data_size, NULL);
+}
+
+queue queue_new_with_arena(size_t data_size, varena* arena) {
     queue q = {0};
     q.head = q.tail = NULL;
     q.data_size = data_size;
+    q.arena = arena;
     return q;
 }
 
@@ -26,7 +31,7 @@ void* queue_peek(queue* q) {
 }
 
 int queue_enque(queue* q, void* data) {
-    qnode* node = qnode_new(data, q->data_size);
+    qnode* node = qnode_new(data, q->data_size, q->arena);
     if (node == NULL) {
         return -1;
     }
@@ -49,12 +54,12 @@ int queue_deque(queue* q, void* out) {
     memcpy(out, node->data, q->data_size);
     q->len--;
     if (q->len == 0) {
-        qnode_free(node, NULL);
+        qnode_free(node, NULL, q->arena);
         q->head = q->tail = NULL;
         return 0;
     }
     q->head = node->next;
-    qnode_free(node, NULL);
+    qnode_free(node, NULL, q->arena);
     return 0;
 }
 
@@ -63,16 +68,16 @@ void queue_free(queue* q, FreeFn* fn) {
     qnode* cur = q->head;
     for (i = 0; i < len; ++i) {
         qnode* next = cur->next;
-        qnode_free(cur, fn);
+        qnode_free(cur, fn, q->arena);
         cur = next;
     }
     q->len = 0;
 }
 
-static qnode* qnode_new(void* data, size_t data_size) {
+static qnode* qnode_new(void* data, size_t data_size, varena* arena) {
     qnode* node;
     size_t needed = (sizeof *node) + data_size;
-    node = malloc(needed);
+    node = varena_alloc(arena, needed);
     if (node == NULL) {
         return NULL;
     }
@@ -80,9 +85,9 @@ static qnode* qnode_new(void* data, size_t data_size) {
     return node;
 }
 
-static void qnode_free(qnode* node, FreeFn* fn) {
+static void qnode_free(qnode* node, FreeFn* fn, varena* arena) {
     if (fn) {
         fn(node->data);
     }
-    free(node);
+    varena_dealloc(arena, node);
 }
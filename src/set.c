@@ -1,280 +1,681 @@
-#include "siphash.h"
 #include "vlib.h"
 #include <assert.h>
+#include <memory.h>
 
-static uint64_t set_hash(set* ht, void* key, size_t key_len);
+/**
+ * the set uses robin hood open addressing. Every slot starts with the hash of
+ * its key, followed by a pointer to a copy of the key, or by the key itself
+ * for sets of fixed size keys. The hash is only kept in the slot, so the copy
+ * of a key is just its length and its bytes. Keys in a run of slots are kept
+ * ordered by their home slot, so a probe stops as soon as it reaches a key
+ * that is closer to its home than the probed key would be. Deleting shifts
+ * the rest of the run back by a slot instead of leaving a tombstone
+ */
+
+/* hashes are stored with the low bit set, so a hash of 0 marks an empty slot */
+#define set_mark_hash(hash) ((hash) | 1)
+#define set_slot(set, table, idx) ((table)->slots + ((idx) * (set)->slot_size))
+#define set_slot_hash(slot) (*((uint64_t*)(slot)))
+#define set_slot_data(slot) ((slot) + sizeof(uint64_t))
+#define set_slot_key(slot) (*((set_key**)set_slot_data(slot)))
+
+/* the copy of a key of a set whose keys are of any size */
+typedef struct {
+    size_t key_len;
+    unsigned char data[];
+} set_key;
+
+/* slot counts are always a power of two, so no division is needed */
+#define set_home(hash, cap) (((hash) >> 1) & ((cap)-1))
+/* how far the slot at idx is from the home slot of its key */
+#define set_dist(hash, idx, cap) (((idx)-set_home(hash, cap)) & ((cap)-1))
+
+/* the table is grown once it is 7/8 full */
+#define set_max_load(cap) ((cap) - ((cap) >> 3))
+
+/* the number of slots migrated to the new table per write operation */
+#define SET_REHASH_STEP 16
+
+#define set_is_rehashing(set) ((set)->rehash_idx != -1)
+
+/* the number of keys set_has_many hashes and prefetches before resolving */
+#define SET_BATCH_SIZE 16
+
+static set set_init(size_t key_size, size_t cap, CmpFn* cmp_key,
+                    HashFn* hash_fn);
+static uint64_t set_hash(set* set, void* key, size_t key_len);
 static int set_resize(set* set);
-static void set_bucket_remove(ht_bucket* bucket, size_t idx, FreeFn* free_fn);
-static int set_realloc_bucket(ht_bucket* bucket);
-static int set_init_bucket(ht_bucket* bucket);
-static void set_bucket_free(ht_bucket* bucket, FreeFn* free_val);
+static int set_rehash_to(set* set, size_t cap);
+static size_t set_cap_for(size_t n);
+static void set_rehash_step(set* set, size_t n);
+static int set_table_init(set* set, set_table* table, size_t cap);
+static bool set_lookup(set* set, void* key, size_t key_len, uint64_t hash,
+                       set_table** table, size_t* idx);
+static bool set_find(set* set, set_table* table, void* key, size_t key_len,
+                     uint64_t hash, size_t* idx);
+static bool set_slot_eq(set* set, unsigned char* slot, void* key,
+                        size_t key_len);
+static unsigned char* set_table_make_room(set* set, set_table* table,
+                                          uint64_t hash);
+static void set_table_remove(set* set, set_table* table, size_t idx);
+static void set_slot_free(set* set, unsigned char* slot, FreeFn* free_fn);
+static set set_init_like(set* like);
+static size_t set_collect(set* set, size_t* pos, void** keys,
+                          size_t* key_lens, size_t max);
+static int set_build(set* out, set* src, set* probe, bool in_probe);
+static size_t set_scan_home(set* set, set_table* table, size_t home,
+                            ScanFn* fn, void* ctx);
+static void set_prefetch_slot(set* set, uint64_t hash);
+static void set_prefetch_key(set* set, uint64_t hash);
+static set_key* set_key_new(set* set, void* key, size_t key_len);
 
-set set_new(CmpFn* cmp_key) {
-    set set = {0};
-    set.buckets = calloc(HT_INITIAL_CAP, sizeof(ht_bucket));
-    assert(set.buckets != NULL);
-    set.cap = HT_INITIAL_CAP;
-    set.len = 0;
-    set.cmp_key = cmp_key;
-    get_random_bytes(set.seed, HT_SEED_SIZE);
+set set_new(CmpFn* cmp_key) { return set_new_with_hash(cmp_key, NULL); }
+
+set set_new_with_hash(CmpFn* cmp_key, HashFn* hash_fn) {
+    return set_init(0, 0, cmp_key, hash_fn);
+}
+
+set set_new_with_capacity(CmpFn* cmp_key, size_t cap) {
+    return set_init(0, cap, cmp_key, NULL);
+}
+
+set set_new_with_arena(CmpFn* cmp_key, varena* arena) {
+    set set = set_init(0, 0, cmp_key, NULL);
+    set.arena = arena;
     return set;
 }
 
+set set_new_fixed(size_t key_size, CmpFn* cmp_key) {
+    assert(key_size > 0);
+    return set_init(key_size, 0, cmp_key, NULL);
+}
+
 size_t set_len(set* set) { return set->len; }
 
+int set_reserve(set* set, size_t n) {
+    set_table* table = &(set->tables[set_is_rehashing(set) ? 1 : 0]);
+    if (n <= set_max_load(table->cap)) {
+        return 0;
+    }
+    return set_rehash_to(set, set_cap_for(n));
+}
+
+int set_shrink_to_fit(set* set) {
+    size_t cap = set_cap_for(set->len);
+    if (set_is_rehashing(set)) {
+        set_rehash_step(set, SIZE_MAX);
+    }
+    if (cap >= set->tables[0].cap) {
+        return 0;
+    }
+    if (set_rehash_to(set, cap) == -1) {
+        return -1;
+    }
+    /* the new table only has room for every key once they are all moved */
+    set_rehash_step(set, SIZE_MAX);
+    return 0;
+}
+
 bool set_has(set* set, void* key, size_t key_len) {
-    uint64_t hash = set_hash(set, key, key_len);
-    ht_bucket bucket = set->buckets[hash];
-    size_t i, len = bucket.len, cap = bucket.cap;
-    if (cap == 0) {
+    set_table* table;
+    size_t idx;
+    uint64_t hash;
+    if (set->key_size && (key_len != set->key_size)) {
         return false;
     }
-    for (i = 0; i < len; ++i) {
-        ht_entry* cur = bucket.entries[i];
-        if (set->cmp_key) {
-            int cmp = set->cmp_key(key, cur->data);
-            if (cmp == 0) {
-                return true;
+    hash = set_hash(set, key, key_len);
+    return set_lookup(set, key, key_len, hash, &table, &idx);
+}
+
+size_t set_has_many(set* set, void** keys, size_t* key_lens, size_t n,
+                    bool* out) {
+    uint64_t hashes[SET_BATCH_SIZE];
+    size_t i, j, found = 0;
+    for (i = 0; i < n; i += SET_BATCH_SIZE) {
+        size_t batch = (n - i) < SET_BATCH_SIZE ? (n - i) : SET_BATCH_SIZE;
+        for (j = 0; j < batch; ++j) {
+            hashes[j] = set_hash(set, keys[i + j], key_lens[i + j]);
+            set_prefetch_slot(set, hashes[j]);
+        }
+        if (set->key_size == 0) {
+            for (j = 0; j < batch; ++j) {
+                set_prefetch_key(set, hashes[j]);
             }
-        } else {
-            size_t cur_key_len = cur->key_len;
-            if ((cur_key_len == key_len) &&
-                (memcmp(key, cur->data, key_len) == 0)) {
-                return true;
+        }
+        for (j = 0; j < batch; ++j) {
+            set_table* table;
+            size_t idx;
+            bool has = (set->key_size == 0) ||
+                       (key_lens[i + j] == set->key_size);
+            has = has && set_lookup(set, keys[i + j], key_lens[i + j],
+                                    hashes[j], &table, &idx);
+            if (out) {
+                out[i + j] = has;
             }
+            found += has;
         }
     }
-    return false;
+    return found;
 }
 
 int set_insert(set* set, void* key, size_t key_len) {
     uint64_t hash;
-    ht_bucket* bucket;
-    ht_entry* entry;
-    size_t i, len, cap;
-    if (set->len == set->cap) {
-        if (set_resize(set) == -1) {
-            return -1;
-        }
+    set_table* table;
+    set_key* copy = NULL;
+    unsigned char* slot;
+    size_t idx;
+    if (set->key_size && (key_len != set->key_size)) {
+        return -1;
+    }
+    if (set_is_rehashing(set)) {
+        set_rehash_step(set, SET_REHASH_STEP);
     }
     hash = set_hash(set, key, key_len);
-    bucket = &(set->buckets[hash]);
-    len = bucket->len;
-    cap = bucket->cap;
-    if (cap == 0) {
-        int init_res = set_init_bucket(bucket);
-        if (init_res == -1) {
+    if (set_lookup(set, key, key_len, hash, &table, &idx)) {
+        return -1;
+    }
+    table = &(set->tables[set_is_rehashing(set) ? 1 : 0]);
+    if (table->len >= set_max_load(table->cap)) {
+        if (set_resize(set) == -1) {
             return -1;
         }
-        entry = ht_entry_new(key, key_len, NULL, 0);
-        if (entry == NULL) {
+        table = &(set->tables[set_is_rehashing(set) ? 1 : 0]);
+    }
+    if (set->key_size == 0) {
+        copy = set_key_new(set, key, key_len);
+        if (copy == NULL) {
             return -1;
         }
-        bucket->entries[0] = entry;
-        bucket->len++;
-        set->len++;
-        return 0;
     }
+    slot = set_table_make_room(set, table, hash);
+    set_slot_hash(slot) = hash;
+    if (copy) {
+        set_slot_key(slot) = copy;
+    } else {
+        memcpy(set_slot_data(slot), key, key_len);
+    }
+    table->len++;
+    set->len++;
+    return 0;
+}
 
-    if (len == 0) {
-        entry = ht_entry_new(key, key_len, NULL, 0);
-        if (entry == NULL) {
-            return -1;
-        }
-        bucket->entries[0] = entry;
-        bucket->len++;
-        set->len++;
-        return 0;
+int set_delete(set* set, void* key, size_t key_len, FreeFn* free_fn) {
+    uint64_t hash;
+    set_table* table;
+    size_t idx;
+    if (set->key_size && (key_len != set->key_size)) {
+        return -1;
+    }
+    if (set_is_rehashing(set)) {
+        set_rehash_step(set, SET_REHASH_STEP);
     }
+    hash = set_hash(set, key, key_len);
+    if (!set_lookup(set, key, key_len, hash, &table, &idx)) {
+        return -1;
+    }
+    set_slot_free(set, set_slot(set, table, idx), free_fn);
+    set_table_remove(set, table, idx);
+    set->len--;
+    return 0;
+}
 
-    for (i = 0; i < len; ++i) {
-        ht_entry* cur = bucket->entries[i];
-        if (set->cmp_key) {
-            int cmp = set->cmp_key(cur->data, key);
-            if (cmp == 0) {
-                return -1;
-            }
-        } else {
-            size_t cur_key_len = cur->key_len;
-            if ((key_len == cur_key_len) &&
-                (memcmp(key, cur->data, key_len) == 0)) {
-                return -1;
-            }
+size_t set_scan(set* set, size_t cursor, size_t count, ScanFn* fn,
+                void* ctx) {
+    size_t found = 0;
+    do {
+        set_table* small = &(set->tables[0]);
+        set_table* large = &(set->tables[1]);
+        size_t small_mask, large_mask;
+        if (!set_is_rehashing(set)) {
+            small_mask = small->cap - 1;
+            found += set_scan_home(set, small, cursor & small_mask, fn, ctx);
+            cursor = scan_cursor_next(cursor, small_mask);
+            continue;
         }
-    }
+        if (small->cap > large->cap) {
+            small = &(set->tables[1]);
+            large = &(set->tables[0]);
+        }
+        small_mask = small->cap - 1;
+        large_mask = large->cap - 1;
+        found += set_scan_home(set, small, cursor & small_mask, fn, ctx);
+        /* visit every slot of the larger table that the slot expands to */
+        do {
+            found += set_scan_home(set, large, cursor & large_mask, fn, ctx);
+            cursor = scan_cursor_next(cursor, large_mask);
+        } while (cursor & (small_mask ^ large_mask));
+    } while ((cursor != 0) && (found < count));
+    return cursor;
+}
 
-    if (len == cap) {
-        int realloc_bucket_res = set_realloc_bucket(bucket);
-        if (realloc_bucket_res == -1) {
-            return -1;
+void set_free(set* set, FreeFn* free_fn) {
+    size_t i, j;
+    for (i = 0; i < 2; ++i) {
+        set_table* table = &(set->tables[i]);
+        for (j = 0; j < table->cap; ++j) {
+            unsigned char* slot = set_slot(set, table, j);
+            if (set_slot_hash(slot)) {
+                set_slot_free(set, slot, free_fn);
+            }
         }
+        free(table->slots);
     }
+}
 
-    entry = ht_entry_new(key, key_len, NULL, 0);
-    if (entry == NULL) {
+int set_union(set* a, set* b, set* out) {
+    set* larger = a->len >= b->len ? a : b;
+    set* smaller = a->len >= b->len ? b : a;
+    *out = set_init_like(a);
+    /* everything in the larger set goes in, then what the smaller adds */
+    if ((set_reserve(out, a->len + b->len) == -1) ||
+        (set_build(out, larger, NULL, true) == -1) ||
+        (set_build(out, smaller, larger, false) == -1)) {
+        set_free(out, NULL);
         return -1;
     }
+    return 0;
+}
 
-    bucket->entries[len] = entry;
-    bucket->len++;
-    set->len++;
+int set_intersect(set* a, set* b, set* out) {
+    set* larger = a->len >= b->len ? a : b;
+    set* smaller = a->len >= b->len ? b : a;
+    *out = set_init_like(a);
+    if ((set_reserve(out, smaller->len) == -1) ||
+        (set_build(out, smaller, larger, true) == -1)) {
+        set_free(out, NULL);
+        return -1;
+    }
     return 0;
 }
 
-int set_delete(set* set, void* key, size_t key_len, FreeFn* free_fn) {
-    uint64_t hash = set_hash(set, key, key_len);
-    ht_bucket* bucket = &(set->buckets[hash]);
-    size_t i, len = bucket->len;
-    if (len == 0) {
+int set_difference(set* a, set* b, set* out) {
+    *out = set_init_like(a);
+    if ((set_reserve(out, a->len) == -1) ||
+        (set_build(out, a, b, false) == -1)) {
+        set_free(out, NULL);
         return -1;
     }
+    return 0;
+}
 
-    for (i = 0; i < len; ++i) {
-        ht_entry* cur = bucket->entries[i];
-        if (set->cmp_key) {
-            int cmp = set->cmp_key(key, cur->data);
-            if (cmp == 0) {
-                set_bucket_remove(bucket, i, free_fn);
-                set->len--;
-                return 0;
+bool set_is_subset(set* a, set* b) {
+    void* keys[SET_BATCH_SIZE];
+    size_t key_lens[SET_BATCH_SIZE];
+    size_t n, pos = 0;
+    if (a->len > b->len) {
+        return false;
+    }
+    while ((n = set_collect(a, &pos, keys, key_lens, SET_BATCH_SIZE)) > 0) {
+        if (set_has_many(b, keys, key_lens, n, NULL) != n) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static set set_init(size_t key_size, size_t cap, CmpFn* cmp_key,
+                    HashFn* hash_fn) {
+    set set = {0};
+    int init_res;
+    set.key_size = key_size;
+    set.slot_size = sizeof(uint64_t) + sizeof(set_key*);
+    if (key_size) {
+        /* keep the hash of every slot 8 byte aligned */
+        set.slot_size = sizeof(uint64_t) + ((key_size + 7) & ~((size_t)7));
+    }
+    init_res = set_table_init(&set, &set.tables[0], set_cap_for(cap));
+    assert(init_res == 0);
+    (void)init_res;
+    set.len = 0;
+    set.rehash_idx = -1;
+    set.cmp_key = cmp_key;
+    set.hash_fn = hash_fn ? hash_fn : hash_siphash;
+    get_random_bytes(set.seed, HT_SEED_SIZE);
+    return set;
+}
+
+/* create an empty set that stores its keys the same way as like */
+static set set_init_like(set* like) {
+    set res = set_init(like->key_size, 0, like->cmp_key, like->hash_fn);
+    res.arena = like->arena;
+    return res;
+}
+
+/**
+ * copy out up to max keys of set, starting at slot pos of its tables and
+ * moving pos past the slots that were visited. The keys point into the set,
+ * so they are only valid until the set is modified
+ */
+static size_t set_collect(set* set, size_t* pos, void** keys,
+                          size_t* key_lens, size_t max) {
+    size_t n = 0;
+    while (n < max) {
+        set_table* table = &(set->tables[0]);
+        size_t idx = *pos;
+        unsigned char* slot;
+        if (idx >= table->cap) {
+            idx -= table->cap;
+            table = &(set->tables[1]);
+            if (idx >= table->cap) {
+                break;
             }
+        }
+        slot = set_slot(set, table, idx);
+        (*pos)++;
+        if (set_slot_hash(slot) == 0) {
+            continue;
+        }
+        if (set->key_size) {
+            keys[n] = set_slot_data(slot);
+            key_lens[n] = set->key_size;
         } else {
-            size_t cur_key_len = cur->key_len;
-            if ((cur_key_len == key_len) &&
-                (memcmp(key, cur->data, key_len) == 0)) {
-                set_bucket_remove(bucket, i, free_fn);
-                set->len--;
-                return 0;
-            }
+            keys[n] = set_slot_key(slot)->data;
+            key_lens[n] = set_slot_key(slot)->key_len;
         }
+        n++;
     }
-    return -1;
+    return n;
 }
 
-void set_free(set* set, FreeFn* free_fn) {
-    size_t i, len = set->cap;
-    for (i = 0; i < len; ++i) {
-        ht_bucket bucket = set->buckets[i];
-        set_bucket_free(&bucket, free_fn);
+/**
+ * insert the keys of src into out. If probe is not null, only the keys that
+ * are in probe, or only those that are not if in_probe is false, are
+ * inserted. src is walked a batch at a time and each batch is resolved
+ * against probe with set_has_many. None of the keys may be in out already
+ */
+static int set_build(set* out, set* src, set* probe, bool in_probe) {
+    void* keys[SET_BATCH_SIZE];
+    size_t key_lens[SET_BATCH_SIZE];
+    bool found[SET_BATCH_SIZE];
+    size_t i, n, pos = 0;
+    while ((n = set_collect(src, &pos, keys, key_lens, SET_BATCH_SIZE)) > 0) {
+        if (probe) {
+            set_has_many(probe, keys, key_lens, n, found);
+        }
+        for (i = 0; i < n; ++i) {
+            if (probe && (found[i] != in_probe)) {
+                continue;
+            }
+            if (set_insert(out, keys[i], key_lens[i]) == -1) {
+                return -1;
+            }
+        }
     }
-    free(set->buckets);
+    return 0;
 }
 
 static uint64_t set_hash(set* set, void* key, size_t key_len) {
-    return siphash(key, key_len, set->seed) % set->cap;
+    return set_mark_hash(set->hash_fn(key, key_len, set->seed));
 }
 
-static int set_resize(set* set) {
-    size_t i, old_cap = set->cap;
-    size_t new_cap = old_cap << 1;
-    void* tmp = realloc(set->buckets, new_cap * sizeof(ht_bucket));
-    if (tmp == NULL) {
-        return -1;
+/**
+ * look for key in both tables. While rehashing, entries that have not been
+ * migrated yet are still in tables[0]
+ */
+static bool set_lookup(set* set, void* key, size_t key_len, uint64_t hash,
+                       set_table** table, size_t* idx) {
+    size_t i, num_tables = set_is_rehashing(set) ? 2 : 1;
+    for (i = 0; i < num_tables; ++i) {
+        if (set_find(set, &(set->tables[i]), key, key_len, hash, idx)) {
+            *table = &(set->tables[i]);
+            return true;
+        }
     }
-    set->buckets = tmp;
-    memset(&(set->buckets[old_cap]), 0,
-           (new_cap - old_cap) * sizeof(ht_bucket));
-    for (i = 0; i < old_cap; ++i) {
-        ht_bucket* bucket = &(set->buckets[i]);
-        size_t j, len = bucket->len;
-        for (j = 0; j < len; ++j) {
-            ht_entry* entry = bucket->entries[j];
-            size_t key_len = entry->key_len;
-            uint64_t hash = set_hash(set, entry->data, key_len);
-            if (hash == i) {
-                size_t k;
-                for (k = 0; k < j; ++k) {
-                    ht_entry* cur = bucket->entries[k];
-                    if (!cur) {
-                        memmove(&(bucket->entries[k]), &(bucket->entries[j]),
-                                sizeof(ht_entry*));
-                        memset(&(bucket->entries[j]), 0, sizeof(ht_entry*));
-                        goto next;
-                    }
-                }
-                goto next;
-            } else {
-                ht_bucket* new_bucket = &(set->buckets[hash]);
-                size_t new_bucket_len = new_bucket->len,
-                       new_bucket_cap = new_bucket->cap;
-                if (new_bucket_cap == 0) {
-                    if (set_init_bucket(new_bucket) == -1) {
-                        return -1;
-                    }
-                    new_bucket_cap = new_bucket->cap;
-                }
-                if (new_bucket->len == 0) {
-                    new_bucket->entries[0] = entry;
-                    memset(&(bucket->entries[j]), 0, sizeof(ht_entry*));
-                    new_bucket->len++;
-                    bucket->len--;
-                    goto next;
-                }
-                if (new_bucket_len == new_bucket_cap) {
-                    if (set_realloc_bucket(new_bucket) == -1) {
-                        return -1;
-                    }
-                }
-                memmove(&(new_bucket->entries[new_bucket_len]),
-                        &(bucket->entries[j]), sizeof(ht_entry*));
-                memset(&(bucket->entries[j]), 0, sizeof(ht_entry*));
-                new_bucket->len++;
-                bucket->len--;
-            }
-        next:
-            continue;
+    return false;
+}
+
+/**
+ * probe from the home slot of hash. The probe ends at an empty slot, or at a
+ * key closer to its home than key would be at that slot, since key would have
+ * displaced it on insert
+ */
+static bool set_find(set* set, set_table* table, void* key, size_t key_len,
+                     uint64_t hash, size_t* idx) {
+    size_t mask = table->cap - 1, i = set_home(hash, table->cap), dist = 0;
+    for (;;) {
+        unsigned char* slot = set_slot(set, table, i);
+        uint64_t cur = set_slot_hash(slot);
+        if ((cur == 0) || (set_dist(cur, i, table->cap) < dist)) {
+            return false;
+        }
+        if ((cur == hash) && set_slot_eq(set, slot, key, key_len)) {
+            *idx = i;
+            return true;
         }
+        i = (i + 1) & mask;
+        dist++;
     }
-    return 0;
 }
 
-static int set_init_bucket(ht_bucket* bucket) {
-    bucket->entries = calloc(HT_BUCKET_INITIAL_CAP, sizeof(ht_entry*));
-    if (bucket->entries == NULL) {
-        return -1;
+static bool set_slot_eq(set* set, unsigned char* slot, void* key,
+                        size_t key_len) {
+    set_key* copy;
+    if (set->key_size) {
+        if (set->cmp_key) {
+            return set->cmp_key(key, set_slot_data(slot)) == 0;
+        }
+        return key_eq_fixed(key, set_slot_data(slot), set->key_size);
     }
-    bucket->cap = HT_BUCKET_INITIAL_CAP;
-    return 0;
+    copy = set_slot_key(slot);
+    if (set->cmp_key) {
+        return set->cmp_key(key, copy->data) == 0;
+    }
+    return (copy->key_len == key_len) &&
+           (memcmp(key, copy->data, key_len) == 0);
 }
 
-static int set_realloc_bucket(ht_bucket* bucket) {
-    size_t len = bucket->len, new_cap = bucket->cap << 1;
-    void* tmp = realloc(bucket->entries, new_cap * sizeof(ht_entry*));
-    if (tmp == NULL) {
+/**
+ * find the slot a key with hash belongs in: the first slot holding a key that
+ * is closer to its home than the new key would be. The keys from there up to
+ * the next empty slot are shifted forward by one slot, which is what robin
+ * hood swapping ends up doing, and the freed slot is returned for the caller
+ * to fill
+ */
+static unsigned char* set_table_make_room(set* set, set_table* table,
+                                          uint64_t hash) {
+    size_t mask = table->cap - 1, i = set_home(hash, table->cap), dist = 0;
+    size_t end;
+    for (;;) {
+        uint64_t cur = set_slot_hash(set_slot(set, table, i));
+        if ((cur == 0) || (set_dist(cur, i, table->cap) < dist)) {
+            break;
+        }
+        i = (i + 1) & mask;
+        dist++;
+    }
+    end = i;
+    while (set_slot_hash(set_slot(set, table, end)) != 0) {
+        end = (end + 1) & mask;
+    }
+    while (end != i) {
+        size_t prev = (end - 1) & mask;
+        memcpy(set_slot(set, table, end), set_slot(set, table, prev),
+               set->slot_size);
+        end = prev;
+    }
+    return set_slot(set, table, i);
+}
+
+/**
+ * remove the key at idx by shifting the keys after it back by one slot, up to
+ * the first empty slot or key that is already in its home slot
+ */
+static void set_table_remove(set* set, set_table* table, size_t idx) {
+    size_t mask = table->cap - 1, next = (idx + 1) & mask;
+    for (;;) {
+        unsigned char* slot = set_slot(set, table, next);
+        uint64_t cur = set_slot_hash(slot);
+        if ((cur == 0) || (set_dist(cur, next, table->cap) == 0)) {
+            break;
+        }
+        memcpy(set_slot(set, table, idx), slot, set->slot_size);
+        idx = next;
+        next = (next + 1) & mask;
+    }
+    set_slot_hash(set_slot(set, table, idx)) = 0;
+    table->len--;
+}
+
+static void set_slot_free(set* set, unsigned char* slot, FreeFn* free_fn) {
+    if (set->key_size == 0) {
+        set_key* copy = set_slot_key(slot);
+        if (free_fn) {
+            free_fn(copy->data);
+        }
+        varena_dealloc(set->arena, copy);
+    } else if (free_fn) {
+        free_fn(set_slot_data(slot));
+    }
+}
+
+static set_key* set_key_new(set* set, void* key, size_t key_len) {
+    set_key* copy = varena_alloc(set->arena, (sizeof *copy) + key_len);
+    if (copy == NULL) {
+        return NULL;
+    }
+    copy->key_len = key_len;
+    memcpy(copy->data, key, key_len);
+    return copy;
+}
+
+/**
+ * start growing the set. A table with twice the slots is allocated in
+ * tables[1], and slots are migrated to it by the write operations that
+ * follow, so no single insert pays for rehashing the whole set
+ */
+static int set_resize(set* set) {
+    if (set_is_rehashing(set)) {
+        set_rehash_step(set, SIZE_MAX);
+    }
+    return set_rehash_to(set, set->tables[0].cap << 1);
+}
+
+/**
+ * start migrating the keys to a new table of cap slots, after finishing the
+ * migration in progress, if any
+ */
+static int set_rehash_to(set* set, size_t cap) {
+    if (set_is_rehashing(set)) {
+        set_rehash_step(set, SIZE_MAX);
+    }
+    if (set_table_init(set, &(set->tables[1]), cap) == -1) {
         return -1;
     }
-    bucket->entries = tmp;
-    memset(&(bucket->entries[len]), 0, (new_cap - len) * sizeof(ht_entry*));
-    bucket->cap = new_cap;
+    set->rehash_idx = 0;
+    /* there is nothing to spread out when the set is empty */
+    set_rehash_step(set, set->len ? SET_REHASH_STEP : SIZE_MAX);
     return 0;
 }
 
-static void set_bucket_remove(ht_bucket* bucket, size_t idx, FreeFn* free_fn) {
-    size_t len;
-    ht_entry* entry = bucket->entries[idx];
-    ht_entry_free(entry, free_fn, NULL);
-    bucket->len--;
-    len = bucket->len;
-    if (len == 0) {
-        memset(bucket->entries, 0, sizeof(ht_entry*));
-        return;
+/* the smallest capacity that holds n keys without growing */
+static size_t set_cap_for(size_t n) {
+    size_t cap = HT_INITIAL_CAP;
+    while (n > set_max_load(cap)) {
+        cap <<= 1;
     }
-    memmove(&(bucket->entries[idx]), &(bucket->entries[idx + 1]),
-            (len - idx) * sizeof(ht_entry*));
-    memset(&(bucket->entries[len]), 0, sizeof(ht_entry*));
+    return cap;
 }
 
-static void set_bucket_free(ht_bucket* bucket, FreeFn* free_fn) {
-    size_t i, len = bucket->len, cap = bucket->cap;
-    if (cap == 0) {
+/**
+ * migrate keys from tables[0] to tables[1], taking up to n steps that each
+ * move a key or pass an empty slot, so SIZE_MAX finishes the migration.
+ * Removing a key from tables[0] shifts the keys after it back, possibly into
+ * the slot that was just migrated, so a slot is only left behind once it is
+ * empty. The slots before rehash_idx are therefore always empty, and the keys
+ * left in tables[0] are still found by probing it
+ */
+static void set_rehash_step(set* set, size_t n) {
+    set_table* from = &(set->tables[0]);
+    set_table* to = &(set->tables[1]);
+    size_t i = (size_t)set->rehash_idx;
+    while ((n > 0) && (i < from->cap)) {
+        unsigned char* slot = set_slot(set, from, i);
+        uint64_t hash = set_slot_hash(slot);
+        n--;
+        if (hash == 0) {
+            i++;
+            continue;
+        }
+        memcpy(set_table_make_room(set, to, hash), slot, set->slot_size);
+        to->len++;
+        set_table_remove(set, from, i);
+    }
+    if (i < from->cap) {
+        set->rehash_idx = (ssize_t)i;
         return;
     }
+    free(from->slots);
+    *from = *to;
+    memset(to, 0, sizeof *to);
+    set->rehash_idx = -1;
+}
 
-    for (i = 0; i < len; ++i) {
-        ht_entry* entry = bucket->entries[i];
-        ht_entry_free(entry, free_fn, NULL);
+/**
+ * call fn with every key whose home slot is home. Those keys are kept
+ * together in the run that starts at home, after the keys of earlier homes
+ * that were displaced into it, and before the keys of later homes
+ */
+static size_t set_scan_home(set* set, set_table* table, size_t home,
+                            ScanFn* fn, void* ctx) {
+    size_t mask = table->cap - 1, i = home, dist = 0, found = 0;
+    for (;;) {
+        unsigned char* slot = set_slot(set, table, i);
+        uint64_t cur = set_slot_hash(slot);
+        size_t cur_dist;
+        if (cur == 0) {
+            return found;
+        }
+        cur_dist = set_dist(cur, i, table->cap);
+        if (cur_dist < dist) {
+            return found;
+        }
+        if (cur_dist == dist) {
+            if (set->key_size) {
+                fn(set_slot_data(slot), set->key_size, NULL, ctx);
+            } else {
+                fn(set_slot_key(slot)->data, set_slot_key(slot)->key_len, NULL,
+                   ctx);
+            }
+            found++;
+        }
+        i = (i + 1) & mask;
+        dist++;
     }
-    if (bucket->entries) {
-        free(bucket->entries);
+}
+
+/**
+ * set_has_many resolves a batch of keys in two rounds of prefetches: the home
+ * slots, then for sets that keep copies of their keys, the copy of each home
+ * slot's key, so the second round only touches slots the first brought into
+ * cache
+ */
+static void set_prefetch_slot(set* set, uint64_t hash) {
+    size_t i, num_tables = set_is_rehashing(set) ? 2 : 1;
+    for (i = 0; i < num_tables; ++i) {
+        set_table* table = &(set->tables[i]);
+        prefetch(set_slot(set, table, set_home(hash, table->cap)));
+    }
+}
+
+static void set_prefetch_key(set* set, uint64_t hash) {
+    size_t i, num_tables = set_is_rehashing(set) ? 2 : 1;
+    for (i = 0; i < num_tables; ++i) {
+        set_table* table = &(set->tables[i]);
+        unsigned char* slot =
+            set_slot(set, table, set_home(hash, table->cap));
+        if (set_slot_hash(slot) == hash) {
+            prefetch(set_slot_key(slot));
+        }
     }
 }
+
+static int set_table_init(set* set, set_table* table, size_t cap) {
+    assert((cap & (cap - 1)) == 0);
+    table->slots = calloc(cap, set->slot_size);
+    if (table->slots == NULL) {
+        return -1;
+    }
+    table->len = 0;
+    table->cap = cap;
+    return 0;
+}
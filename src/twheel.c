@@ -0,0 +1,126 @@
+#include "vlib.h"
+
+/**
+ * level l of the wheel holds timers that expire between 64^l and 64^(l+1)
+ * ticks from now, in the slot picked by the l-th group of 6 bits of their
+ * expiry tick. Every time level 0 wraps around, the current slot of level 1
+ * is cascaded: its timers are placed again, now landing in level 0, and so on
+ * for the higher levels. A timer is moved at most once per level, so
+ * scheduling, cancelling and expiring are all O(1) amortized
+ */
+
+#define TWHEEL_MASK (TWHEEL_SLOTS - 1)
+#define TWHEEL_MAX (((uint64_t)1) << (TWHEEL_BITS * TWHEEL_LEVELS))
+
+static void twheel_place(twheel* tw, twheel_timer* timer);
+static void twheel_unlink(twheel_timer* timer);
+static void twheel_cascade(twheel* tw, size_t level);
+
+twheel twheel_new(void) {
+    twheel tw = {0};
+    tw.now = 0;
+    tw.len = 0;
+    return tw;
+}
+
+void twheel_timer_init(twheel_timer* timer) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+}
+
+bool twheel_timer_pending(twheel_timer* timer) { return timer->pprev != NULL; }
+
+void twheel_add(twheel* tw, twheel_timer* timer, uint64_t ticks) {
+    twheel_remove(tw, timer);
+    timer->expires = tw->now + (ticks ? ticks : 1);
+    twheel_place(tw, timer);
+    tw->len++;
+}
+
+void twheel_remove(twheel* tw, twheel_timer* timer) {
+    if (!twheel_timer_pending(timer)) {
+        return;
+    }
+    twheel_unlink(timer);
+    tw->len--;
+}
+
+void twheel_advance(twheel* tw, uint64_t ticks, TimerFn* fn, void* ctx) {
+    while (ticks > 0) {
+        twheel_timer** slot;
+        if (tw->len == 0) {
+            tw->now += ticks;
+            return;
+        }
+        tw->now++;
+        ticks--;
+        if ((tw->now & TWHEEL_MASK) == 0) {
+            twheel_cascade(tw, 1);
+        }
+        slot = &(tw->slots[0][tw->now & TWHEEL_MASK]);
+        while (*slot) {
+            twheel_timer* timer = *slot;
+            twheel_unlink(timer);
+            tw->len--;
+            fn(timer, ctx);
+        }
+    }
+}
+
+static void twheel_place(twheel* tw, twheel_timer* timer) {
+    uint64_t expires = timer->expires, delta = expires - tw->now;
+    size_t level = 0, idx;
+    twheel_timer** slot;
+    if (delta >= TWHEEL_MAX) {
+        delta = TWHEEL_MAX - 1;
+        expires = tw->now + delta;
+    }
+    while (delta >= (((uint64_t)1) << (TWHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    idx = (size_t)((expires >> (TWHEEL_BITS * level)) & TWHEEL_MASK);
+    slot = &(tw->slots[level][idx]);
+    timer->next = *slot;
+    if (*slot) {
+        (*slot)->pprev = &(timer->next);
+    }
+    *slot = timer;
+    timer->pprev = slot;
+}
+
+static void twheel_unlink(twheel_timer* timer) {
+    *(timer->pprev) = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * place the timers of the current slot of level again. Their expiry is now
+ * less than 64^level ticks away, so they land in a lower level. When the slot
+ * is the first of its level, the level above wraps around too and is
+ * cascaded first
+ */
+static void twheel_cascade(twheel* tw, size_t level) {
+    size_t idx;
+    twheel_timer* cur;
+    if (level >= TWHEEL_LEVELS) {
+        return;
+    }
+    idx = (size_t)((tw->now >> (TWHEEL_BITS * level)) & TWHEEL_MASK);
+    if (idx == 0) {
+        twheel_cascade(tw, level + 1);
+    }
+    cur = tw->slots[level][idx];
+    tw->slots[level][idx] = NULL;
+    while (cur) {
+        twheel_timer* next = cur->next;
+        cur->next = NULL;
+        cur->pprev = NULL;
+        twheel_place(tw, cur);
+        cur = next;
+    }
+}
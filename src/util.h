@@ -2,8 +2,10 @@
 
 #define __UTIL_H__
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 /**
  * @brief utility function for putting random bytes into a buffer of len length
@@ -12,4 +14,74 @@
  */
 void get_random_bytes(uint8_t* p, size_t len);
 
+/**
+ * hint to the cpu that the memory at addr is going to be read soon
+ */
+#if defined(__GNUC__)
+#define prefetch(addr) __builtin_prefetch(addr)
+#else
+#define prefetch(addr) ((void)(addr))
+#endif
+
+/**
+ * @brief check if two keys of key_size bytes are equal. Keys of 4, 8 and 16
+ * bytes are compared a word at a time, other sizes fall back to memcmp
+ * @param a the first key
+ * @param b the second key
+ * @param key_size the size of both keys
+ * @returns true if the keys are equal, false if not
+ */
+static inline bool key_eq_fixed(const void* a, const void* b,
+                                size_t key_size) {
+    uint64_t a0, a1, b0, b1;
+    uint32_t a32, b32;
+    switch (key_size) {
+    case sizeof(uint32_t):
+        memcpy(&a32, a, sizeof a32);
+        memcpy(&b32, b, sizeof b32);
+        return a32 == b32;
+    case sizeof(uint64_t):
+        memcpy(&a0, a, sizeof a0);
+        memcpy(&b0, b, sizeof b0);
+        return a0 == b0;
+    case 2 * sizeof(uint64_t):
+        memcpy(&a0, a, sizeof a0);
+        memcpy(&a1, ((const unsigned char*)a) + sizeof a0, sizeof a1);
+        memcpy(&b0, b, sizeof b0);
+        memcpy(&b1, ((const unsigned char*)b) + sizeof b0, sizeof b1);
+        return ((a0 ^ b0) | (a1 ^ b1)) == 0;
+    default:
+        return memcmp(a, b, key_size) == 0;
+    }
+}
+
+/**
+ * @brief reverse the bits of v
+ */
+static inline size_t rev_bits(size_t v) {
+    size_t s = sizeof(v) * 8, mask = ~((size_t)0);
+    while ((s >>= 1) > 0) {
+        mask ^= (mask << s);
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+/**
+ * @brief advance a scan cursor over a table of mask + 1 buckets. The cursor
+ * counts up from its high bits, so the buckets a cursor has visited in a
+ * table of one size map to buckets it has visited in a table of any other
+ * power of two size, and a scan stays complete when the table is resized
+ * between calls
+ * @param cursor the cursor to advance
+ * @param mask the size of the table minus one
+ * @returns the next cursor, 0 once every bucket was visited
+ */
+static inline size_t scan_cursor_next(size_t cursor, size_t mask) {
+    cursor |= ~mask;
+    cursor = rev_bits(cursor);
+    cursor++;
+    return rev_bits(cursor);
+}
+
 #endif /* __UTIL_H__ */
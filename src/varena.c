@@ -0,0 +1,225 @@
+#define _POSIX_C_SOURCE 200112L
+#include "vlib.h"
+#include <memory.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * every slab is VARENA_SLAB_SIZE bytes and aligned to VARENA_SLAB_SIZE, so the
+ * slab that owns a pointer is found by masking off the low bits of the
+ * pointer. Allocations larger than the biggest size class come straight from
+ * malloc, behind a header that links them into a list of their own, so they
+ * don't pay for the alignment of a slab. The arena keeps a set of the
+ * addresses of its slabs: a pointer whose masked address is not in the set is
+ * a large allocation, and its header sits right before it. Masked addresses
+ * are only compared, never read, so a large allocation anywhere in memory
+ * can't be mistaken for a slab
+ */
+
+#define VARENA_LARGE_CLASS VARENA_NUM_CLASSES
+#define varena_slab_of(ptr)                                                    \
+    ((varena_slab*)(((uintptr_t)(ptr)) & ~((uintptr_t)VARENA_SLAB_SIZE - 1)))
+
+typedef struct varena_slab {
+    struct varena_slab* prev; /* previous slab owned by the arena */
+    struct varena_slab* next; /* next slab owned by the arena */
+    size_t size_class;        /* index into varena_class_sizes, or
+                                 VARENA_LARGE_CLASS */
+    size_t pad;               /* keeps the objects 16 byte aligned */
+    unsigned char data[];
+} varena_slab;
+
+/* large allocations use the slab header, without the alignment */
+#define varena_large_of(ptr) (((varena_slab*)(ptr)) - 1)
+
+/* the slab address set is grown once it is half full */
+#define VARENA_MIN_SLAB_ADDRS 16
+#define varena_addr_hash(addr)                                                 \
+    ((size_t)(((uint64_t)(addr) >> 16) * 0x9E3779B97F4A7C15ULL))
+
+static const size_t varena_class_sizes[VARENA_NUM_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048,
+};
+
+static size_t varena_size_class(size_t size);
+static varena_slab* varena_slab_new(varena* arena, size_t size_class);
+static varena_slab* varena_large_new(varena* arena, size_t size);
+static void varena_large_unlink(varena* arena, varena_slab* large);
+static bool varena_has_slab(varena* arena, uintptr_t addr);
+static int varena_add_slab(varena* arena, uintptr_t addr);
+static void varena_insert_addr(uintptr_t* addrs, size_t cap, uintptr_t addr);
+
+varena varena_new(void) {
+    varena arena = {0};
+    return arena;
+}
+
+void* varena_alloc(varena* arena, size_t size) {
+    size_t size_class;
+    void* ptr;
+    if (arena == NULL) {
+        return malloc(size);
+    }
+    size_class = varena_size_class(size);
+    if (size_class == VARENA_LARGE_CLASS) {
+        varena_slab* large = varena_large_new(arena, size);
+        return large ? large->data : NULL;
+    }
+    ptr = arena->free_lists[size_class];
+    if (ptr) {
+        arena->free_lists[size_class] = *((void**)ptr);
+        return ptr;
+    }
+    if (arena->bump_avail[size_class] == 0) {
+        varena_slab* slab = varena_slab_new(arena, size_class);
+        if (slab == NULL) {
+            return NULL;
+        }
+        arena->bump[size_class] = slab->data;
+        arena->bump_avail[size_class] =
+            (VARENA_SLAB_SIZE - sizeof *slab) / varena_class_sizes[size_class];
+    }
+    ptr = arena->bump[size_class];
+    arena->bump[size_class] += varena_class_sizes[size_class];
+    arena->bump_avail[size_class]--;
+    return ptr;
+}
+
+void varena_dealloc(varena* arena, void* ptr) {
+    varena_slab* slab;
+    if (arena == NULL) {
+        free(ptr);
+        return;
+    }
+    if (ptr == NULL) {
+        return;
+    }
+    slab = varena_slab_of(ptr);
+    if (!varena_has_slab(arena, (uintptr_t)slab)) {
+        varena_slab* large = varena_large_of(ptr);
+        varena_large_unlink(arena, large);
+        free(large);
+        return;
+    }
+    *((void**)ptr) = arena->free_lists[slab->size_class];
+    arena->free_lists[slab->size_class] = ptr;
+}
+
+void varena_free(varena* arena) {
+    varena_slab* cur = arena->slabs;
+    while (cur) {
+        varena_slab* next = cur->next;
+        free(cur);
+        cur = next;
+    }
+    cur = arena->large;
+    while (cur) {
+        varena_slab* next = cur->next;
+        free(cur);
+        cur = next;
+    }
+    free(arena->slab_addrs);
+    memset(arena, 0, sizeof *arena);
+}
+
+static size_t varena_size_class(size_t size) {
+    size_t i;
+    for (i = 0; i < VARENA_NUM_CLASSES; ++i) {
+        if (size <= varena_class_sizes[i]) {
+            return i;
+        }
+    }
+    return VARENA_LARGE_CLASS;
+}
+
+static varena_slab* varena_slab_new(varena* arena, size_t size_class) {
+    void* block;
+    varena_slab* slab;
+    if (posix_memalign(&block, VARENA_SLAB_SIZE, VARENA_SLAB_SIZE) != 0) {
+        return NULL;
+    }
+    if (varena_add_slab(arena, (uintptr_t)block) == -1) {
+        free(block);
+        return NULL;
+    }
+    slab = block;
+    slab->size_class = size_class;
+    slab->prev = NULL;
+    slab->next = arena->slabs;
+    if (arena->slabs) {
+        arena->slabs->prev = slab;
+    }
+    arena->slabs = slab;
+    return slab;
+}
+
+static varena_slab* varena_large_new(varena* arena, size_t size) {
+    varena_slab* large = malloc(sizeof *large + size);
+    if (large == NULL) {
+        return NULL;
+    }
+    large->size_class = VARENA_LARGE_CLASS;
+    large->prev = NULL;
+    large->next = arena->large;
+    if (arena->large) {
+        arena->large->prev = large;
+    }
+    arena->large = large;
+    return large;
+}
+
+static void varena_large_unlink(varena* arena, varena_slab* large) {
+    if (large->prev) {
+        large->prev->next = large->next;
+    } else {
+        arena->large = large->next;
+    }
+    if (large->next) {
+        large->next->prev = large->prev;
+    }
+}
+
+static bool varena_has_slab(varena* arena, uintptr_t addr) {
+    size_t mask = arena->slab_addrs_cap - 1, idx;
+    if (arena->slab_addrs_cap == 0) {
+        return false;
+    }
+    idx = varena_addr_hash(addr) & mask;
+    while (arena->slab_addrs[idx] != 0) {
+        if (arena->slab_addrs[idx] == addr) {
+            return true;
+        }
+        idx = (idx + 1) & mask;
+    }
+    return false;
+}
+
+static int varena_add_slab(varena* arena, uintptr_t addr) {
+    if ((arena->num_slabs + 1) * 2 > arena->slab_addrs_cap) {
+        size_t i, cap = arena->slab_addrs_cap ? arena->slab_addrs_cap * 2
+                                              : VARENA_MIN_SLAB_ADDRS;
+        uintptr_t* addrs = calloc(cap, sizeof(uintptr_t));
+        if (addrs == NULL) {
+            return -1;
+        }
+        for (i = 0; i < arena->slab_addrs_cap; ++i) {
+            if (arena->slab_addrs[i] != 0) {
+                varena_insert_addr(addrs, cap, arena->slab_addrs[i]);
+            }
+        }
+        free(arena->slab_addrs);
+        arena->slab_addrs = addrs;
+        arena->slab_addrs_cap = cap;
+    }
+    varena_insert_addr(arena->slab_addrs, arena->slab_addrs_cap, addr);
+    arena->num_slabs++;
+    return 0;
+}
+
+static void varena_insert_addr(uintptr_t* addrs, size_t cap, uintptr_t addr) {
+    size_t mask = cap - 1, idx = varena_addr_hash(addr) & mask;
+    while (addrs[idx] != 0) {
+        idx = (idx + 1) & mask;
+    }
+    addrs[idx] = addr;
+}
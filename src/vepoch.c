@@ -0,0 +1,204 @@
+#define _POSIX_C_SOURCE 200112L
+#include "vlib.h"
+#include <sched.h>
+#include <stdlib.h>
+
+/**
+ * epoch based reclamation. The global epoch only moves from g to g + 1 once
+ * every thread that is reading has announced g, so when it reaches g + 2, no
+ * thread can still be reading in g or earlier, and memory retired while the
+ * epoch was g is no longer reachable by any reader.
+ *
+ * Every thread has its own reader record, on a cache line of its own, so
+ * entering and leaving a read section only writes memory no other thread
+ * writes. Records are found through a thread specific key and are never
+ * freed before the domain: a thread that exits gives its record up for the
+ * next thread to claim
+ */
+
+#define VEPOCH_CACHE_LINE 64
+
+struct vepoch_reader {
+    uint64_t epoch;              /* the epoch of the read in progress, 0 when
+                                    the thread is not reading */
+    uint32_t in_use;             /* set while a live thread owns the record */
+    struct vepoch_reader* next;  /* the next record of the domain */
+};
+
+typedef struct vepoch_retired {
+    void* ptr;      /* the memory to free */
+    uint64_t epoch; /* the global epoch when ptr was retired */
+} vepoch_retired;
+
+static vepoch_reader* vepoch_reader_new(vepoch* e);
+static void vepoch_reader_release(void* ptr);
+static bool vepoch_try_advance(vepoch* e);
+static void vepoch_synchronize(vepoch* e);
+
+vepoch vepoch_new(void) {
+    vepoch e = {0};
+    e.epoch = 1;
+    e.readers = NULL;
+    e.has_key = pthread_key_create(&e.key, vepoch_reader_release) == 0;
+    return e;
+}
+
+vepoch_reader* vepoch_enter(vepoch* e) {
+    vepoch_reader* r;
+    uint64_t epoch;
+    if (!e->has_key) {
+        return NULL;
+    }
+    r = pthread_getspecific(e->key);
+    if (r == NULL) {
+        r = vepoch_reader_new(e);
+        if (r == NULL) {
+            return NULL;
+        }
+    }
+    epoch = __atomic_load_n(&(e->epoch), __ATOMIC_RELAXED);
+    __atomic_store_n(&(r->epoch), epoch, __ATOMIC_RELAXED);
+    /* the epoch must be visible before anything the read section loads */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return r;
+}
+
+void vepoch_exit(vepoch_reader* r) {
+    __atomic_store_n(&(r->epoch), 0, __ATOMIC_RELEASE);
+}
+
+vepoch_list vepoch_list_new(void) {
+    vepoch_list list = {0};
+    return list;
+}
+
+void vepoch_retire(vepoch* e, vepoch_list* list, void* ptr) {
+    if (list->len == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : VEPOCH_RECLAIM_AT;
+        vepoch_retired* items = realloc(list->items, cap * sizeof *items);
+        if (items == NULL) {
+            /* wait until nobody can be reading ptr instead */
+            vepoch_synchronize(e);
+            free(ptr);
+            return;
+        }
+        list->items = items;
+        list->cap = cap;
+    }
+    /* ptr was unlinked before the epoch it is tagged with is read */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    list->items[list->len].ptr = ptr;
+    list->items[list->len].epoch =
+        __atomic_load_n(&(e->epoch), __ATOMIC_SEQ_CST);
+    list->len++;
+    if ((list->len % VEPOCH_RECLAIM_AT) == 0) {
+        vepoch_reclaim(e, list);
+    }
+}
+
+void vepoch_reclaim(vepoch* e, vepoch_list* list) {
+    size_t i, kept = 0;
+    uint64_t epoch;
+    vepoch_try_advance(e);
+    epoch = __atomic_load_n(&(e->epoch), __ATOMIC_SEQ_CST);
+    for (i = 0; i < list->len; ++i) {
+        if ((list->items[i].epoch + 2) <= epoch) {
+            free(list->items[i].ptr);
+            continue;
+        }
+        list->items[kept++] = list->items[i];
+    }
+    list->len = kept;
+}
+
+void vepoch_list_free(vepoch_list* list) {
+    size_t i;
+    for (i = 0; i < list->len; ++i) {
+        free(list->items[i].ptr);
+    }
+    free(list->items);
+    list->items = NULL;
+    list->len = 0;
+    list->cap = 0;
+}
+
+void vepoch_free(vepoch* e) {
+    vepoch_reader* cur = e->readers;
+    if (e->has_key) {
+        pthread_key_delete(e->key);
+        e->has_key = false;
+    }
+    while (cur) {
+        vepoch_reader* next = cur->next;
+        free(cur);
+        cur = next;
+    }
+    e->readers = NULL;
+}
+
+/**
+ * claim the record of a thread that exited, or link a new one. Records are
+ * only ever pushed onto the front of the list, so the list can be walked
+ * without a lock
+ */
+static vepoch_reader* vepoch_reader_new(vepoch* e) {
+    void* block;
+    vepoch_reader* r = __atomic_load_n(&(e->readers), __ATOMIC_ACQUIRE);
+    for (; r; r = r->next) {
+        uint32_t expected = 0;
+        if (__atomic_compare_exchange_n(&(r->in_use), &expected, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (r == NULL) {
+        if (posix_memalign(&block, VEPOCH_CACHE_LINE, VEPOCH_CACHE_LINE) !=
+            0) {
+            return NULL;
+        }
+        r = block;
+        r->epoch = 0;
+        r->in_use = 1;
+        r->next = __atomic_load_n(&(e->readers), __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&(e->readers), &(r->next), r,
+                                            true, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+    }
+    if (pthread_setspecific(e->key, r) != 0) {
+        __atomic_store_n(&(r->in_use), 0, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    return r;
+}
+
+static void vepoch_reader_release(void* ptr) {
+    vepoch_reader* r = ptr;
+    __atomic_store_n(&(r->epoch), 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&(r->in_use), 0, __ATOMIC_RELEASE);
+}
+
+/* move the global epoch on if every thread that is reading has seen it */
+static bool vepoch_try_advance(vepoch* e) {
+    uint64_t epoch = __atomic_load_n(&(e->epoch), __ATOMIC_SEQ_CST);
+    vepoch_reader* r = __atomic_load_n(&(e->readers), __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (; r; r = r->next) {
+        uint64_t seen = __atomic_load_n(&(r->epoch), __ATOMIC_ACQUIRE);
+        if ((seen != 0) && (seen != epoch)) {
+            return false;
+        }
+    }
+    return __atomic_compare_exchange_n(&(e->epoch), &epoch, epoch + 1, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/* wait until every read section that started before the call has ended */
+static void vepoch_synchronize(vepoch* e) {
+    uint64_t target = __atomic_load_n(&(e->epoch), __ATOMIC_SEQ_CST) + 2;
+    while (__atomic_load_n(&(e->epoch), __ATOMIC_SEQ_CST) < target) {
+        if (!vepoch_try_advance(e)) {
+            sched_yield();
+        }
+    }
+}
@@ -11,9 +11,16 @@
  *              - Doubly linked list (list.c)
  *              - Priority Queue (Min-heap) (pq.c)
  *              - Hashtable (ht.c)
+ *              - Concurrent hashtable (cht.c)
  *              - avl tree (avl_tree.c)
  *              - generic tree (tree.c)
  *              - set (set.c)
+ *              - lru and tlfu caches (lru.c)
+ *              - concurrent lru (clru.c)
+ *              - timing wheel (twheel.c)
+ *              - arena allocator (varena.c)
+ *              - epoch based reclamation (vepoch.c)
+ *              - string intern pool (vstr_pool.c)
  *
  *              Algorithms:
  *              - binary search (binary_search.c)
@@ -30,6 +37,7 @@
 
 #include "small_vec.h"
 #include "util.h"
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -126,6 +134,169 @@ void merge_sort(void* arr, size_t len, size_t data_size, CmpFn* fn);
  */
 void quick_sort(void* arr, size_t len, size_t data_size, CmpFn* fn);
 
+#define VARENA_SLAB_SIZE (1 << 16)
+#define VARENA_NUM_CLASSES 14
+
+/**
+ * @brief slab allocator for the nodes and entries of the node based data
+ * structures
+ *
+ * Memory is carved out of VARENA_SLAB_SIZE byte slabs, each holding objects of
+ * a single size class (16 bytes up to 2048 bytes). Freed objects go on a free
+ * list for their size class and are handed out again by the next allocation
+ * of that class, so allocating and freeing nodes rarely reaches malloc.
+ * Objects larger than the biggest size class are allocated with malloc and
+ * kept on a list of their own.
+ *
+ * The data structures that take an arena (ht_new_with_arena,
+ * set_new_with_arena, list_new_with_arena, queue_new_with_arena,
+ * avl_tree_new_with_arena and binary_node_new_with_arena) allocate their
+ * nodes from it and hand them back to it when they are removed. An arena can
+ * be shared by several data structures, but it is not thread safe.
+ * varena_free releases every slab and large object at once.
+ *
+ * Available operations:
+ *      - alloc (varena_alloc)
+ *      - dealloc (varena_dealloc)
+ */
+typedef struct {
+    struct varena_slab* slabs; /* every slab owned by the arena */
+    struct varena_slab* large; /* allocations larger than the biggest class */
+    uintptr_t* slab_addrs;     /* set of the addresses of the slabs */
+    size_t slab_addrs_cap;     /* the number of entries in slab_addrs */
+    size_t num_slabs;          /* the number of slabs */
+    void* free_lists[VARENA_NUM_CLASSES]; /* freed objects of each class */
+    unsigned char* bump[VARENA_NUM_CLASSES]; /* next unused object of the
+                                                current slab of each class */
+    size_t bump_avail[VARENA_NUM_CLASSES]; /* unused objects left in the
+                                              current slab of each class */
+} varena;
+
+/**
+ * @brief create a new arena. No memory is allocated until the first call to
+ * varena_alloc
+ * @returns the newly created arena
+ */
+varena varena_new(void);
+/**
+ * @brief allocate memory from an arena
+ * @param arena the arena to allocate from. If null, malloc is used
+ * @param size the number of bytes to allocate
+ * @returns pointer to at least size bytes aligned to 16 bytes, NULL on failure
+ */
+void* varena_alloc(varena* arena, size_t size);
+/**
+ * @brief give memory back to the arena it was allocated from
+ * @param arena the arena ptr was allocated from. If null, free is used
+ * @param ptr the memory to give back. If null, it is ignored
+ */
+void varena_dealloc(varena* arena, void* ptr);
+/**
+ * @brief release all memory owned by the arena. Every pointer allocated from
+ * it becomes invalid
+ * @param arena the arena to free
+ */
+void varena_free(varena* arena);
+
+/* the number of retired pointers between two attempts to free them */
+#define VEPOCH_RECLAIM_AT 64
+
+/**
+ * the record a thread reads through in an epoch domain
+ */
+typedef struct vepoch_reader vepoch_reader;
+
+/**
+ * @brief epoch based reclamation, for memory that threads read without a lock
+ *
+ * Readers wrap every lookup in vepoch_enter and vepoch_exit, which only write
+ * to a record owned by the calling thread. Writers that unlink memory
+ * readers may still be using retire it instead of freeing it, and it is
+ * freed once every read section that could have seen it has ended. The
+ * domain keeps a global epoch that is moved on by writers once every thread
+ * that is reading has seen the current one. Memory retired in epoch g is
+ * freed when the epoch reaches g + 2.
+ *
+ * Retired memory is kept in vepoch_list's owned by the writers, so writers
+ * serialized by different locks don't share a list. Everything retired must
+ * have been allocated with malloc.
+ *
+ * Available operations:
+ *      - enter a read section (vepoch_enter)
+ *      - exit a read section (vepoch_exit)
+ *      - retire memory (vepoch_retire)
+ *      - free retired memory (vepoch_reclaim)
+ */
+typedef struct {
+    uint64_t epoch;                /* the global epoch, starting at 1 */
+    struct vepoch_reader* readers; /* the record of every thread that read */
+    pthread_key_t key;             /* the record of the calling thread */
+    bool has_key;                  /* false if key could not be created */
+} vepoch;
+
+/**
+ * @brief memory retired by one writer
+ */
+typedef struct {
+    struct vepoch_retired* items; /* the retired pointers and their epochs */
+    size_t len;                   /* the number of retired pointers */
+    size_t cap;                   /* the number of items allocated */
+} vepoch_list;
+
+/**
+ * @brief create an epoch domain. The domain must not move once threads read
+ * through it
+ * @returns the domain
+ */
+vepoch vepoch_new(void);
+/**
+ * @brief start a read section. Memory retired after this call is not freed
+ * before the matching vepoch_exit
+ * @param e the domain to read in
+ * @returns the record of the calling thread, to pass to vepoch_exit, NULL if
+ * the thread could not be registered, in which case the caller must not read
+ * without a lock
+ */
+vepoch_reader* vepoch_enter(vepoch* e);
+/**
+ * @brief end a read section
+ * @param r the record returned by vepoch_enter
+ */
+void vepoch_exit(vepoch_reader* r);
+/**
+ * @brief create an empty list of retired memory
+ * @returns the list
+ */
+vepoch_list vepoch_list_new(void);
+/**
+ * @brief free ptr once no reader can be using it. ptr must already be
+ * unreachable for readers that start after the call. Calls to the same list
+ * must be serialized by the caller
+ * @param e the domain readers of ptr read in
+ * @param list the list of the caller to keep ptr in
+ * @param ptr memory allocated with malloc
+ */
+void vepoch_retire(vepoch* e, vepoch_list* list, void* ptr);
+/**
+ * @brief free the memory of list that no reader can be using anymore.
+ * vepoch_retire calls it every VEPOCH_RECLAIM_AT pointers
+ * @param e the domain readers of the memory read in
+ * @param list the list to free memory from
+ */
+void vepoch_reclaim(vepoch* e, vepoch_list* list);
+/**
+ * @brief free everything in a list, whether it was safe to free or not. No
+ * thread may be reading
+ * @param list the list to free
+ */
+void vepoch_list_free(vepoch_list* list);
+/**
+ * @brief free an epoch domain. No thread may be reading, and the lists of the
+ * domain must be freed separately
+ * @param e the domain to free
+ */
+void vepoch_free(vepoch* e);
+
 #define VSTR_MAX_SMALL_SIZE 23
 #define VSTR_MAX_LARGE_SIZE ((((uint64_t)(1)) << 56) - 1)
 
@@ -185,6 +356,22 @@ typedef struct {
                              a small string */
 } vstr;
 
+/**
+ * @brief a view of a string that does not own it
+ *
+ * A view is a pointer and a length into a vstr or any other buffer, so
+ * slicing and tokenizing never allocate. The viewed bytes must outlive the
+ * view, and a view of a vstr is only valid until the vstr is modified or
+ * freed. Views are passed by value. The compare and search functions work the
+ * same as their vstr counterparts, which are implemented on top of them.
+ * Since keys are plain bytes, a view is looked up in an ht or a set by passing
+ * its data and len, and hashed with any HashFn the same way.
+ */
+typedef struct {
+    const char* data; /* the first viewed byte, not null terminated */
+    size_t len;       /* the number of viewed bytes */
+} vstr_view;
+
 /**
  * @breif create a new vstr. Default initial type is a small string
  * @returns a vstr struct
@@ -230,12 +417,49 @@ size_t vstr_len(vstr* s);
  */
 const char* vstr_data(vstr* s);
 /**
- * @brief compare two vstr's
+ * @brief compare two vstr's byte by byte. The strings may contain nulls. When
+ * one string is a prefix of the other, the shorter one sorts after it
  * @param a vstr to compare
  * @param b vstr to compare
- * @returns 0 if they are equal, non zero if they are not
+ * @returns 0 if they are equal, less than 0 if a sorts before b and greater
+ * than 0 if it sorts after
  */
 int vstr_cmp(vstr* a, vstr* b);
+/**
+ * @brief compare two vstr's, ignoring ascii case. Strings are ordered like
+ * vstr_cmp, so the shorter of two strings where one is a prefix of the other
+ * sorts after it
+ * @param a vstr to compare
+ * @param b vstr to compare
+ * @returns 0 if they are equal ignoring case, less than 0 if a sorts before b
+ * and greater than 0 if it sorts after
+ */
+int vstr_casecmp(vstr* a, vstr* b);
+/**
+ * @brief find the first occurrence of a byte string in a vstr
+ * @param s the vstr to search
+ * @param needle the bytes to look for. May contain nulls
+ * @param needle_len the number of bytes in needle
+ * @returns the index of the first occurrence, -1 if there is none
+ */
+ssize_t vstr_find(vstr* s, const char* needle, size_t needle_len);
+/**
+ * @brief find the first occurrence of a char in a vstr
+ * @param s the vstr to search
+ * @param c the char to look for
+ * @returns the index of the first occurrence, -1 if there is none
+ */
+ssize_t vstr_find_char(vstr* s, char c);
+/**
+ * @brief split a vstr at each occurrence of delim. Once max - 1 parts were
+ * split off, the last part holds the rest of the string
+ * @param s the vstr to split
+ * @param delim the char to split at
+ * @param out where the parts are stored. Each one must be freed with vstr_free
+ * @param max the maximum number of parts, at most the size of out
+ * @returns the number of parts stored in out
+ */
+size_t vstr_split(vstr* s, char delim, vstr* out, size_t max);
 /**
  * @brief append a char to a vstr
  * @param s the vstr to append to
@@ -250,11 +474,130 @@ int vstr_push_char(vstr* s, char c);
  * @returns 0 on success, -1 on failure
  */
 int vstr_push_string(vstr* s, const char* str);
+/**
+ * @brief append len bytes to a vstr. The bytes may contain nulls
+ * @param s the vstr to append to
+ * @param str the bytes to append. Must not point into s
+ * @param len the number of bytes to append
+ * @returns 0 on success, -1 on failure
+ */
+int vstr_push_len(vstr* s, const char* str, size_t len);
+/**
+ * @brief append another vstr to a vstr
+ * @param s the vstr to append to
+ * @param other the vstr to append. May be s itself
+ * @returns 0 on success, -1 on failure
+ */
+int vstr_append(vstr* s, vstr* other);
+/**
+ * @brief create a vstr that is the concatenation of n vstrs. The total length
+ * is computed first, so the result is allocated at most once
+ * @param parts the vstrs to concatenate
+ * @param n the number of vstrs in parts
+ * @returns the concatenation of parts
+ */
+vstr vstr_concat_n(vstr* parts, size_t n);
+/**
+ * @brief make room for a string of len bytes, so that appending up to that
+ * length does not reallocate. Without it, large strings double their
+ * capacity whenever they run out of room
+ * @param s the vstr to make room in
+ * @param len the length to make room for, not counting the null terminator
+ * @returns 0 on success, -1 on failure
+ */
+int vstr_reserve(vstr* s, size_t len);
+/**
+ * @brief release the capacity a vstr is not using. A large string that is
+ * short enough becomes a small string again
+ * @param s the vstr to shrink
+ * @returns 0 on success, -1 on failure
+ */
+int vstr_shrink_to_fit(vstr* s);
 /**
  * @brief free a vstr
  * @param s the vstr to free
  */
 void vstr_free(vstr* s);
+/**
+ * @brief view the whole string of a vstr
+ * @param s the vstr to view
+ * @returns a view that is valid until s is modified or freed
+ */
+vstr_view vstr_view_of(vstr* s);
+/**
+ * @brief view len bytes of a buffer
+ * @param data the buffer
+ * @param len the number of bytes to view
+ * @returns the view
+ */
+vstr_view vstr_view_from(const char* data, size_t len);
+/**
+ * @brief view part of a view. The slice is clamped to the end of v
+ * @param v the view to slice
+ * @param start the index the slice starts at
+ * @param len the length of the slice
+ * @returns the slice
+ */
+vstr_view vstr_view_slice(vstr_view v, size_t start, size_t len);
+/**
+ * @brief copy the bytes of a view into a new vstr
+ * @param v the view to copy
+ * @returns the new vstr
+ */
+vstr vstr_from_view(vstr_view v);
+/**
+ * @brief compare two views byte by byte, like vstr_cmp. When one view is a
+ * prefix of the other, the shorter one sorts after it
+ * @param a view to compare
+ * @param b view to compare
+ * @returns 0 if they are equal, less than 0 if a sorts before b and greater
+ * than 0 if it sorts after
+ */
+int vstr_view_cmp(vstr_view a, vstr_view b);
+/**
+ * @brief compare two views ignoring ascii case, like vstr_casecmp. Views are
+ * ordered like vstr_view_cmp, so the shorter of two views where one is a
+ * prefix of the other sorts after it
+ * @param a view to compare
+ * @param b view to compare
+ * @returns 0 if they are equal ignoring case, less than 0 if a sorts before b
+ * and greater than 0 if it sorts after
+ */
+int vstr_view_casecmp(vstr_view a, vstr_view b);
+/**
+ * @brief find the first occurrence of a byte string in a view
+ * @param v the view to search
+ * @param needle the bytes to look for. May contain nulls
+ * @param needle_len the number of bytes in needle
+ * @returns the index of the first occurrence, -1 if there is none
+ */
+ssize_t vstr_view_find(vstr_view v, const char* needle, size_t needle_len);
+/**
+ * @brief find the first occurrence of a char in a view
+ * @param v the view to search
+ * @param c the char to look for
+ * @returns the index of the first occurrence, -1 if there is none
+ */
+ssize_t vstr_view_find_char(vstr_view v, char c);
+/**
+ * @brief split the next token off a view. Call it until it returns false to
+ * walk the tokens of a buffer, then rest holds the part after the last delim
+ * @param rest the view to split. It is moved past the token and the delim
+ * @param delim the char that ends a token
+ * @param token set to the token, without the delim
+ * @returns true if a token was split off, false if rest has no delim left
+ */
+bool vstr_view_next_token(vstr_view* rest, char delim, vstr_view* token);
+/**
+ * @brief split a view at each occurrence of delim, like vstr_split, without
+ * copying
+ * @param v the view to split
+ * @param delim the char to split at
+ * @param out where the parts are stored
+ * @param max the maximum number of parts, at most the size of out
+ * @returns the number of parts stored in out
+ */
+size_t vstr_view_split(vstr_view v, char delim, vstr_view* out, size_t max);
 
 /**
  * @brief a vector representation
@@ -425,6 +768,7 @@ typedef struct {
     size_t data_size;   /* the size of the data in the nodes */
     struct qnode* head; /* the first element of the queue */
     struct qnode* tail; /* the last element of the queue */
+    varena* arena;      /* optional arena the nodes are allocated from */
 } queue;
 
 /**
@@ -433,6 +777,13 @@ typedef struct {
  * @returns newly created queue
  */
 queue queue_new(size_t data_size);
+/**
+ * @brief create a new queue that allocates its nodes from an arena
+ * @param data_size the size of the data stored in the queue
+ * @param arena the arena to allocate nodes from. It must outlive the queue
+ * @returns newly created queue
+ */
+queue queue_new_with_arena(size_t data_size, varena* arena);
 /**
  * @brief get the number of nodes in the queue
  * @param q the q to get the length of
@@ -510,6 +861,7 @@ typedef struct {
     struct node* tail; /* the end of the list */
     size_t data_size;  /* the size of the data stored in the nodes */
     size_t len;        /* the number of nodes in the list */
+    varena* arena;     /* optional arena the nodes are allocated from */
 } list;
 
 /**
@@ -518,6 +870,13 @@ typedef struct {
  * @returns the newly created list
  */
 list list_new(size_t data_size);
+/**
+ * @brief create a new list that allocates its nodes from an arena
+ * @param data_size the size of the data to store in the nodes
+ * @param arena the arena to allocate nodes from. It must outlive the list
+ * @returns the newly created list
+ */
+list list_new_with_arena(size_t data_size, varena* arena);
 /**
  * @brief get the number of items in the list
  * @param list the list to get the length of
@@ -595,6 +954,16 @@ typedef struct binary_node {
  * @returns newly create node on success, NULL on failure
  */
 binary_node* binary_node_new(void* data, size_t data_size);
+/**
+ * @brief allocate a new node from an arena. Trees built from such nodes must
+ * set the arena of the binary_tree to the same arena
+ * @param data the data to store in the node
+ * @param data_size the size of the data to store
+ * @param arena the arena to allocate the node from
+ * @returns newly create node on success, NULL on failure
+ */
+binary_node* binary_node_new_with_arena(void* data, size_t data_size,
+                                        varena* arena);
 
 /**
  * @brief binary tree structure
@@ -606,6 +975,8 @@ typedef struct {
     size_t num_el;     /* the number of nodes in the tree */
     size_t data_size;  /* size of the data in the nodes */
     binary_node* root; /* root of the tree */
+    varena* arena;     /* the arena the nodes were allocated from, or null
+                          if they were allocated with binary_node_new */
 } binary_tree;
 
 /**
@@ -669,6 +1040,7 @@ typedef struct {
     size_t num_el;
     size_t key_size;
     struct avl_node* root;
+    varena* arena; /* optional arena the nodes are allocated from */
 } avl_tree;
 
 /**
@@ -677,6 +1049,13 @@ typedef struct {
  * @returns avl_tree
  */
 avl_tree avl_tree_new(size_t key_size);
+/**
+ * @brief create a new avl tree that allocates its nodes from an arena
+ * @param key_size the size of the key stored in the tree's nodes
+ * @param arena the arena to allocate nodes from. It must outlive the tree
+ * @returns avl_tree
+ */
+avl_tree avl_tree_new_with_arena(size_t key_size, varena* arena);
 /**
  * @brief insert a key into the tree
  * @param tree the tree to insert into
@@ -864,51 +1243,149 @@ void pq_free(pq* pq, FreeFn* fn);
 /**
  * @brief an entry in the hashtable
  *
- * the key is padded to ensure that data is on an 8 byte aligned address
+ * the key is padded to ensure that data is on an 8 byte aligned address. The
+ * full hash of the key is kept so that entries with a different hash are
+ * rejected without comparing keys, and so that resizing never rehashes a key
  *
  * Memory layout:
- *  --------------------------------
- * | key_len | key + padding | data |
- *  --------------------------------
+ *  ---------------------------------------
+ * | hash | key_len | key + padding | data |
+ *  ---------------------------------------
  */
 typedef struct ht_entry {
+    uint64_t hash;
     size_t key_len;
     unsigned char data[];
 } ht_entry;
-ht_entry* ht_entry_new(void* key, size_t key_len, void* data, size_t data_size);
-void ht_entry_free(ht_entry* entry, FreeFn* free_key, FreeFn* free_val);
-
-typedef struct {
-    size_t len;
-    size_t cap;
-    struct ht_entry** entries;
-} ht_bucket;
+ht_entry* ht_entry_new(void* key, size_t key_len, uint64_t hash, void* data,
+                       size_t data_size, varena* arena);
+void ht_entry_free(ht_entry* entry, FreeFn* free_key, FreeFn* free_val,
+                   varena* arena);
+/**
+ * @brief get the value stored in an entry of a hashtable
+ * @param entry the entry
+ * @returns pointer to the value of the entry
+ */
+void* ht_entry_value(ht_entry* entry);
 
 #define HT_SEED_SIZE 16
 #define HT_INITIAL_CAP 32
-#define HT_BUCKET_INITIAL_CAP 2
+#define HT_GROUP_WIDTH 16
+
+/**
+ * hash function type used by ht and set. seed points to HT_SEED_SIZE random
+ * bytes that are generated when the table is created
+ */
+typedef uint64_t HashFn(const void* key, size_t key_len, const uint8_t* seed);
+
+/**
+ * callback function type used by ht_update. value is uninitialized when
+ * inserted is true
+ */
+typedef void UpdateFn(void* value, bool inserted, void* ctx);
+
+/**
+ * callback function type used by ht_scan and set_scan. value is null for sets
+ */
+typedef void ScanFn(void* key, size_t key_len, void* value, void* ctx);
+
+/**
+ * callback function type used by ht_set_retire. It takes over memory the table
+ * no longer uses, and frees it once no reader can hold a pointer to it
+ */
+typedef void RetireFn(void* ptr, void* ctx);
+
+/**
+ * @brief siphash 1-2. The default hash function of ht and set. Resistant to
+ * hash flooding, so it is safe to use with untrusted keys
+ */
+uint64_t hash_siphash(const void* key, size_t key_len, const uint8_t* seed);
+/**
+ * @brief a fast non cryptographic hash based on wyhash. Use it for trusted
+ * keys only
+ */
+uint64_t hash_wyhash(const void* key, size_t key_len, const uint8_t* seed);
+/**
+ * @brief a mixer for 1, 2, 4 and 8 byte keys such as integers and pointers.
+ * Keys of any other size are hashed with hash_wyhash. Use it for trusted keys
+ * only
+ */
+uint64_t hash_int(const void* key, size_t key_len, const uint8_t* seed);
+
+/**
+ * @brief one table of slots in a hashtable
+ */
+typedef struct {
+    size_t len;             /* the number of entries in this table */
+    size_t cap;             /* the number of slots in this table. Always a
+                               power of two multiple of HT_GROUP_WIDTH */
+    size_t deleted;         /* the number of slots marked as deleted */
+    uint8_t* ctrl;          /* control byte for each slot */
+    ht_entry** slots;       /* pointer to the entry of each slot, NULL in
+                               fixed key tables */
+    unsigned char* entries; /* the entry of each slot in fixed key tables,
+                               NULL otherwise */
+} ht_table;
 
 /**
  * @brief hashtable implementation
  *
- * siphash 1-2 is used to hash the keys
+ * siphash 1-2 is used to hash the keys by default. Tables with trusted keys
+ * can use a faster hash function through ht_new_with_hash
+ *
+ * The table uses open addressing. Each slot has a control byte that holds 7
+ * bits of the key's hash, or marks the slot as empty or deleted. Lookups
+ * match a whole group of HT_GROUP_WIDTH control bytes at once (using SSE2 when
+ * available), and only compare keys of slots whose control byte matches.
+ * Entries are allocated separately from the slots, so pointers returned by
+ * ht_get stay valid when the table grows.
+ *
+ * Tables created with ht_new_fixed store each entry, key and value, in its
+ * slot instead, so there is no allocation per entry and a lookup compares keys
+ * a word at a time without following a pointer. Their entries move when the
+ * table grows or shrinks, so pointers into a fixed key table are only valid
+ * until the next insert, reserve or shrink.
+ *
+ * Growing is incremental. When the table fills up, a second table is
+ * allocated and each following insert or delete migrates a small number of
+ * slots into it, so the cost of rehashing is spread across many operations.
+ * Lookups search both tables while this is in progress.
  *
  * Available operations:
  *      - len (ht_len)
+ *      - reserve (ht_reserve)
+ *      - shrink to fit (ht_shrink_to_fit)
  *      - has (ht_has)
  *      - insert (ht_insert)
  *      - try insert (ht_try_insert)
+ *      - emplace (ht_emplace)
+ *      - get or insert slot (ht_get_or_insert_slot)
+ *      - find or insert entry (ht_entry_find_or_insert)
+ *      - find or insert entry by hash (ht_entry_find_or_insert_hashed)
+ *      - update (ht_update)
  *      - get (ht_get)
+ *      - get by hash (ht_get_hashed)
+ *      - read by hash without the writer's lock (ht_read_hashed)
+ *      - get many (ht_get_many)
  *      - delete (ht_delete)
+ *      - delete by hash (ht_delete_hashed)
+ *      - scan (ht_scan)
  */
 typedef struct {
-    size_t len;       /* the number of entries in the table */
-    size_t cap;       /* the number of slots available in the table */
-    size_t data_size; /* the size of the data in the table */
-    CmpFn* cmp_key;   /* optional function to compare keys. If null, memcmp is
-                         used */
+    size_t len;         /* the number of entries in the table */
+    size_t data_size;   /* the size of the data in the table */
+    size_t key_size;    /* the size of every key, 0 if keys are of any size */
+    ssize_t rehash_idx; /* the next slot of tables[0] to migrate to tables[1],
+                           -1 when not rehashing */
+    CmpFn* cmp_key;     /* optional function to compare keys. If null, memcmp
+                           is used */
+    HashFn* hash_fn;    /* function used to hash the keys */
     unsigned char seed[HT_SEED_SIZE]; /* seed used to hash the keys*/
-    ht_bucket* buckets;               /* slots of the table */
+    varena* arena;      /* optional arena the entries are allocated from */
+    RetireFn* retire;   /* optional function that takes over removed entries
+                           and tables instead of freeing them */
+    void* retire_ctx;   /* passed to retire */
+    ht_table tables[2]; /* tables[1] is only used while rehashing */
 } ht;
 
 /**
@@ -918,12 +1395,64 @@ typedef struct {
  * @return hashtable
  */
 ht ht_new(size_t data_size, CmpFn* cmp_key);
+/**
+ * @brief create a new hashtable that uses a specific hash function
+ * @param data_size the size of the data to store
+ * @param cmp_key optional function to compare keys
+ * @param hash_fn the function used to hash keys. If null, hash_siphash is used
+ * @return hashtable
+ */
+ht ht_new_with_hash(size_t data_size, CmpFn* cmp_key, HashFn* hash_fn);
+/**
+ * @brief create a new hashtable large enough to hold cap entries without
+ * growing
+ * @param data_size the size of the data to store
+ * @param cmp_key optional function to compare keys
+ * @param cap the number of entries to make room for
+ * @return hashtable
+ */
+ht ht_new_with_capacity(size_t data_size, CmpFn* cmp_key, size_t cap);
+/**
+ * @brief create a new hashtable that allocates its entries from an arena
+ * @param data_size the size of the data to store
+ * @param cmp_key optional function to compare keys
+ * @param arena the arena to allocate entries from. It must outlive the table
+ * @return hashtable
+ */
+ht ht_new_with_arena(size_t data_size, CmpFn* cmp_key, varena* arena);
+/**
+ * @brief create a new hashtable whose keys all have the same size, such as
+ * integers or uuids. Keys and values are stored in the slots, keys are
+ * compared bytewise, a word at a time, and lookups and inserts with a key of
+ * any other size fail. Pointers to values are invalidated by inserts
+ * @param key_size the size of every key
+ * @param data_size the size of the data to store
+ * @return hashtable
+ */
+ht ht_new_fixed(size_t key_size, size_t data_size);
 /**
  * @brief get the number of entries in a table
  * @param ht the table to get the number of entries in
  * @returns number of entries in the table
  */
 size_t ht_len(ht* ht);
+/**
+ * @brief make room for n entries in total, so that inserting up to n entries
+ * does not grow the table again. The entries are migrated to the larger
+ * table incrementally, like when the table grows
+ * @param ht the table to make room in
+ * @param n the number of entries to make room for
+ * @returns 0 on success, -1 on failure
+ */
+int ht_reserve(ht* ht, size_t n);
+/**
+ * @brief shrink the table to the smallest capacity that holds its entries,
+ * and drop the tombstones left by deletes. Unlike growing, the entries are
+ * all migrated before this returns
+ * @param ht the table to shrink
+ * @returns 0 on success, -1 on failure
+ */
+int ht_shrink_to_fit(ht* ht);
 /**
  * @brief check if key is in the table
  * @param ht the ht to search in
@@ -953,6 +1482,69 @@ int ht_insert(ht* ht, void* key, size_t key_len, void* value, FreeFn* fn);
  * @returns 0 on success, -1 on failure
  */
 int ht_try_insert(ht* ht, void* key, size_t key_len, void* value);
+/**
+ * @brief insert a key and return the storage of its value, so the value can
+ * be built in place instead of being copied in. If key is already in the
+ * table, don't insert
+ * @param ht the table to insert into
+ * @param key the key to insert
+ * @param key_len the size of the key
+ * @returns pointer to the uninitialized value of the new entry, NULL if key
+ * is already in the table or on failure
+ */
+void* ht_emplace(ht* ht, void* key, size_t key_len);
+/**
+ * @brief get the value of a key, inserting the key if it is not in the table.
+ * The key is hashed and looked up once, so upserts don't need a ht_get
+ * followed by a ht_insert
+ * @param ht the table to search and insert into
+ * @param key the key to get or insert
+ * @param key_len the size of the key
+ * @param inserted set to true if the key was inserted. The value of an
+ * inserted key is uninitialized and must be set by the caller
+ * @returns pointer to the value, NULL on failure
+ */
+void* ht_get_or_insert_slot(ht* ht, void* key, size_t key_len,
+                            bool* inserted);
+/**
+ * @brief find the entry of a key, inserting the key if it is not in the
+ * table. The key is hashed once and the table is probed once: the lookup
+ * remembers where the key would go, so a miss is inserted without probing
+ * again
+ * @param ht the table to search and insert into
+ * @param key the key to find or insert
+ * @param key_len the size of the key
+ * @param inserted set to true if the key was inserted. The value of an
+ * inserted entry is uninitialized and must be set by the caller
+ * @returns the entry of the key, NULL on failure
+ */
+ht_entry* ht_entry_find_or_insert(ht* ht, void* key, size_t key_len,
+                                  bool* inserted);
+/**
+ * @brief ht_entry_find_or_insert with a hash the caller already computed, so
+ * a structure built on several tables hashes each key once. The hash must be
+ * ht->hash_fn of the key with ht->seed
+ * @param ht the table to search and insert into
+ * @param key the key to find or insert
+ * @param key_len the size of the key
+ * @param hash the hash of the key
+ * @param inserted set to true if the key was inserted
+ * @returns the entry of the key, NULL on failure
+ */
+ht_entry* ht_entry_find_or_insert_hashed(ht* ht, void* key, size_t key_len,
+                                         uint64_t hash, bool* inserted);
+/**
+ * @brief update the value of a key in place, inserting the key if it is not
+ * in the table
+ * @param ht the table to update in
+ * @param key the key to update
+ * @param key_len the size of the key
+ * @param fn called with the value of the key, whether the key was just
+ * inserted, and ctx
+ * @param ctx passed to fn
+ * @returns 0 on success, -1 on failure
+ */
+int ht_update(ht* ht, void* key, size_t key_len, UpdateFn* fn, void* ctx);
 /**
  * @brief retrieve an entry from the table
  * @param ht the table to retrieve from
@@ -961,6 +1553,46 @@ int ht_try_insert(ht* ht, void* key, size_t key_len, void* value);
  * @returns pointer to value on success, NULL on failure
  */
 void* ht_get(ht* ht, void* key, size_t key_len);
+/**
+ * @brief ht_get with a hash the caller already computed. The hash must be
+ * ht->hash_fn of the key with ht->seed
+ * @param ht the table to retrieve from
+ * @param key the key of the value to get
+ * @param key_len the size of the key
+ * @param hash the hash of the key
+ * @returns pointer to value on success, NULL on failure
+ */
+void* ht_get_hashed(ht* ht, void* key, size_t key_len, uint64_t hash);
+/**
+ * @brief retrieve the values of many keys at once. All keys of a batch are
+ * hashed and their slots and entries are prefetched before any of them is
+ * resolved, which hides most of the cache misses of tables that don't fit in
+ * cache
+ * @param ht the table to retrieve from
+ * @param keys the keys of the values to get
+ * @param key_lens the size of each key
+ * @param n the number of keys
+ * @param out where the pointer to each key's value is stored, NULL for keys
+ * that are not in the table
+ * @returns the number of keys found
+ */
+size_t ht_get_many(ht* ht, void** keys, size_t* key_lens, size_t n,
+                   void** out);
+/**
+ * @brief look a key up while another thread may be writing to the table.
+ * Every entry and table the writer removes must be handed to a RetireFn (see
+ * ht_set_retire) that keeps it alive until the read is over, and the caller
+ * must check the read wasn't torn by a concurrent write, e.g. with a seqlock.
+ * Only for tables whose keys are of any size
+ * @param ht the table to read from
+ * @param key the key of the value to get
+ * @param key_len the size of the key
+ * @param hash the hash of the key
+ * @param out where the value is copied to. May be NULL
+ * @returns true if the key was found
+ */
+bool ht_read_hashed(ht* ht, void* key, size_t key_len, uint64_t hash,
+                    void* out);
 /**
  * @brief remove an entry from the table
  * @param ht the table to remove from
@@ -974,6 +1606,35 @@ void* ht_get(ht* ht, void* key, size_t key_len);
  */
 int ht_delete(ht* ht, void* key, size_t key_len, FreeFn* free_key,
               FreeFn* free_val);
+/**
+ * @brief ht_delete with a hash the caller already computed. The hash must be
+ * ht->hash_fn of the key with ht->seed
+ * @param ht the table to remove from
+ * @param key the key to remove
+ * @param key_len the size of the key
+ * @param hash the hash of the key
+ * @param free_key optional callback function to free the key
+ * @param free_val optional callback function to free the value
+ * @returns 0 on success, -1 on failure
+ */
+int ht_delete_hashed(ht* ht, void* key, size_t key_len, uint64_t hash,
+                     FreeFn* free_key, FreeFn* free_val);
+/**
+ * @brief iterate over the table a few entries at a time. Start with a cursor
+ * of 0 and pass the returned cursor to the next call, until it returns 0.
+ * Every entry that is in the table for the whole scan is visited at least
+ * once, even if the table is modified or resized between calls. An entry may
+ * be visited more than once if the table grows during the scan
+ * @param ht the table to scan
+ * @param cursor 0 to start a scan, or the cursor returned by the last call
+ * @param count the number of entries to visit before returning, if the scan
+ * does not end first. More may be visited
+ * @param fn called with the key and value of each entry, and ctx. It must not
+ * modify the table
+ * @param ctx passed to fn
+ * @returns the cursor to continue the scan with, 0 when the scan is done
+ */
+size_t ht_scan(ht* ht, size_t cursor, size_t count, ScanFn* fn, void* ctx);
 /**
  * @brief free the whole table
  * @param ht the table to free
@@ -983,23 +1644,274 @@ int ht_delete(ht* ht, void* key, size_t key_len, FreeFn* free_key,
  * ignored
  */
 void ht_free(ht* ht, FreeFn* free_key, FreeFn* free_val);
+/**
+ * @brief free the slots of the table without visiting the entries. For
+ * tables whose entries come from an arena, which is freed right after, so
+ * the entries are released with the arena at once
+ * @param ht the table to free
+ */
+void ht_free_tables(ht* ht);
+/**
+ * @brief hand the entries and tables the table removes to fn instead of
+ * freeing them, so ht_read_hashed can run alongside a writer. Not for tables
+ * that allocate from an arena
+ * @param ht the table
+ * @param fn the function that takes over the memory
+ * @param ctx passed to fn
+ */
+void ht_set_retire(ht* ht, RetireFn* fn, void* ctx);
+
+/**
+ * @brief an interned string. Every atom of a pool has a different string, so
+ * two atoms of the same pool are equal if and only if their pointers, or
+ * their ids, are equal
+ */
+typedef struct {
+    const char* data; /* the string, not null terminated. May contain nulls */
+    size_t len;       /* the length of the string */
+    size_t id;        /* the order the atom was created in, starting at 0 */
+} vstr_atom;
+
+/**
+ * @brief a pool of interned strings
+ *
+ * Interning a string returns the pool's atom for it, creating the atom the
+ * first time the string is seen. Equal strings share a single copy, and
+ * atoms can be compared, or used as fixed size hashtable keys, by pointer or
+ * by id. Atoms stay valid until the pool is freed, and are never removed.
+ *
+ * Available operations:
+ *      - len (vstr_pool_len)
+ *      - intern (vstr_intern)
+ *      - intern vstr (vstr_intern_vstr)
+ *      - find (vstr_pool_find)
+ */
+typedef struct {
+    ht atoms;      /* string -> vstr_atom */
+    varena* arena; /* the entries of atoms are allocated from it */
+} vstr_pool;
+
+/**
+ * @brief create a new string pool
+ * @returns the newly created pool
+ */
+vstr_pool vstr_pool_new(void);
+/**
+ * @brief get the number of atoms in a pool
+ * @param pool the pool
+ * @returns the number of distinct strings interned
+ */
+size_t vstr_pool_len(vstr_pool* pool);
+/**
+ * @brief intern a string, creating its atom if it is not in the pool yet
+ * @param pool the pool to intern in
+ * @param str the string. It is copied the first time it is interned
+ * @param len the length of the string
+ * @returns the atom of the string, NULL on failure
+ */
+const vstr_atom* vstr_intern(vstr_pool* pool, const char* str, size_t len);
+/**
+ * @brief intern the string of a vstr
+ * @param pool the pool to intern in
+ * @param s the vstr to intern
+ * @returns the atom of the string, NULL on failure
+ */
+const vstr_atom* vstr_intern_vstr(vstr_pool* pool, vstr* s);
+/**
+ * @brief get the atom of a string without interning it
+ * @param pool the pool to look in
+ * @param str the string
+ * @param len the length of the string
+ * @returns the atom of the string, NULL if it was never interned
+ */
+const vstr_atom* vstr_pool_find(vstr_pool* pool, const char* str,
+                                size_t len);
+/**
+ * @brief free the pool and every atom in it
+ * @param pool the pool to free
+ */
+void vstr_pool_free(vstr_pool* pool);
+
+#define CHT_DEFAULT_SHARDS 64
+
+/**
+ * shard of a concurrent hashtable
+ */
+struct cht_shard;
+
+/**
+ * @brief concurrent hashtable
+ *
+ * The keyspace is split across a power of two number of shards, picked by the
+ * high bits of the key's hash. Each shard is an ht with its own writer lock,
+ * so writes to different shards never contend. Reads take no lock: a shard
+ * counts its writes with a sequence number and a read that overlapped a write
+ * is retried, and the entries and tables a write removes are freed through an
+ * epoch domain (see vepoch) once no read can still see them. Reads never write
+ * to shared memory, so they scale with the number of threads. The shards share
+ * the hash function and seed of the table, so the hash that picked the shard
+ * is passed on to it and every key is hashed once. Values are copied out by
+ * cht_get, since a pointer into a shard could be freed by another thread as
+ * soon as the read is over.
+ *
+ * Available operations:
+ *      - len (cht_len)
+ *      - has (cht_has)
+ *      - get (cht_get)
+ *      - insert (cht_insert)
+ *      - try insert (cht_try_insert)
+ *      - delete (cht_delete)
+ */
+typedef struct {
+    size_t num_shards; /* the number of shards. Always a power of two */
+    size_t data_size;  /* the size of the data in the table */
+    HashFn* hash_fn;   /* function used to hash the keys of every shard */
+    unsigned char seed[HT_SEED_SIZE]; /* seed shared by every shard */
+    vepoch* epoch;            /* frees what the shards remove after the reads
+                                 that could see it */
+    struct cht_shard* shards; /* the shards of the table */
+} cht;
+
+/**
+ * @brief create a new concurrent hashtable
+ * @param num_shards the number of shards, rounded up to a power of two. If 0,
+ * CHT_DEFAULT_SHARDS is used
+ * @param data_size the size of the data to store
+ * @param cmp_key optional function to compare keys
+ * @returns concurrent hashtable
+ */
+cht cht_new(size_t num_shards, size_t data_size, CmpFn* cmp_key);
+/**
+ * @brief create a new concurrent hashtable that uses a specific hash function
+ * @param num_shards the number of shards, rounded up to a power of two. If 0,
+ * CHT_DEFAULT_SHARDS is used
+ * @param data_size the size of the data to store
+ * @param cmp_key optional function to compare keys
+ * @param hash_fn the function used to hash keys. If null, hash_siphash is used
+ * @returns concurrent hashtable
+ */
+cht cht_new_with_hash(size_t num_shards, size_t data_size, CmpFn* cmp_key,
+                      HashFn* hash_fn);
+/**
+ * @brief get the number of entries in the table. Shards are counted one at a
+ * time, so the result is only exact when no other thread is writing
+ * @param cht the table to get the number of entries in
+ * @returns number of entries in the table
+ */
+size_t cht_len(cht* cht);
+/**
+ * @brief check if key is in the table
+ * @param cht the table to search in
+ * @param key the key to search for
+ * @param key_len the size of the key
+ * @returns true on found, false on not found
+ */
+bool cht_has(cht* cht, void* key, size_t key_len);
+/**
+ * @brief copy the value of key out of the table
+ * @param cht the table to retrieve from
+ * @param key the key of the value to get
+ * @param key_len the size of the key
+ * @param out where the value is copied to
+ * @returns 0 on success, -1 when key is not in the table
+ */
+int cht_get(cht* cht, void* key, size_t key_len, void* out);
+/**
+ * @brief insert a value into the table
+ * @param cht the table to insert into
+ * @param key the key associated with the value
+ * @param key_len the size of the key
+ * @param value the value to insert
+ * @param fn optional callback function to free the old value if one is
+ * overwritten. If null, it is ignored
+ * @returns 0 on success, -1 on failure
+ */
+int cht_insert(cht* cht, void* key, size_t key_len, void* value, FreeFn* fn);
+/**
+ * @brief try to insert a value into the table. If key is already in table,
+ * don't insert
+ * @param cht the table to insert into
+ * @param key the key to insert
+ * @param key_len the size of the key
+ * @param value the value to insert
+ * @returns 0 on success, -1 on failure
+ */
+int cht_try_insert(cht* cht, void* key, size_t key_len, void* value);
+/**
+ * @brief remove an entry from the table
+ * @param cht the table to remove from
+ * @param key the key to remove
+ * @param key_len the size of the key
+ * @param free_key optional callback function to free the key. If null, it is
+ * ignored
+ * @param free_val optional callback function to free the value. If null, it is
+ * ignored
+ * @returns 0 on success, -1 on failure
+ */
+int cht_delete(cht* cht, void* key, size_t key_len, FreeFn* free_key,
+               FreeFn* free_val);
+/**
+ * @brief free the whole table. No other thread may be using it
+ * @param cht the table to free
+ * @param free_key optional callback function to free the keys. If null, it is
+ * ignored
+ * @param free_val optional callback function to free the values. If null, it is
+ * ignored
+ */
+void cht_free(cht* cht, FreeFn* free_key, FreeFn* free_val);
+
+/**
+ * @brief one table of slots in a set
+ */
+typedef struct {
+    size_t len;           /* the number of elements in this table */
+    size_t cap;           /* the number of slots in this table. Always a power
+                             of two */
+    unsigned char* slots; /* the slots of the table, slot_size bytes each */
+} set_table;
 
 /**
  * @brief set data structure
  *
+ * The set uses robin hood open addressing: each slot holds the hash of its
+ * key and a pointer to the key, and keys that are far from their home slot
+ * take slots from keys that are close to theirs, which keeps probes short and
+ * lets a lookup for a missing key stop early. Deleting shifts the following
+ * keys back instead of leaving tombstones.
+ *
+ * Sets created with set_new_fixed store their keys in the slots themselves,
+ * so a lookup touches no memory other than the slots.
+ *
+ * Like ht, growing is incremental. Slots are migrated to the larger table
+ * a few at a time by the inserts and deletes that follow a resize.
+ *
  * Available operations:
  *      - len (set_len)
+ *      - reserve (set_reserve)
+ *      - shrink to fit (set_shrink_to_fit)
  *      - has (set_has)
+ *      - has many (set_has_many)
  *      - insert (set_insert)
  *      - delete (set_delete)
+ *      - union (set_union)
+ *      - intersect (set_intersect)
+ *      - difference (set_difference)
+ *      - is subset (set_is_subset)
+ *      - scan (set_scan)
  */
 typedef struct {
-    size_t len;     /* the number of elements in the set */
-    size_t cap;     /* the number of buckets in the set */
-    CmpFn* cmp_key; /* optional function to compare keys. If null, memcmp is
-                       used */
+    size_t len;         /* the number of elements in the set */
+    size_t key_size;    /* the size of every key, 0 if keys are of any size
+                           and copied into allocations of their own */
+    size_t slot_size;   /* the size of a slot */
+    ssize_t rehash_idx; /* the next slot of tables[0] to migrate to
+                           tables[1], -1 when not rehashing */
+    CmpFn* cmp_key;     /* optional function to compare keys. If null, memcmp
+                           is used */
+    HashFn* hash_fn;    /* function used to hash the keys */
     unsigned char seed[HT_SEED_SIZE]; /* seed used to hash the keys */
-    ht_bucket* buckets;               /* slots of the table */
+    varena* arena;       /* optional arena the entries are allocated from */
+    set_table tables[2]; /* tables[1] is only used while rehashing */
 } set;
 
 /**
@@ -1008,12 +1920,57 @@ typedef struct {
  * @returns newly created set
  */
 set set_new(CmpFn* cmp_key);
+/**
+ * @brief create a new set that uses a specific hash function
+ * @param cmp_key optional key comparison function
+ * @param hash_fn the function used to hash keys. If null, hash_siphash is used
+ * @returns newly created set
+ */
+set set_new_with_hash(CmpFn* cmp_key, HashFn* hash_fn);
+/**
+ * @brief create a new set large enough to hold cap keys without growing
+ * @param cmp_key optional key comparison function
+ * @param cap the number of keys to make room for
+ * @returns newly created set
+ */
+set set_new_with_capacity(CmpFn* cmp_key, size_t cap);
+/**
+ * @brief create a new set that allocates its entries from an arena
+ * @param cmp_key optional key comparison function
+ * @param arena the arena to allocate entries from. It must outlive the set
+ * @returns newly created set
+ */
+set set_new_with_arena(CmpFn* cmp_key, varena* arena);
+/**
+ * @brief create a new set of keys that all have the same size. The keys are
+ * copied into the slots of the set rather than into separately allocated
+ * entries
+ * @param key_size the size of every key
+ * @param cmp_key optional key comparison function
+ * @returns newly created set
+ */
+set set_new_fixed(size_t key_size, CmpFn* cmp_key);
 /**
  * @brief get the number of elements in the set
  * @param set the set to get the number of elements in
  * @returns number of elements in the set
  */
 size_t set_len(set* set);
+/**
+ * @brief make room for n keys in total, so that inserting up to n keys does
+ * not grow the set again
+ * @param set the set to make room in
+ * @param n the number of keys to make room for
+ * @returns 0 on success, -1 on failure
+ */
+int set_reserve(set* set, size_t n);
+/**
+ * @brief shrink the set to the smallest capacity that holds its keys. The
+ * keys are all migrated before this returns
+ * @param set the set to shrink
+ * @returns 0 on success, -1 on failure
+ */
+int set_shrink_to_fit(set* set);
 /**
  * @brief check if a key is in the set
  * @param set the set to search in
@@ -1022,12 +1979,26 @@ size_t set_len(set* set);
  * @returns true on found, false on not found
  */
 bool set_has(set* set, void* key, size_t key_len);
+/**
+ * @brief check if many keys are in the set at once. Like ht_get_many, all
+ * keys of a batch are hashed and prefetched before any of them is resolved
+ * @param set the set to search in
+ * @param keys the keys to search for
+ * @param key_lens the size of each key
+ * @param n the number of keys
+ * @param out optional array where whether each key is in the set is stored.
+ * If null, it is ignored
+ * @returns the number of keys found
+ */
+size_t set_has_many(set* set, void** keys, size_t* key_lens, size_t n,
+                    bool* out);
 /**
  * @brief insert a key in the set
  * @param set the set to insert into
  * @param key the key to insert
- * @param key_len the size of the key
- * @returns 0 on success, -1 on failure
+ * @param key_len the size of the key. Must be the key size of sets created
+ * with set_new_fixed
+ * @returns 0 on success, -1 on failure or if the key is already in the set
  */
 int set_insert(set* set, void* key, size_t key_len);
 /**
@@ -1040,6 +2011,59 @@ int set_insert(set* set, void* key, size_t key_len);
  * @returns 0 on success, -1 on failure
  */
 int set_delete(set* set, void* key, size_t key_len, FreeFn* free_fn);
+/**
+ * @brief create the union of two sets. The sets must have been created the
+ * same way, with the same key size and comparison function. The result is
+ * sized for both sets up front, so building it never rehashes
+ * @param a the first set
+ * @param b the second set
+ * @param out where the new set is stored. It is created like a, and must be
+ * freed with set_free
+ * @returns 0 on success, -1 on failure
+ */
+int set_union(set* a, set* b, set* out);
+/**
+ * @brief create the intersection of two sets. The smaller set is walked and
+ * its keys are looked up in the larger one in prefetched batches
+ * @param a the first set
+ * @param b the second set
+ * @param out where the new set is stored. It is created like a, and must be
+ * freed with set_free
+ * @returns 0 on success, -1 on failure
+ */
+int set_intersect(set* a, set* b, set* out);
+/**
+ * @brief create the set of keys that are in a but not in b
+ * @param a the set to take keys from
+ * @param b the set of keys to leave out
+ * @param out where the new set is stored. It is created like a, and must be
+ * freed with set_free
+ * @returns 0 on success, -1 on failure
+ */
+int set_difference(set* a, set* b, set* out);
+/**
+ * @brief check if every key of a is in b
+ * @param a the set that may be a subset
+ * @param b the set that may contain it
+ * @returns true if a is a subset of b, false if not
+ */
+bool set_is_subset(set* a, set* b);
+/**
+ * @brief iterate over the set a few keys at a time. Start with a cursor of 0
+ * and pass the returned cursor to the next call, until it returns 0. Every
+ * key that is in the set for the whole scan is visited at least once, even if
+ * the set is modified or resized between calls. A key may be visited more
+ * than once if the set grows during the scan
+ * @param set the set to scan
+ * @param cursor 0 to start a scan, or the cursor returned by the last call
+ * @param count the number of keys to visit before returning, if the scan
+ * does not end first. More may be visited
+ * @param fn called with each key and ctx. It must not modify the set
+ * @param ctx passed to fn
+ * @returns the cursor to continue the scan with, 0 when the scan is done
+ */
+size_t set_scan(set* set, size_t cursor, size_t count, ScanFn* fn,
+                void* ctx);
 /**
  * @brief free the whole set
  * @param set the set to free
@@ -1048,22 +2072,141 @@ int set_delete(set* set, void* key, size_t key_len, FreeFn* free_fn);
  */
 void set_free(set* set, FreeFn* free_fn);
 
+#define TWHEEL_BITS 6
+#define TWHEEL_SLOTS (1 << TWHEEL_BITS)
+#define TWHEEL_LEVELS 4
+
+/**
+ * @brief a timer in a timing wheel. Embed it in the object that expires
+ */
+typedef struct twheel_timer {
+    struct twheel_timer* next;   /* next timer in the same slot */
+    struct twheel_timer** pprev; /* the pointer that points to this timer,
+                                    null when the timer is not scheduled */
+    uint64_t expires;            /* the tick the timer expires at */
+} twheel_timer;
+
+/**
+ * callback function type called for each timer that expires
+ */
+typedef void TimerFn(twheel_timer* timer, void* ctx);
+
+/**
+ * @brief hierarchical timing wheel
+ *
+ * Timers are kept in TWHEEL_LEVELS levels of TWHEEL_SLOTS slots. Level 0 has
+ * a slot per tick, and each following level has a slot per TWHEEL_SLOTS slots
+ * of the level below. As time advances, timers move down the levels until
+ * they expire in level 0, so scheduling, cancelling and expiring a timer are
+ * O(1) amortized and no timer is scanned before it is due. Timers more than
+ * TWHEEL_SLOTS^TWHEEL_LEVELS ticks away are parked in the top level until
+ * they get closer.
+ *
+ * Time is counted in ticks that the caller defines, and the wheel only moves
+ * when twheel_advance is called. Timers store the pointer to them, so the
+ * wheel must not be moved while timers are scheduled.
+ *
+ * Available operations:
+ *      - add (twheel_add)
+ *      - remove (twheel_remove)
+ *      - advance (twheel_advance)
+ */
+typedef struct {
+    uint64_t now; /* the current tick */
+    size_t len;   /* the number of scheduled timers */
+    twheel_timer* slots[TWHEEL_LEVELS][TWHEEL_SLOTS];
+} twheel;
+
+/**
+ * @brief create a new timing wheel at tick 0
+ * @returns the newly created timing wheel
+ */
+twheel twheel_new(void);
+/**
+ * @brief initialize a timer that is not scheduled
+ * @param timer the timer to initialize
+ */
+void twheel_timer_init(twheel_timer* timer);
+/**
+ * @brief check if a timer is scheduled
+ * @param timer the timer to check
+ * @returns true if the timer is scheduled, false if not
+ */
+bool twheel_timer_pending(twheel_timer* timer);
+/**
+ * @brief schedule a timer, rescheduling it if it already is
+ * @param tw the wheel to schedule on
+ * @param timer an initialized timer
+ * @param ticks the number of ticks from now the timer expires in. 0 is
+ * treated as 1
+ */
+void twheel_add(twheel* tw, twheel_timer* timer, uint64_t ticks);
+/**
+ * @brief cancel a timer. Does nothing if the timer is not scheduled
+ * @param tw the wheel the timer is scheduled on
+ * @param timer the timer to cancel
+ */
+void twheel_remove(twheel* tw, twheel_timer* timer);
+/**
+ * @brief advance the wheel, calling fn for every timer that expires. Timers
+ * are no longer scheduled when fn is called, and fn may add and remove timers
+ * @param tw the wheel to advance
+ * @param ticks the number of ticks to advance by
+ * @param fn the function called with each expired timer
+ * @param ctx passed to fn
+ */
+void twheel_advance(twheel* tw, uint64_t ticks, TimerFn* fn, void* ctx);
+
+/**
+ * node in the lists of lru and tlfu
+ */
+struct lru_node;
+
+/**
+ * @brief list of nodes ordered from most to least recently used
+ */
+typedef struct {
+    struct lru_node* head; /* the most recently used node */
+    struct lru_node* tail; /* the least recently used node */
+} lru_list;
+
 /**
  * @brief an lru data structure
  *
+ * Each node of the list stores its value and points to its entry in the
+ * lookup table, which holds the key and its hash, so keys are stored once and
+ * evicting the least recently used node deletes it without hashing its key.
+ * Updates find or insert the key with a single probe.
+ *
+ * Every entry has a cost, key_len + data_size unless it is given with
+ * lru_update_cost. A weighted lru (lru_new_weighted) is bounded by the total
+ * cost of its entries rather than by their number, so it can bound memory
+ * when the values own buffers of very different sizes.
+ *
+ * An lru created with lru_new_with_ttl also owns a timing wheel, and entries
+ * given a ttl with lru_update_ttl are removed once that many ticks have passed.
+ * The caller decides what a tick is and drives the clock with lru_tick.
+ *
  * Available operations
  *
  *      - update (lru_update)
+ *      - update with cost (lru_update_cost)
+ *      - update with ttl (lru_update_ttl)
+ *      - tick (lru_tick)
  *      - get (lru_get)
+ *      - bytes (lru_bytes)
+ *      - reserve (lru_reserve)
+ *      - shrink to fit (lru_shrink_to_fit)
  */
 typedef struct {
     size_t len;
     size_t cap;
     size_t data_size;
-    node* head;
-    node* tail;
-    ht lookup;
-    ht reverse_lookup;
+    size_t budget; /* the maximum total cost, 0 when not weighted */
+    size_t bytes;  /* the total cost of the entries */
+    lru_list list; /* the nodes, most recently used first */
+    ht lookup;     /* key -> node */
+    twheel* wheel; /* expires entries, NULL when ttl is not enabled */
 } lru;
 
 /**
@@ -1074,6 +2217,22 @@ typedef struct {
  * @returns newly created lru
  */
 lru lru_new(size_t cap, size_t data_size, CmpFn* cmp_keys);
+/**
+ * @brief create a new lru bounded by the total cost of its entries
+ * @param budget the maximum total cost of the entries, e.g. in bytes
+ * @param data_size size of data stored in lru
+ * @param cmp_keys optional key comparison function
+ * @returns newly created lru
+ */
+lru lru_new_weighted(size_t budget, size_t data_size, CmpFn* cmp_keys);
+/**
+ * @brief create a new lru whose entries can expire
+ * @param cap the capacity of the lru
+ * @param data_size size of data stored in lru
+ * @param cmp_keys optional key comparison function
+ * @returns newly created lru
+ */
+lru lru_new_with_ttl(size_t cap, size_t data_size, CmpFn* cmp_keys);
 /**
  * @brief update a key in the lru
  * @param l the lru to update in
@@ -1084,6 +2243,40 @@ lru lru_new(size_t cap, size_t data_size, CmpFn* cmp_keys);
  * @returns 0 on success, -1 on failure
  */
 int lru_update(lru* l, void* key, size_t key_len, void* value, FreeFn* fn);
+/**
+ * @brief update a key in the lru, giving the entry a specific cost. The least
+ * recently used entries are evicted until the total cost is within the
+ * budget, which evicts the entry itself if its cost is over the budget
+ * @param l the lru to update in
+ * @param key the key to update
+ * @param key_len the size of the key
+ * @param value the value to update with
+ * @param cost the cost of the entry, e.g. the number of bytes it owns
+ * @param fn optional callback function to free the old or evicted values
+ * @returns 0 on success, -1 on failure
+ */
+int lru_update_cost(lru* l, void* key, size_t key_len, void* value,
+                    size_t cost, FreeFn* fn);
+/**
+ * @brief update a key in the lru and set when it expires. lru_update and
+ * lru_update_cost keep the ttl of an existing entry
+ * @param l the lru to update in, created with lru_new_with_ttl
+ * @param key the key to update
+ * @param key_len the size of the key
+ * @param value the value to update with
+ * @param ttl the number of ticks until the entry expires, 0 to never expire
+ * @param fn optional callback function to free the old or evicted values
+ * @returns 0 on success, -1 on failure or if ttl is not enabled
+ */
+int lru_update_ttl(lru* l, void* key, size_t key_len, void* value,
+                   uint64_t ttl, FreeFn* fn);
+/**
+ * @brief advance the clock of the lru, removing the entries that expire
+ * @param l the lru to advance. Does nothing if ttl is not enabled
+ * @param ticks the number of ticks that passed
+ * @param fn optional callback function to free the expired values
+ */
+void lru_tick(lru* l, uint64_t ticks, FreeFn* fn);
 /**
  * @brief get a value from the lru
  * @param l the lru to get from
@@ -1092,6 +2285,27 @@ int lru_update(lru* l, void* key, size_t key_len, void* value, FreeFn* fn);
  * @returns value on success, NULL on failure
  */
 void* lru_get(lru* l, void* key, size_t key_len);
+/**
+ * @brief get the total cost of the entries in the lru
+ * @param l the lru
+ * @returns the total cost of the entries
+ */
+size_t lru_bytes(lru* l);
+/**
+ * @brief make room for n entries in the lookup table of the lru, up to its
+ * capacity, so that filling it does not rehash
+ * @param l the lru to make room in
+ * @param n the number of entries to make room for
+ * @returns 0 on success, -1 on failure
+ */
+int lru_reserve(lru* l, size_t n);
+/**
+ * @brief shrink the lookup table of the lru to the smallest capacity that
+ * holds its entries, e.g. after many entries expired
+ * @param l the lru to shrink
+ * @returns 0 on success, -1 on failure
+ */
+int lru_shrink_to_fit(lru* l);
 /**
  * @brief free the lru
  * @param l the lru to free
@@ -1100,4 +2314,178 @@ void* lru_get(lru* l, void* key, size_t key_len);
  */
 void lru_free(lru* l, FreeFn* free_key, FreeFn* free_val);
 
+/**
+ * @brief count-min sketch estimating how often keys were accessed
+ */
+typedef struct {
+    size_t width;       /* counters per row. Always a power of two */
+    size_t additions;   /* increments since the counters were last halved */
+    size_t sample_size; /* the number of increments between halvings */
+    uint8_t* table;     /* the 4 bit counters, one per byte, one row after
+                           another */
+    unsigned char seed[HT_SEED_SIZE]; /* seed used to hash the keys */
+} lru_sketch;
+
+/**
+ * @brief scan resistant cache using the W-TinyLFU policy
+ *
+ * New keys enter a small lru window (1% of the capacity). Keys leaving the
+ * window compete for a place in the main cache, which is a segmented lru: a
+ * probation segment, and a protected segment (80% of the main cache) for keys
+ * that were hit while in probation. A key leaving the window is only admitted
+ * when a count-min sketch of recent accesses says it is used more often than
+ * the key the main cache would evict, so a burst of keys that are only seen
+ * once, like a full table scan, cannot flush the keys that are used often.
+ *
+ * Available operations
+ *
+ *      - update (tlfu_update)
+ *      - get (tlfu_get)
+ */
+typedef struct {
+    size_t len;           /* the number of entries in the cache */
+    size_t cap;           /* the maximum number of entries */
+    size_t data_size;     /* the size of the values */
+    size_t window_cap;    /* the maximum number of entries in the window */
+    size_t protected_cap; /* the maximum number of protected entries */
+    size_t window_len;    /* the number of entries in the window */
+    size_t probation_len; /* the number of entries in probation */
+    size_t protected_len; /* the number of protected entries */
+    lru_list window;      /* entries that were added recently */
+    lru_list probation;   /* entries admitted to the main cache */
+    lru_list protected;   /* entries hit while in probation */
+    lru_sketch sketch;    /* access frequency of recently seen keys */
+    ht lookup;            /* key -> node */
+} tlfu;
+
+/**
+ * @brief create a new tlfu cache
+ * @param cap the capacity of the cache
+ * @param data_size size of data stored in the cache
+ * @param cmp_keys optional key comparison function
+ * @returns newly created cache
+ */
+tlfu tlfu_new(size_t cap, size_t data_size, CmpFn* cmp_keys);
+/**
+ * @brief update a key in the cache
+ * @param c the cache to update in
+ * @param key the key to update
+ * @param key_len the size of the key
+ * @param value the value to update with
+ * @param fn optional callback function to free the old or evicted value
+ * @returns 0 on success, -1 on failure
+ */
+int tlfu_update(tlfu* c, void* key, size_t key_len, void* value, FreeFn* fn);
+/**
+ * @brief get a value from the cache
+ * @param c the cache to get from
+ * @param key the key to get
+ * @param key_len the size of the key
+ * @returns value on success, NULL on failure
+ */
+void* tlfu_get(tlfu* c, void* key, size_t key_len);
+/**
+ * @brief free the cache
+ * @param c the cache to free
+ * @param free_key optional callback function to free the key
+ * @param free_val optional callback function to free the value
+ */
+void tlfu_free(tlfu* c, FreeFn* free_key, FreeFn* free_val);
+
+#define CLRU_DEFAULT_SHARDS 16
+
+/**
+ * shard of a concurrent lru
+ */
+struct clru_shard;
+
+/**
+ * @brief concurrent least recently used cache
+ *
+ * Keys are spread over a power of two number of shards, each holding at most
+ * cap / num_shards entries. Eviction uses the CLOCK approximation of lru: a
+ * hit only sets a reference bit on its entry rather than moving it to the
+ * front of a list. Lookups take no lock: like cht, a lookup that overlapped a
+ * write to its shard is retried, and what the shard's lookup table removes is
+ * freed through an epoch domain, so hits scale across threads. When a shard is
+ * full, the clock hand evicts the first entry that has not been hit since the
+ * hand last passed it. Values are copied out by clru_get since another thread
+ * may evict them as soon as the lookup is over.
+ *
+ * Available operations:
+ *      - len (clru_len)
+ *      - update (clru_update)
+ *      - get (clru_get)
+ */
+typedef struct {
+    size_t cap;        /* the maximum number of entries */
+    size_t num_shards; /* the number of shards. Always a power of two */
+    size_t data_size;  /* the size of the values */
+    HashFn* hash_fn;   /* function used to hash the keys */
+    unsigned char seed[HT_SEED_SIZE]; /* seed used to hash the keys */
+    vepoch* epoch;             /* frees what the shards remove after the
+                                  lookups that could see it */
+    struct clru_shard* shards; /* the shards of the cache */
+} clru;
+
+/**
+ * @brief create a new concurrent lru
+ * @param cap the maximum number of entries in the cache. It is split across
+ * the shards, so a shard may evict while others still have room
+ * @param num_shards the number of shards, rounded up to a power of two, then
+ * lowered to at most cap. If 0, CLRU_DEFAULT_SHARDS is used
+ * @param data_size the size of the values
+ * @param cmp_keys optional function to compare keys
+ * @returns concurrent lru
+ */
+clru clru_new(size_t cap, size_t num_shards, size_t data_size,
+              CmpFn* cmp_keys);
+/**
+ * @brief create a new concurrent lru that uses a specific hash function
+ * @param cap the maximum number of entries in the cache
+ * @param num_shards the number of shards, rounded up to a power of two, then
+ * lowered to at most cap. If 0, CLRU_DEFAULT_SHARDS is used
+ * @param data_size the size of the values
+ * @param cmp_keys optional function to compare keys
+ * @param hash_fn the function used to hash keys. If null, hash_siphash is used
+ * @returns concurrent lru
+ */
+clru clru_new_with_hash(size_t cap, size_t num_shards, size_t data_size,
+                        CmpFn* cmp_keys, HashFn* hash_fn);
+/**
+ * @brief get the number of entries in the cache
+ * @param l the cache to get the number of entries in
+ * @returns the number of entries in the cache
+ */
+size_t clru_len(clru* l);
+/**
+ * @brief insert or update a key in the cache
+ * @param l the cache to update
+ * @param key the key to update
+ * @param key_len the size of the key
+ * @param value the value to store
+ * @param fn optional callback function to free the value that is overwritten
+ * or evicted. If null, it is ignored
+ * @returns 0 on success, -1 on failure
+ */
+int clru_update(clru* l, void* key, size_t key_len, void* value, FreeFn* fn);
+/**
+ * @brief copy the value of key out of the cache
+ * @param l the cache to get from
+ * @param key the key to get
+ * @param key_len the size of the key
+ * @param out where the value is copied to
+ * @returns 0 on success, -1 when key is not in the cache
+ */
+int clru_get(clru* l, void* key, size_t key_len, void* out);
+/**
+ * @brief free the cache. No other thread may be using it
+ * @param l the cache to free
+ * @param free_key optional callback function to free the keys. If null, it is
+ * ignored
+ * @param free_val optional callback function to free the values. If null, it
+ * is ignored
+ */
+void clru_free(clru* l, FreeFn* free_key, FreeFn* free_val);
+
 #endif /*__VLIB_H__*/
@@ -4,18 +4,75 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+/**
+ * AVX2 kernels are compiled with a target attribute and picked at runtime, so
+ * the library itself does not require AVX2
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VSTR_AVX2
+#include <immintrin.h>
+#endif
 
-static vstr_lg vstr_make_lg(const char* data);
+/* the signatures of the search kernels */
+typedef size_t vstr_memchr_fn(const char* s, size_t len, char c);
+typedef size_t vstr_memmem_fn(const char* s, size_t len, const char* needle,
+                              size_t needle_len);
+typedef size_t vstr_casediff_fn(const char* a, const char* b, size_t len);
+
+/* ascii lower case, as an int so differences of folded bytes can be taken */
+#define vstr_lower(c)                                                          \
+    ((((unsigned char)(c)) >= 'A') && (((unsigned char)(c)) <= 'Z')            \
+         ? ((unsigned char)(c)) | 0x20                                         \
+         : ((unsigned char)(c)))
+
+static vstr_lg vstr_make_lg(const char* data, size_t len, size_t cap);
 static vstr_lg vstr_lg_new_len(size_t len);
 static vstr_lg vstr_make_lg_len(const char* data, size_t len);
+static size_t vstr_grow_cap(size_t cap, size_t len);
 static int vstr_sm_push_char(vstr_sm* sm, char c, uint8_t avail);
 static int vstr_lg_push_char(vstr_lg* lg, char c);
 static int vstr_lg_push_string(vstr_lg* lg, const char* str, size_t str_len);
 static int vstr_sm_push_string(vstr_sm* sm, const char* str, size_t str_len,
                                uint8_t avail);
-static int vstr_realloc_lg(vstr_lg* lg, size_t len, size_t cap);
-static int vstr_realloc_lg_len(vstr_lg* lg, size_t len, size_t cap,
-                               size_t new_len);
+static int vstr_realloc_lg(vstr_lg* lg, size_t cap);
+static size_t vstr_memchr(const char* s, size_t len, char c);
+static size_t vstr_memmem(const char* s, size_t len, const char* needle,
+                          size_t needle_len);
+static size_t vstr_casediff(const char* a, const char* b, size_t len);
+static void vstr_resolve_kernels(void);
+static size_t vstr_memchr_resolve(const char* s, size_t len, char c);
+static size_t vstr_memmem_resolve(const char* s, size_t len,
+                                  const char* needle, size_t needle_len);
+static size_t vstr_casediff_resolve(const char* a, const char* b, size_t len);
+static size_t vstr_memchr_scalar(const char* s, size_t len, char c);
+static size_t vstr_memmem_scalar(const char* s, size_t len,
+                                 const char* needle, size_t needle_len);
+static size_t vstr_casediff_scalar(const char* a, const char* b, size_t len);
+#if defined(__SSE2__)
+static size_t vstr_memchr_sse2(const char* s, size_t len, char c);
+static size_t vstr_memmem_sse2(const char* s, size_t len, const char* needle,
+                               size_t needle_len);
+static size_t vstr_casediff_sse2(const char* a, const char* b, size_t len);
+static __m128i vstr_lower_sse2(__m128i block);
+#endif
+#if defined(VSTR_AVX2)
+static size_t vstr_memchr_avx2(const char* s, size_t len, char c);
+static size_t vstr_memmem_avx2(const char* s, size_t len, const char* needle,
+                               size_t needle_len);
+static size_t vstr_casediff_avx2(const char* a, const char* b, size_t len);
+static __m256i vstr_lower_avx2(__m256i block);
+#endif
+
+/**
+ * the kernels used by this cpu. They start out as resolvers that pick the
+ * kernels on first use, so the cpu is only queried once
+ */
+static vstr_memchr_fn* vstr_memchr_kernel = vstr_memchr_resolve;
+static vstr_memmem_fn* vstr_memmem_kernel = vstr_memmem_resolve;
+static vstr_casediff_fn* vstr_casediff_kernel = vstr_casediff_resolve;
 
 vstr vstr_new(void) {
     vstr s = {0};
@@ -114,26 +171,120 @@ const char* vstr_data(vstr* s) {
 }
 
 int vstr_cmp(vstr* a, vstr* b) {
-    size_t alen = vstr_len(a);
-    size_t blen = vstr_len(b);
-    const char* astr = vstr_data(a);
-    const char* bstr = vstr_data(b);
-    if (alen == blen) {
-        return strncmp(astr, bstr, alen);
-    }
-    if (alen < blen) {
-        int cmp = strncmp(astr, bstr, alen);
-        if (cmp == 0) {
-            return 1;
-        }
-        return cmp;
-    } else {
-        int cmp = strncmp(astr, bstr, blen);
-        if (cmp == 0) {
-            return -1;
-        }
+    return vstr_view_cmp(vstr_view_of(a), vstr_view_of(b));
+}
+
+int vstr_casecmp(vstr* a, vstr* b) {
+    return vstr_view_casecmp(vstr_view_of(a), vstr_view_of(b));
+}
+
+ssize_t vstr_find(vstr* s, const char* needle, size_t needle_len) {
+    return vstr_view_find(vstr_view_of(s), needle, needle_len);
+}
+
+ssize_t vstr_find_char(vstr* s, char c) {
+    return vstr_view_find_char(vstr_view_of(s), c);
+}
+
+size_t vstr_split(vstr* s, char delim, vstr* out, size_t max) {
+    vstr_view rest = vstr_view_of(s), token;
+    size_t n = 0;
+    if (max == 0) {
+        return 0;
+    }
+    while ((n < (max - 1)) && vstr_view_next_token(&rest, delim, &token)) {
+        out[n++] = vstr_from_len(token.data, token.len);
+    }
+    out[n++] = vstr_from_len(rest.data, rest.len);
+    return n;
+}
+
+vstr_view vstr_view_of(vstr* s) {
+    vstr_view v;
+    v.data = vstr_data(s);
+    v.len = vstr_len(s);
+    return v;
+}
+
+vstr_view vstr_view_from(const char* data, size_t len) {
+    vstr_view v;
+    v.data = data;
+    v.len = len;
+    return v;
+}
+
+vstr_view vstr_view_slice(vstr_view v, size_t start, size_t len) {
+    if (start > v.len) {
+        start = v.len;
+    }
+    if (len > (v.len - start)) {
+        len = v.len - start;
+    }
+    return vstr_view_from(v.data + start, len);
+}
+
+vstr vstr_from_view(vstr_view v) { return vstr_from_len(v.data, v.len); }
+
+int vstr_view_cmp(vstr_view a, vstr_view b) {
+    size_t len = a.len < b.len ? a.len : b.len;
+    int cmp;
+    /* the data of an empty view may be NULL, which memcmp must not be given */
+    if (len == 0) {
+        return a.len == b.len ? 0 : (a.len < b.len ? 1 : -1);
+    }
+    cmp = memcmp(a.data, b.data, len);
+    if ((cmp != 0) || (a.len == b.len)) {
         return cmp;
     }
+    /* when one is a prefix of the other, the shorter one compares greater */
+    return a.len < b.len ? 1 : -1;
+}
+
+int vstr_view_casecmp(vstr_view a, vstr_view b) {
+    size_t len = a.len < b.len ? a.len : b.len;
+    size_t idx = vstr_casediff(a.data, b.data, len);
+    if (idx < len) {
+        return vstr_lower(a.data[idx]) - vstr_lower(b.data[idx]);
+    }
+    if (a.len == b.len) {
+        return 0;
+    }
+    /* the same prefix rule as vstr_view_cmp, so the two order alike */
+    return a.len < b.len ? 1 : -1;
+}
+
+ssize_t vstr_view_find(vstr_view v, const char* needle, size_t needle_len) {
+    size_t idx = vstr_memmem(v.data, v.len, needle, needle_len);
+    /* an empty needle is found at 0, even in an empty string */
+    return (idx + needle_len) > v.len ? -1 : (ssize_t)idx;
+}
+
+ssize_t vstr_view_find_char(vstr_view v, char c) {
+    size_t idx = vstr_memchr(v.data, v.len, c);
+    return idx == v.len ? -1 : (ssize_t)idx;
+}
+
+bool vstr_view_next_token(vstr_view* rest, char delim, vstr_view* token) {
+    size_t idx = vstr_memchr(rest->data, rest->len, delim);
+    if (idx == rest->len) {
+        return false;
+    }
+    *token = vstr_view_from(rest->data, idx);
+    rest->data += idx + 1;
+    rest->len -= idx + 1;
+    return true;
+}
+
+size_t vstr_view_split(vstr_view v, char delim, vstr_view* out, size_t max) {
+    size_t n = 0;
+    if (max == 0) {
+        return 0;
+    }
+    while ((n < (max - 1)) && vstr_view_next_token(&v, delim, &(out[n]))) {
+        n++;
+    }
+    out[n++] = v;
+    return n;
 }
 
 int vstr_push_char(vstr* s, char c) {
@@ -146,7 +297,9 @@ int vstr_push_char(vstr* s, char c) {
         s->small_avail--;
         return 0;
     }
-    s->str_data.lg = vstr_make_lg(s->str_data.sm.data);
+    s->str_data.lg = vstr_make_lg(
+        s->str_data.sm.data, VSTR_MAX_SMALL_SIZE,
+        vstr_grow_cap(VSTR_MAX_SMALL_SIZE + 1, VSTR_MAX_SMALL_SIZE + 1));
     if (s->str_data.lg.cap == 0) {
         return -1;
     }
@@ -155,8 +308,12 @@ int vstr_push_char(vstr* s, char c) {
 }
 
 int vstr_push_string(vstr* s, const char* str) {
+    return vstr_push_len(s, str, strlen(str));
+}
+
+int vstr_push_len(vstr* s, const char* str, size_t str_len) {
     int push_res;
-    size_t old_len, str_len = strlen(str);
+    size_t old_len;
     if (s->is_large) {
         return vstr_lg_push_string(&(s->str_data.lg), str, str_len);
     }
@@ -167,28 +324,108 @@ int vstr_push_string(vstr* s, const char* str) {
         return 0;
     }
     old_len = vstr_len(s);
-    s->str_data.lg = vstr_make_lg_len(s->str_data.sm.data, old_len);
+    if ((old_len + str_len) > VSTR_MAX_LARGE_SIZE) {
+        return -1;
+    }
+    s->str_data.lg = vstr_make_lg(
+        s->str_data.sm.data, old_len,
+        vstr_grow_cap(VSTR_MAX_SMALL_SIZE + 1, old_len + str_len));
+    if (s->str_data.lg.cap == 0) {
+        return -1;
+    }
     s->is_large = 1;
     return vstr_lg_push_string(&(s->str_data.lg), str, str_len);
 }
 
+int vstr_append(vstr* s, vstr* other) {
+    size_t other_len = vstr_len(other);
+    /* make room first, other may be s itself and move when s grows */
+    if (vstr_reserve(s, vstr_len(s) + other_len) == -1) {
+        return -1;
+    }
+    return vstr_push_len(s, vstr_data(other), other_len);
+}
+
+vstr vstr_concat_n(vstr* parts, size_t n) {
+    vstr s;
+    size_t i, len = 0;
+    for (i = 0; i < n; ++i) {
+        len += vstr_len(&(parts[i]));
+    }
+    s = vstr_new_len(len);
+    for (i = 0; i < n; ++i) {
+        int push_res = vstr_push_len(&s, vstr_data(&(parts[i])),
+                                     vstr_len(&(parts[i])));
+        assert(push_res == 0);
+        (void)push_res;
+    }
+    return s;
+}
+
+int vstr_reserve(vstr* s, size_t len) {
+    size_t old_len;
+    if (len > VSTR_MAX_LARGE_SIZE) {
+        return -1;
+    }
+    if (s->is_large) {
+        if (s->str_data.lg.cap > len) {
+            return 0;
+        }
+        return vstr_realloc_lg(&(s->str_data.lg), len + 1);
+    }
+    if (len <= VSTR_MAX_SMALL_SIZE) {
+        return 0;
+    }
+    old_len = vstr_len(s);
+    s->str_data.lg = vstr_make_lg(s->str_data.sm.data, old_len, len + 1);
+    if (s->str_data.lg.cap == 0) {
+        return -1;
+    }
+    s->is_large = 1;
+    return 0;
+}
+
+int vstr_shrink_to_fit(vstr* s) {
+    vstr_lg lg;
+    if (!s->is_large) {
+        return 0;
+    }
+    lg = s->str_data.lg;
+    if (lg.len > VSTR_MAX_SMALL_SIZE) {
+        if (lg.cap == (lg.len + 1)) {
+            return 0;
+        }
+        return vstr_realloc_lg(&(s->str_data.lg), lg.len + 1);
+    }
+    /* short enough to be a small string again */
+    memset(s->str_data.sm.data, 0, VSTR_MAX_SMALL_SIZE);
+    memcpy(s->str_data.sm.data, lg.data, lg.len);
+    s->is_large = 0;
+    s->small_avail = VSTR_MAX_SMALL_SIZE - lg.len;
+    free(lg.data);
+    return 0;
+}
+
 void vstr_free(vstr* s) {
     if (s->is_large) {
         free(s->str_data.lg.data);
     }
 }
 
-static vstr_lg vstr_make_lg(const char* data) {
+/**
+ * move the len bytes of a small string to the heap, in a buffer of cap bytes.
+ * Only the string and its null terminator are written
+ */
+static vstr_lg vstr_make_lg(const char* data, size_t len, size_t cap) {
     vstr_lg lg = {0};
-    lg.len = VSTR_MAX_SMALL_SIZE;
-    lg.cap = VSTR_MAX_SMALL_SIZE + 2;
-    lg.data = calloc(lg.cap, sizeof(char));
+    lg.data = malloc(cap);
     if (lg.data == NULL) {
-        lg.len = 0;
-        lg.cap = 0;
         return lg;
     }
-    memcpy(lg.data, data, VSTR_MAX_SMALL_SIZE);
+    memcpy(lg.data, data, len);
+    lg.data[len] = '\0';
+    lg.len = len;
+    lg.cap = cap;
     return lg;
 }
 
@@ -244,16 +481,17 @@ static int vstr_lg_push_char(vstr_lg* lg, char c) {
     if (cap == 0) {
         return -1;
     }
+    if ((len + 1) > VSTR_MAX_LARGE_SIZE) {
+        return -1;
+    }
     if (len == (cap - 1)) {
-        int realloc_res = vstr_realloc_lg(lg, len, cap);
+        int realloc_res = vstr_realloc_lg(lg, vstr_grow_cap(cap, len + 1));
         if (realloc_res == -1) {
             return -1;
         }
     }
-    if ((len + 1) > VSTR_MAX_LARGE_SIZE) {
-        return -1;
-    }
     lg->data[len] = c;
+    lg->data[len + 1] = '\0';
     lg->len++;
     return 0;
 }
@@ -267,39 +505,284 @@ static int vstr_lg_push_string(vstr_lg* lg, const char* str, size_t str_len) {
         return -1;
     }
     if ((len + str_len) > (cap - 1)) {
-        int realloc_res = vstr_realloc_lg_len(lg, len, cap, str_len);
+        int realloc_res =
+            vstr_realloc_lg(lg, vstr_grow_cap(cap, len + str_len));
         if (realloc_res == -1) {
             return -1;
         }
     }
     memcpy(lg->data + len, str, str_len);
+    lg->data[len + str_len] = '\0';
     lg->len += str_len;
     return 0;
 }
 
-static int vstr_realloc_lg(vstr_lg* lg, size_t len, size_t cap) {
-    void* tmp;
-    cap <<= 1;
-    tmp = realloc(lg->data, cap);
-    if (tmp == NULL) {
-        return -1;
+/**
+ * the capacity to grow a buffer of cap bytes to so that it holds len bytes
+ * and the null terminator. The capacity at least doubles, so building a
+ * string a piece at a time reallocates O(log n) times
+ */
+static size_t vstr_grow_cap(size_t cap, size_t len) {
+    while (cap < (len + 1)) {
+        cap <<= 1;
     }
-    lg->data = tmp;
-    memset(lg->data + len, 0, cap - len);
-    lg->cap = cap;
-    return 0;
+    return cap;
 }
 
-static int vstr_realloc_lg_len(vstr_lg* lg, size_t len, size_t cap,
-                               size_t new_len) {
-    void* tmp;
-    cap += new_len;
-    tmp = realloc(lg->data, cap);
+/**
+ * resize the buffer of a large string to cap bytes. The string and its null
+ * terminator are kept, and the rest of the buffer is left uninitialized
+ */
+static int vstr_realloc_lg(vstr_lg* lg, size_t cap) {
+    void* tmp = realloc(lg->data, cap);
     if (tmp == NULL) {
         return -1;
     }
     lg->data = tmp;
-    memset(lg->data + len, 0, cap - len);
     lg->cap = cap;
     return 0;
 }
+
+/**
+ * the search kernels below return the index of what they look for, or len if
+ * it is not there. The SSE2 kernels are used when the library is built for a
+ * target that has SSE2, which every x86_64 target does, and the AVX2 kernels
+ * when the cpu running it supports AVX2. The scalar kernels handle the tails
+ * that are shorter than a vector, and everything on other targets
+ */
+
+static size_t vstr_memchr(const char* s, size_t len, char c) {
+    return __atomic_load_n(&vstr_memchr_kernel, __ATOMIC_RELAXED)(s, len, c);
+}
+
+static size_t vstr_memmem(const char* s, size_t len, const char* needle,
+                          size_t needle_len) {
+    if (needle_len == 0) {
+        return 0;
+    }
+    if (needle_len > len) {
+        return len;
+    }
+    if (needle_len == 1) {
+        return vstr_memchr(s, len, needle[0]);
+    }
+    return __atomic_load_n(&vstr_memmem_kernel, __ATOMIC_RELAXED)(
+        s, len, needle, needle_len);
+}
+
+static size_t vstr_casediff(const char* a, const char* b, size_t len) {
+    return __atomic_load_n(&vstr_casediff_kernel, __ATOMIC_RELAXED)(a, b, len);
+}
+
+/**
+ * pick the kernels for the cpu running the library. Threads that race on the
+ * first call all store the same kernels, so no lock is needed
+ */
+static void vstr_resolve_kernels(void) {
+    vstr_memchr_fn* memchr_kernel = vstr_memchr_scalar;
+    vstr_memmem_fn* memmem_kernel = vstr_memmem_scalar;
+    vstr_casediff_fn* casediff_kernel = vstr_casediff_scalar;
+#if defined(__SSE2__)
+    memchr_kernel = vstr_memchr_sse2;
+    memmem_kernel = vstr_memmem_sse2;
+    casediff_kernel = vstr_casediff_sse2;
+#endif
+#if defined(VSTR_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        memchr_kernel = vstr_memchr_avx2;
+        memmem_kernel = vstr_memmem_avx2;
+        casediff_kernel = vstr_casediff_avx2;
+    }
+#endif
+    __atomic_store_n(&vstr_memchr_kernel, memchr_kernel, __ATOMIC_RELAXED);
+    __atomic_store_n(&vstr_memmem_kernel, memmem_kernel, __ATOMIC_RELAXED);
+    __atomic_store_n(&vstr_casediff_kernel, casediff_kernel, __ATOMIC_RELAXED);
+}
+
+static size_t vstr_memchr_resolve(const char* s, size_t len, char c) {
+    vstr_resolve_kernels();
+    return vstr_memchr(s, len, c);
+}
+
+static size_t vstr_memmem_resolve(const char* s, size_t len,
+                                  const char* needle, size_t needle_len) {
+    vstr_resolve_kernels();
+    return vstr_memmem(s, len, needle, needle_len);
+}
+
+static size_t vstr_casediff_resolve(const char* a, const char* b, size_t len) {
+    vstr_resolve_kernels();
+    return vstr_casediff(a, b, len);
+}
+
+static size_t vstr_memchr_scalar(const char* s, size_t len, char c) {
+    size_t i;
+    for (i = 0; i < len; ++i) {
+        if (s[i] == c) {
+            return i;
+        }
+    }
+    return len;
+}
+
+static size_t vstr_memmem_scalar(const char* s, size_t len,
+                                 const char* needle, size_t needle_len) {
+    size_t i;
+    if (needle_len > len) {
+        return len;
+    }
+    for (i = 0; i <= (len - needle_len); ++i) {
+        if ((s[i] == needle[0]) && (memcmp(s + i, needle, needle_len) == 0)) {
+            return i;
+        }
+    }
+    return len;
+}
+
+static size_t vstr_casediff_scalar(const char* a, const char* b, size_t len) {
+    size_t i;
+    for (i = 0; i < len; ++i) {
+        if (vstr_lower(a[i]) != vstr_lower(b[i])) {
+            return i;
+        }
+    }
+    return len;
+}
+
+#if defined(__SSE2__)
+
+static size_t vstr_memchr_sse2(const char* s, size_t len, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    size_t i;
+    for (i = 0; (i + 16) <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(s + i));
+        uint32_t match =
+            (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (match) {
+            return i + __builtin_ctz(match);
+        }
+    }
+    return i + vstr_memchr_scalar(s + i, len - i, c);
+}
+
+/**
+ * compare the first and the last byte of needle against 16 positions at once,
+ * and only compare the rest of needle where both match
+ */
+static size_t vstr_memmem_sse2(const char* s, size_t len, const char* needle,
+                               size_t needle_len) {
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+    size_t i;
+    for (i = 0; (i + needle_len - 1 + 16) <= len; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i block_last =
+            _mm_loadu_si128((const __m128i*)(s + i + needle_len - 1));
+        uint32_t match = (uint32_t)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                          _mm_cmpeq_epi8(block_last, last)));
+        while (match) {
+            size_t idx = i + __builtin_ctz(match);
+            if (memcmp(s + idx + 1, needle + 1, needle_len - 2) == 0) {
+                return idx;
+            }
+            match &= match - 1;
+        }
+    }
+    return i + vstr_memmem_scalar(s + i, len - i, needle, needle_len);
+}
+
+/* set bit 0x20 of the bytes between 'A' and 'Z', and of no others */
+static __m128i vstr_lower_sse2(__m128i block) {
+    __m128i upper =
+        _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('A' - 1)),
+                      _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), block));
+    return _mm_or_si128(block, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static size_t vstr_casediff_sse2(const char* a, const char* b, size_t len) {
+    size_t i;
+    for (i = 0; (i + 16) <= len; i += 16) {
+        __m128i block_a =
+            vstr_lower_sse2(_mm_loadu_si128((const __m128i*)(a + i)));
+        __m128i block_b =
+            vstr_lower_sse2(_mm_loadu_si128((const __m128i*)(b + i)));
+        uint32_t diff =
+            (~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block_a, block_b))) &
+            0xFFFF;
+        if (diff) {
+            return i + __builtin_ctz(diff);
+        }
+    }
+    return i + vstr_casediff_scalar(a + i, b + i, len - i);
+}
+
+#endif
+
+#if defined(VSTR_AVX2)
+
+__attribute__((target("avx2"))) static size_t
+vstr_memchr_avx2(const char* s, size_t len, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t i;
+    for (i = 0; (i + 32) <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(s + i));
+        uint32_t match =
+            (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+        if (match) {
+            return i + __builtin_ctz(match);
+        }
+    }
+    return i + vstr_memchr_scalar(s + i, len - i, c);
+}
+
+__attribute__((target("avx2"))) static size_t
+vstr_memmem_avx2(const char* s, size_t len, const char* needle,
+                 size_t needle_len) {
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+    size_t i;
+    for (i = 0; (i + needle_len - 1 + 32) <= len; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i block_last =
+            _mm256_loadu_si256((const __m256i*)(s + i + needle_len - 1));
+        uint32_t match = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first),
+                             _mm256_cmpeq_epi8(block_last, last)));
+        while (match) {
+            size_t idx = i + __builtin_ctz(match);
+            if (memcmp(s + idx + 1, needle + 1, needle_len - 2) == 0) {
+                return idx;
+            }
+            match &= match - 1;
+        }
+    }
+    return i + vstr_memmem_scalar(s + i, len - i, needle, needle_len);
+}
+
+__attribute__((target("avx2"))) static __m256i vstr_lower_avx2(__m256i block) {
+    __m256i upper =
+        _mm256_and_si256(_mm256_cmpgt_epi8(block, _mm256_set1_epi8('A' - 1)),
+                         _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), block));
+    return _mm256_or_si256(block,
+                           _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2"))) static size_t
+vstr_casediff_avx2(const char* a, const char* b, size_t len) {
+    size_t i;
+    for (i = 0; (i + 32) <= len; i += 32) {
+        __m256i block_a =
+            vstr_lower_avx2(_mm256_loadu_si256((const __m256i*)(a + i)));
+        __m256i block_b =
+            vstr_lower_avx2(_mm256_loadu_si256((const __m256i*)(b + i)));
+        uint32_t diff = ~(uint32_t)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(block_a, block_b));
+        if (diff) {
+            return i + __builtin_ctz(diff);
+        }
+    }
+    return i + vstr_casediff_scalar(a + i, b + i, len - i);
+}
+
+#endif
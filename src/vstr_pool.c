@@ -0,0 +1,57 @@
+#include "vlib.h"
+#include <assert.h>
+#include <stdlib.h>
+
+/**
+ * the atoms are the values of a hashtable keyed by the strings. Entries are
+ * never moved once they are allocated, so the copy of the key in the entry is
+ * the one shared copy of the string, and a pointer to the value is a stable
+ * handle. Nothing is ever removed, so the entries come from an arena owned by
+ * the pool and are all released together
+ */
+
+vstr_pool vstr_pool_new(void) {
+    vstr_pool pool = {0};
+    /* the table keeps a pointer to the arena, so it can't live in the pool */
+    pool.arena = malloc(sizeof(varena));
+    assert(pool.arena != NULL);
+    *(pool.arena) = varena_new();
+    pool.atoms = ht_new_with_arena(sizeof(vstr_atom), NULL, pool.arena);
+    return pool;
+}
+
+size_t vstr_pool_len(vstr_pool* pool) { return ht_len(&(pool->atoms)); }
+
+const vstr_atom* vstr_intern(vstr_pool* pool, const char* str, size_t len) {
+    bool inserted;
+    vstr_atom* atom;
+    ht_entry* entry =
+        ht_entry_find_or_insert(&(pool->atoms), (void*)str, len, &inserted);
+    if (entry == NULL) {
+        return NULL;
+    }
+    atom = ht_entry_value(entry);
+    if (inserted) {
+        atom->data = (const char*)entry->data;
+        atom->len = len;
+        atom->id = ht_len(&(pool->atoms)) - 1;
+    }
+    return atom;
+}
+
+const vstr_atom* vstr_intern_vstr(vstr_pool* pool, vstr* s) {
+    return vstr_intern(pool, vstr_data(s), vstr_len(s));
+}
+
+const vstr_atom* vstr_pool_find(vstr_pool* pool, const char* str,
+                                size_t len) {
+    return ht_get(&(pool->atoms), (void*)str, len);
+}
+
+void vstr_pool_free(vstr_pool* pool) {
+    /* the entries and the strings in them all go with the arena */
+    ht_free_tables(&(pool->atoms));
+    varena_free(pool->arena);
+    free(pool->arena);
+    pool->arena = NULL;
+}
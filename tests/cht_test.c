@@ -0,0 +1,178 @@
+#include "../src/vlib.h"
+#include <check.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_THREADS 4
+#define KEYS_PER_THREAD 10000
+
+typedef struct {
+    cht* cht;
+    size_t id;
+    size_t found;
+} worker;
+
+static void* writer(void* arg) {
+    worker* w = arg;
+    size_t i, start = w->id * KEYS_PER_THREAD;
+    for (i = start; i < start + KEYS_PER_THREAD; ++i) {
+        size_t value = i * 2;
+        cht_insert(w->cht, &i, sizeof(size_t), &value, NULL);
+    }
+    for (i = start; i < start + KEYS_PER_THREAD; i += 2) {
+        cht_delete(w->cht, &i, sizeof(size_t), NULL, NULL);
+    }
+    return NULL;
+}
+
+typedef struct {
+    size_t a;
+    size_t b;
+} pair;
+
+/* every write stores a pair of equal halves, so a torn read shows */
+static void* pair_writer(void* arg) {
+    worker* w = arg;
+    size_t i, round;
+    for (round = 0; round < 20; ++round) {
+        for (i = 0; i < KEYS_PER_THREAD; ++i) {
+            pair value;
+            value.a = value.b = (round * KEYS_PER_THREAD) + i;
+            if ((round % 4) == 3) {
+                cht_delete(w->cht, &i, sizeof(size_t), NULL, NULL);
+                continue;
+            }
+            cht_insert(w->cht, &i, sizeof(size_t), &value, NULL);
+        }
+    }
+    return NULL;
+}
+
+static void* pair_reader(void* arg) {
+    worker* w = arg;
+    size_t i, round;
+    for (round = 0; round < 20; ++round) {
+        for (i = 0; i < KEYS_PER_THREAD; ++i) {
+            pair out;
+            if (cht_get(w->cht, &i, sizeof(size_t), &out) == 0) {
+                ck_assert_uint_eq(out.a, out.b);
+                ck_assert_uint_eq(out.a % KEYS_PER_THREAD, i);
+                w->found++;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void* reader(void* arg) {
+    worker* w = arg;
+    size_t i, n = NUM_THREADS * KEYS_PER_THREAD;
+    for (i = 0; i < n; ++i) {
+        size_t out;
+        if (cht_get(w->cht, &i, sizeof(size_t), &out) == 0) {
+            ck_assert_uint_eq(out, i * 2);
+            w->found++;
+        }
+    }
+    return NULL;
+}
+
+START_TEST(test_cht) {
+    cht cht = cht_new(3, sizeof(int), NULL);
+    int a = 1, b = 2, out;
+    ck_assert_uint_eq(cht.num_shards, 4);
+    ck_assert_int_eq(cht_insert(&cht, "foo", 3, &a, NULL), 0);
+    ck_assert_int_eq(cht_try_insert(&cht, "foo", 3, &b), -1);
+    ck_assert_int_eq(cht_try_insert(&cht, "bar", 3, &b), 0);
+    ck_assert_uint_eq(cht_len(&cht), 2);
+    ck_assert(cht_has(&cht, "foo", 3));
+    ck_assert_int_eq(cht_get(&cht, "bar", 3, &out), 0);
+    ck_assert_int_eq(out, 2);
+    ck_assert_int_eq(cht_insert(&cht, "bar", 3, &a, NULL), 0);
+    ck_assert_int_eq(cht_get(&cht, "bar", 3, &out), 0);
+    ck_assert_int_eq(out, 1);
+    ck_assert_int_eq(cht_delete(&cht, "foo", 3, NULL, NULL), 0);
+    ck_assert_int_eq(cht_get(&cht, "foo", 3, &out), -1);
+    ck_assert(!cht_has(&cht, "foo", 3));
+    ck_assert_uint_eq(cht_len(&cht), 1);
+    cht_free(&cht, NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_cht_threads) {
+    cht cht = cht_new(0, sizeof(size_t), NULL);
+    pthread_t threads[NUM_THREADS * 2];
+    worker workers[NUM_THREADS * 2];
+    size_t i, out;
+    for (i = 0; i < NUM_THREADS * 2; ++i) {
+        workers[i].cht = &cht;
+        workers[i].id = i;
+        workers[i].found = 0;
+        ck_assert_int_eq(pthread_create(&threads[i], NULL,
+                                        i < NUM_THREADS ? writer : reader,
+                                        &workers[i]),
+                         0);
+    }
+    for (i = 0; i < NUM_THREADS * 2; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    ck_assert_uint_eq(cht_len(&cht), (NUM_THREADS * KEYS_PER_THREAD) / 2);
+    for (i = 0; i < NUM_THREADS * KEYS_PER_THREAD; ++i) {
+        if (i % 2 == 0) {
+            ck_assert_int_eq(cht_get(&cht, &i, sizeof(size_t), &out), -1);
+        } else {
+            ck_assert_int_eq(cht_get(&cht, &i, sizeof(size_t), &out), 0);
+            ck_assert_uint_eq(out, i * 2);
+        }
+    }
+    cht_free(&cht, NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_cht_torn_reads) {
+    cht cht = cht_new(2, sizeof(pair), NULL);
+    pthread_t threads[NUM_THREADS];
+    worker workers[NUM_THREADS];
+    size_t i;
+    for (i = 0; i < NUM_THREADS; ++i) {
+        workers[i].cht = &cht;
+        workers[i].id = i;
+        workers[i].found = 0;
+        ck_assert_int_eq(pthread_create(&threads[i], NULL,
+                                        i == 0 ? pair_writer : pair_reader,
+                                        &workers[i]),
+                         0);
+    }
+    for (i = 0; i < NUM_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    cht_free(&cht, NULL, NULL);
+}
+END_TEST
+
+Suite* cht_suite() {
+    Suite* s;
+    TCase* tc_core;
+    s = suite_create("cht");
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_cht);
+    tcase_add_test(tc_core, test_cht_threads);
+    tcase_add_test(tc_core, test_cht_torn_reads);
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main() {
+    int number_failed;
+    Suite* s;
+    SRunner* sr;
+    s = cht_suite();
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,138 @@
+#include "../src/vlib.h"
+#include <check.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_THREADS 4
+#define OPS_PER_THREAD 20000
+
+typedef struct {
+    clru* l;
+    size_t id;
+} worker;
+
+static void* work(void* arg) {
+    worker* w = arg;
+    size_t i;
+    for (i = 0; i < OPS_PER_THREAD; ++i) {
+        size_t key = (i * 31 + w->id) % 512, out;
+        if (clru_get(w->l, &key, sizeof(size_t), &out) == 0) {
+            ck_assert_uint_eq(out, key * 3);
+        } else {
+            size_t value = key * 3;
+            ck_assert_int_eq(clru_update(w->l, &key, sizeof(size_t), &value,
+                                         NULL),
+                             0);
+        }
+    }
+    return NULL;
+}
+
+START_TEST(test_clru) {
+    clru l = clru_new(4, 1, sizeof(int), NULL);
+    int a = 1, b = 2, c = 3, d = 4, e = 5, out;
+    ck_assert_int_eq(clru_update(&l, "a", 1, &a, NULL), 0);
+    ck_assert_int_eq(clru_update(&l, "b", 1, &b, NULL), 0);
+    ck_assert_int_eq(clru_update(&l, "c", 1, &c, NULL), 0);
+    ck_assert_int_eq(clru_update(&l, "d", 1, &d, NULL), 0);
+    ck_assert_uint_eq(clru_len(&l), 4);
+
+    /* a and c were hit, so b is the first entry without a reference */
+    ck_assert_int_eq(clru_get(&l, "a", 1, &out), 0);
+    ck_assert_int_eq(out, 1);
+    ck_assert_int_eq(clru_get(&l, "c", 1, &out), 0);
+    ck_assert_int_eq(clru_update(&l, "e", 1, &e, NULL), 0);
+    ck_assert_uint_eq(clru_len(&l), 4);
+    ck_assert_int_eq(clru_get(&l, "b", 1, &out), -1);
+    ck_assert_int_eq(clru_get(&l, "a", 1, &out), 0);
+    ck_assert_int_eq(clru_get(&l, "c", 1, &out), 0);
+    ck_assert_int_eq(clru_get(&l, "d", 1, &out), 0);
+    ck_assert_int_eq(clru_get(&l, "e", 1, &out), 0);
+    ck_assert_int_eq(out, 5);
+
+    ck_assert_int_eq(clru_update(&l, "e", 1, &a, NULL), 0);
+    ck_assert_int_eq(clru_get(&l, "e", 1, &out), 0);
+    ck_assert_int_eq(out, 1);
+    clru_free(&l, NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_clru_cap) {
+    size_t caps[] = {1, 3, 10, 100, 1000};
+    size_t i, j;
+    for (i = 0; i < sizeof caps / sizeof caps[0]; ++i) {
+        clru l = clru_new(caps[i], 0, sizeof(size_t), NULL);
+        ck_assert_uint_le(l.num_shards, caps[i]);
+        for (j = 0; j < 10000; ++j) {
+            ck_assert_int_eq(clru_update(&l, &j, sizeof(size_t), &j, NULL), 0);
+        }
+        ck_assert_uint_le(clru_len(&l), caps[i]);
+        /* every shard is full after that many keys */
+        ck_assert_uint_eq(clru_len(&l), caps[i]);
+        clru_free(&l, NULL, NULL);
+    }
+}
+END_TEST
+
+START_TEST(test_clru_hash) {
+    clru l = clru_new_with_hash(2, 1, sizeof(int), NULL, hash_wyhash);
+    int a = 1, b = 2, c = 3, out;
+    ck_assert_ptr_eq(l.hash_fn, hash_wyhash);
+    ck_assert_int_eq(clru_update(&l, "a", 1, &a, NULL), 0);
+    ck_assert_int_eq(clru_update(&l, "b", 1, &b, NULL), 0);
+    /* evicting a deletes it from the lookup with the hash of its slot */
+    ck_assert_int_eq(clru_update(&l, "c", 1, &c, NULL), 0);
+    ck_assert_uint_eq(clru_len(&l), 2);
+    ck_assert_int_eq(clru_get(&l, "a", 1, &out), -1);
+    ck_assert_int_eq(clru_get(&l, "c", 1, &out), 0);
+    ck_assert_int_eq(out, 3);
+    clru_free(&l, NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_clru_threads) {
+    clru l = clru_new(256, 0, sizeof(size_t), NULL);
+    pthread_t threads[NUM_THREADS];
+    worker workers[NUM_THREADS];
+    size_t i;
+    for (i = 0; i < NUM_THREADS; ++i) {
+        workers[i].l = &l;
+        workers[i].id = i;
+        ck_assert_int_eq(pthread_create(&threads[i], NULL, work, &workers[i]),
+                         0);
+    }
+    for (i = 0; i < NUM_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    ck_assert_uint_le(clru_len(&l), 256);
+    clru_free(&l, NULL, NULL);
+}
+END_TEST
+
+Suite* clru_suite() {
+    Suite* s;
+    TCase* tc_core;
+    s = suite_create("clru");
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_clru);
+    tcase_add_test(tc_core, test_clru_cap);
+    tcase_add_test(tc_core, test_clru_hash);
+    tcase_add_test(tc_core, test_clru_threads);
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main() {
+    int number_failed;
+    Suite* s;
+    SRunner* sr;
+    s = clru_suite();
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -70,12 +70,454 @@ START_TEST(test_ht) {
 }
 END_TEST
 
+START_TEST(test_ht_many) {
+    size_t i, n = 10000;
+    size_t* get;
+    ht ht = ht_new(sizeof(size_t), NULL);
+    for (i = 0; i < n; ++i) {
+        ck_assert_int_eq(ht_insert(&ht, &i, sizeof(size_t), &i, NULL), 0);
+    }
+    ck_assert_uint_eq(ht_len(&ht), n);
+    for (i = 0; i < n; ++i) {
+        get = ht_get(&ht, &i, sizeof(size_t));
+        ck_assert_ptr_nonnull(get);
+        ck_assert_uint_eq(*get, i);
+    }
+    for (i = 0; i < n; i += 2) {
+        ck_assert_int_eq(ht_delete(&ht, &i, sizeof(size_t), NULL, NULL), 0);
+    }
+    ck_assert_uint_eq(ht_len(&ht), n / 2);
+    for (i = 0; i < n; ++i) {
+        get = ht_get(&ht, &i, sizeof(size_t));
+        if (i % 2 == 0) {
+            ck_assert_ptr_null(get);
+        } else {
+            ck_assert_ptr_nonnull(get);
+            ck_assert_uint_eq(*get, i);
+        }
+    }
+    for (i = 0; i < n; i += 2) {
+        ck_assert_int_eq(ht_try_insert(&ht, &i, sizeof(size_t), &i), 0);
+    }
+    ck_assert_uint_eq(ht_len(&ht), n);
+    for (i = 0; i < n; ++i) {
+        ck_assert(ht_has(&ht, &i, sizeof(size_t)));
+    }
+    ht_free(&ht, NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_ht_rehash) {
+    size_t i, j, n = 1000;
+    size_t* get;
+    ht ht = ht_new(sizeof(size_t), NULL);
+    for (i = 0; i < n; ++i) {
+        ck_assert_int_eq(ht_insert(&ht, &i, sizeof(size_t), &i, NULL), 0);
+        for (j = 0; j <= i; ++j) {
+            get = ht_get(&ht, &j, sizeof(size_t));
+            ck_assert_ptr_nonnull(get);
+            ck_assert_uint_eq(*get, j);
+        }
+    }
+    for (i = 0; i < n; ++i) {
+        ck_assert_int_eq(ht_delete(&ht, &i, sizeof(size_t), NULL, NULL), 0);
+        ck_assert(!ht_has(&ht, &i, sizeof(size_t)));
+    }
+    ck_assert_uint_eq(ht_len(&ht), 0);
+    ht_free(&ht, NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_ht_hash_fn) {
+    HashFn* fns[] = {hash_siphash, hash_wyhash, hash_int};
+    uint8_t seed[HT_SEED_SIZE] = {0};
+    uint8_t other_seed[HT_SEED_SIZE] = {1};
+    char buf[128];
+    size_t i, j, n = 5000;
+    size_t* get;
+    for (i = 0; i < sizeof buf; ++i) {
+        buf[i] = (char)i;
+    }
+    for (i = 0; i < sizeof fns / sizeof fns[0]; ++i) {
+        ht ht = ht_new_with_hash(sizeof(size_t), NULL, fns[i]);
+        for (j = 0; j < sizeof buf; ++j) {
+            ck_assert_uint_eq(fns[i](buf, j, seed), fns[i](buf, j, seed));
+            ck_assert_uint_ne(fns[i](buf, j, seed),
+                              fns[i](buf, j, other_seed));
+        }
+        for (j = 0; j < n; ++j) {
+            ck_assert_int_eq(ht_insert(&ht, &j, sizeof(size_t), &j, NULL), 0);
+        }
+        for (j = 0; j < sizeof buf; ++j) {
+            ck_assert_int_eq(ht_insert(&ht, buf, j, &j, NULL), 0);
+        }
+        for (j = 0; j < n; ++j) {
+            get = ht_get(&ht, &j, sizeof(size_t));
+            ck_assert_ptr_nonnull(get);
+            ck_assert_uint_eq(*get, j);
+        }
+        for (j = 0; j < sizeof buf; ++j) {
+            get = ht_get(&ht, buf, j);
+            ck_assert_ptr_nonnull(get);
+            ck_assert_uint_eq(*get, j);
+        }
+        ht_free(&ht, NULL, NULL);
+    }
+}
+END_TEST
+
+START_TEST(test_ht_get_many) {
+    ht ht = ht_new(sizeof(size_t), NULL);
+    size_t i, n = 1000, total = 1100, vals[1100], key_lens[1100];
+    void* keys[1100];
+    void* out[1100];
+    for (i = 0; i < total; ++i) {
+        vals[i] = i;
+        keys[i] = &vals[i];
+        key_lens[i] = sizeof(size_t);
+    }
+    /* only the first n keys are inserted */
+    for (i = 0; i < n; ++i) {
+        ck_assert_int_eq(ht_insert(&ht, &vals[i], sizeof(size_t), &i, NULL),
+                         0);
+    }
+    ck_assert_uint_eq(ht_get_many(&ht, keys, key_lens, total, out), n);
+    for (i = 0; i < total; ++i) {
+        if (i < n) {
+            ck_assert_ptr_nonnull(out[i]);
+            ck_assert_uint_eq(*((size_t*)out[i]), i);
+        } else {
+            ck_assert_ptr_null(out[i]);
+        }
+    }
+    ht_free(&ht, NULL, NULL);
+}
+END_TEST
+
+typedef struct {
+    size_t count;
+    char name[64];
+} big_value;
+
+START_TEST(test_ht_emplace) {
+    ht ht = ht_new(sizeof(big_value), NULL);
+    big_value* value;
+    bool inserted;
+    size_t i;
+
+    value = ht_emplace(&ht, "foo", 3);
+    ck_assert_ptr_nonnull(value);
+    value->count = 1;
+    strcpy(value->name, "foo");
+    ck_assert_ptr_null(ht_emplace(&ht, "foo", 3));
+    ck_assert_uint_eq(ht_len(&ht), 1);
+    value = ht_get(&ht, "foo", 3);
+    ck_assert_ptr_nonnull(value);
+    ck_assert_uint_eq(value->count, 1);
+    ck_assert_str_eq(value->name, "foo");
+
+    /* count words with one lookup per word, across a few resizes */
+    for (i = 0; i < 5000; ++i) {
+        size_t key = i % 1000;
+        value = ht_get_or_insert_slot(&ht, &key, sizeof(size_t), &inserted);
+        ck_assert_ptr_nonnull(value);
+        ck_assert(inserted == (i < 1000));
+        if (inserted) {
+            value->count = 0;
+        }
+        value->count++;
+    }
+    ck_assert_uint_eq(ht_len(&ht), 1001);
+    for (i = 0; i < 1000; ++i) {
+        value = ht_get(&ht, &i, sizeof(size_t));
+        ck_assert_ptr_nonnull(value);
+        ck_assert_uint_eq(value->count, 5);
+    }
+
+    value = ht_get_or_insert_slot(&ht, "foo", 3, &inserted);
+    ck_assert(!inserted);
+    ck_assert_str_eq(value->name, "foo");
+    ht_free(&ht, NULL, NULL);
+}
+END_TEST
+
+static void count(void* value, bool inserted, void* ctx) {
+    size_t* n = value;
+    if (inserted) {
+        *n = 0;
+    }
+    *n += *((size_t*)ctx);
+}
+
+START_TEST(test_ht_update) {
+    ht ht = ht_new(sizeof(size_t), NULL);
+    ht_entry* entry;
+    bool inserted;
+    size_t i, one = 1, val = 42;
+
+    for (i = 0; i < 10000; ++i) {
+        size_t key = i % 2000;
+        ck_assert_int_eq(ht_update(&ht, &key, sizeof(size_t), count, &one), 0);
+    }
+    ck_assert_uint_eq(ht_len(&ht), 2000);
+    for (i = 0; i < 2000; ++i) {
+        size_t* get = ht_get(&ht, &i, sizeof(size_t));
+        ck_assert_ptr_nonnull(get);
+        ck_assert_uint_eq(*get, 5);
+    }
+
+    entry = ht_entry_find_or_insert(&ht, "foo", 3, &inserted);
+    ck_assert_ptr_nonnull(entry);
+    ck_assert(inserted);
+    ck_assert_uint_eq(entry->key_len, 3);
+    ck_assert_int_eq(memcmp(entry->data, "foo", 3), 0);
+    memcpy(ht_entry_value(entry), &val, sizeof(size_t));
+    ck_assert_ptr_eq(ht_entry_find_or_insert(&ht, "foo", 3, &inserted), entry);
+    ck_assert(!inserted);
+    ck_assert_uint_eq(*((size_t*)ht_get(&ht, "foo", 3)), 42);
+
+    /* ht_insert and ht_try_insert go through the same path */
+    ck_assert_int_eq(ht_try_insert(&ht, "foo", 3, &one), -1);
+    ck_assert_int_eq(ht_insert(&ht, "foo", 3, &one, NULL), 0);
+    ck_assert_uint_eq(*((size_t*)ht_get(&ht, "foo", 3)), 1);
+    ck_assert_uint_eq(ht_len(&ht), 2001);
+    ht_free(&ht, NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_ht_hashed) {
+    ht ht = ht_new(sizeof(size_t), NULL);
+    size_t i, n = 5000;
+    bool inserted;
+    for (i = 0; i < n; ++i) {
+        uint64_t hash = ht.hash_fn(&i, sizeof(size_t), ht.seed);
+        ht_entry* entry =
+            ht_entry_find_or_insert_hashed(&ht, &i, sizeof(size_t), hash,
+                                           &inserted);
+        ck_assert_ptr_nonnull(entry);
+        ck_assert(inserted);
+        memcpy(ht_entry_value(entry), &i, sizeof(size_t));
+    }
+    /* keys inserted with a precomputed hash are found by the plain calls */
+    for (i = 0; i < n; ++i) {
+        uint64_t hash = ht.hash_fn(&i, sizeof(size_t), ht.seed);
+        size_t* get = ht_get(&ht, &i, sizeof(size_t));
+        ck_assert_ptr_nonnull(get);
+        ck_assert_uint_eq(*get, i);
+        ck_assert_ptr_eq(ht_get_hashed(&ht, &i, sizeof(size_t), hash), get);
+    }
+    for (i = 0; i < n; i += 2) {
+        uint64_t hash = ht.hash_fn(&i, sizeof(size_t), ht.seed);
+        ck_assert_int_eq(
+            ht_delete_hashed(&ht, &i, sizeof(size_t), hash, NULL, NULL), 0);
+        ck_assert_ptr_null(ht_get_hashed(&ht, &i, sizeof(size_t), hash));
+        ck_assert_int_eq(
+            ht_delete_hashed(&ht, &i, sizeof(size_t), hash, NULL, NULL), -1);
+    }
+    ck_assert_uint_eq(ht_len(&ht), n / 2);
+    ht_free(&ht, NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_ht_fixed) {
+    ht ints = ht_new_fixed(sizeof(uint64_t), sizeof(uint64_t));
+    ht uuids = ht_new_fixed(16, sizeof(uint64_t));
+    uint64_t i, n = 5000, small = 1;
+    unsigned char uuid[16] = {0};
+    bool inserted;
+    for (i = 0; i < n; ++i) {
+        uint64_t val = i * 2;
+        ck_assert_int_eq(ht_insert(&ints, &i, sizeof(uint64_t), &val, NULL), 0);
+        memcpy(uuid + 8, &i, sizeof i);
+        ck_assert_int_eq(ht_insert(&uuids, uuid, 16, &val, NULL), 0);
+    }
+    ck_assert_uint_eq(ht_len(&ints), n);
+    /* keys of another size are never found or inserted */
+    ck_assert_ptr_null(ht_get(&ints, &small, sizeof(uint32_t)));
+    ck_assert_int_eq(ht_insert(&ints, &small, sizeof(uint32_t), &small, NULL),
+                     -1);
+    ck_assert_ptr_null(
+        ht_get_or_insert_slot(&ints, &small, sizeof(uint8_t), &inserted));
+    ck_assert(!inserted);
+    ck_assert_uint_eq(ht_len(&ints), n);
+    for (i = 0; i < n; i += 2) {
+        ck_assert_int_eq(ht_delete(&ints, &i, sizeof(uint64_t), NULL, NULL), 0);
+    }
+    for (i = 0; i < n + 10; ++i) {
+        uint64_t* get = ht_get(&ints, &i, sizeof(uint64_t));
+        if ((i >= n) || (i % 2 == 0)) {
+            ck_assert_ptr_null(get);
+            continue;
+        }
+        ck_assert_ptr_nonnull(get);
+        ck_assert_uint_eq(*get, i * 2);
+    }
+    for (i = 0; i < n; ++i) {
+        uint64_t* get;
+        memcpy(uuid + 8, &i, sizeof i);
+        get = ht_get(&uuids, uuid, 16);
+        ck_assert_ptr_nonnull(get);
+        ck_assert_uint_eq(*get, i * 2);
+    }
+    uuid[0] = 1;
+    ck_assert_ptr_null(ht_get(&uuids, uuid, 16));
+    ht_free(&ints, NULL, NULL);
+    ht_free(&uuids, NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_ht_fixed_inline) {
+    /* odd key and value sizes, so the inline entries need padding */
+    ht ht = ht_new_fixed(3, 5);
+    uint32_t i, n = 3000;
+    bool inserted;
+    ht_entry* entry;
+    for (i = 0; i < n; ++i) {
+        unsigned char value[5] = {0};
+        memcpy(value, &i, sizeof i);
+        ck_assert_int_eq(ht_insert(&ht, &i, 3, value, NULL), 0);
+    }
+    entry = ht_entry_find_or_insert(&ht, &n, 3, &inserted);
+    ck_assert_ptr_nonnull(entry);
+    ck_assert(inserted);
+    ck_assert_uint_eq(entry->key_len, 3);
+    ck_assert_int_eq(memcmp(entry->data, &n, 3), 0);
+    ck_assert_uint_eq(((uintptr_t)ht_entry_value(entry)) % sizeof(void*), 0);
+    memcpy(ht_entry_value(entry), &n, sizeof n);
+    entry = ht_entry_find_or_insert(&ht, &n, 3, &inserted);
+    ck_assert(!inserted);
+    for (i = 0; i < n; i += 2) {
+        ck_assert_int_eq(ht_delete(&ht, &i, 3, NULL, NULL), 0);
+    }
+    /* the entries are copied into the smaller table */
+    ck_assert_int_eq(ht_shrink_to_fit(&ht), 0);
+    for (i = 0; i <= n; ++i) {
+        uint32_t* get = ht_get(&ht, &i, 3);
+        if ((i % 2 == 0) && (i != n)) {
+            ck_assert_ptr_null(get);
+            continue;
+        }
+        ck_assert_ptr_nonnull(get);
+        ck_assert_uint_eq(*get, i);
+    }
+    ht_free(&ht, NULL, NULL);
+}
+END_TEST
+
+static void mark(void* key, size_t key_len, void* value, void* ctx) {
+    size_t* seen = ctx;
+    size_t k = *((size_t*)key);
+    ck_assert_uint_eq(key_len, sizeof(size_t));
+    ck_assert_uint_eq(*((size_t*)value), k * 2);
+    seen[k]++;
+}
+
+START_TEST(test_ht_scan) {
+    ht ht = ht_new(sizeof(size_t), NULL);
+    size_t* seen = calloc(30000, sizeof(size_t));
+    size_t i, cursor = 0, next = 10000;
+    ck_assert_ptr_nonnull(seen);
+    for (i = 0; i < 10000; ++i) {
+        size_t val = i * 2;
+        ck_assert_int_eq(ht_insert(&ht, &i, sizeof(size_t), &val, NULL), 0);
+    }
+    /* without changes every entry is visited exactly once */
+    do {
+        cursor = ht_scan(&ht, cursor, 100, mark, seen);
+    } while (cursor != 0);
+    for (i = 0; i < 10000; ++i) {
+        ck_assert_uint_eq(seen[i], 1);
+    }
+    /* the table grows and rehashes while it is scanned, the entries that are
+     * in it the whole time are still all visited */
+    memset(seen, 0, 30000 * sizeof(size_t));
+    do {
+        size_t j;
+        cursor = ht_scan(&ht, cursor, 10, mark, seen);
+        for (j = 0; (j < 20) && (next < 30000); ++j, ++next) {
+            size_t val = next * 2, del = next - 5;
+            ck_assert_int_eq(ht_insert(&ht, &next, sizeof(size_t), &val, NULL),
+                             0);
+            if ((del >= 10000) && (del % 3 == 0)) {
+                ck_assert_int_eq(
+                    ht_delete(&ht, &del, sizeof(size_t), NULL, NULL), 0);
+            }
+        }
+    } while (cursor != 0);
+    for (i = 0; i < 10000; ++i) {
+        ck_assert_uint_ge(seen[i], 1);
+    }
+    free(seen);
+    ht_free(&ht, NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_ht_capacity) {
+    ht presized = ht_new_with_capacity(sizeof(size_t), NULL, 10000);
+    ht grown = ht_new(sizeof(size_t), NULL);
+    size_t i, cap = presized.tables[0].cap;
+    for (i = 0; i < 10000; ++i) {
+        ck_assert_int_eq(ht_insert(&presized, &i, sizeof(size_t), &i, NULL), 0);
+    }
+    /* a presized table never grows on the way */
+    ck_assert_uint_eq(presized.tables[0].cap, cap);
+    ck_assert_int_eq(presized.rehash_idx, -1);
+
+    ck_assert_int_eq(ht_reserve(&grown, 10000), 0);
+    ck_assert_uint_eq(grown.tables[0].cap, cap);
+    ck_assert_int_eq(grown.rehash_idx, -1);
+    for (i = 0; i < 10000; ++i) {
+        ck_assert_int_eq(ht_insert(&grown, &i, sizeof(size_t), &i, NULL), 0);
+    }
+    ck_assert_uint_eq(grown.tables[0].cap, cap);
+    ck_assert_int_eq(ht_reserve(&grown, 100), 0);
+    ck_assert_uint_eq(grown.tables[0].cap, cap);
+    /* reserving on a full table migrates it incrementally */
+    ck_assert_int_eq(ht_reserve(&grown, 40000), 0);
+    for (i = 10000; i < 40000; ++i) {
+        ck_assert_int_eq(ht_insert(&grown, &i, sizeof(size_t), &i, NULL), 0);
+    }
+    ck_assert_uint_eq(grown.tables[grown.rehash_idx == -1 ? 0 : 1].cap,
+                      cap * 4);
+
+    for (i = 100; i < 40000; ++i) {
+        ck_assert_int_eq(ht_delete(&grown, &i, sizeof(size_t), NULL, NULL), 0);
+    }
+    ck_assert_int_eq(ht_shrink_to_fit(&grown), 0);
+    ck_assert_int_eq(grown.rehash_idx, -1);
+    ck_assert_uint_eq(grown.tables[0].cap, 128);
+    ck_assert_uint_eq(grown.tables[0].deleted, 0);
+    for (i = 0; i < 200; ++i) {
+        size_t* get = ht_get(&grown, &i, sizeof(size_t));
+        if (i >= 100) {
+            ck_assert_ptr_null(get);
+            continue;
+        }
+        ck_assert_ptr_nonnull(get);
+        ck_assert_uint_eq(*get, i);
+    }
+    ht_free(&presized, NULL, NULL);
+    ht_free(&grown, NULL, NULL);
+}
+END_TEST
+
 Suite* ht_suite() {
     Suite* s;
     TCase* tc_core;
     s = suite_create("ht test");
     tc_core = tcase_create("Core");
     tcase_add_test(tc_core, test_ht);
+    tcase_add_test(tc_core, test_ht_many);
+    tcase_add_test(tc_core, test_ht_rehash);
+    tcase_add_test(tc_core, test_ht_hash_fn);
+    tcase_add_test(tc_core, test_ht_get_many);
+    tcase_add_test(tc_core, test_ht_emplace);
+    tcase_add_test(tc_core, test_ht_update);
+    tcase_add_test(tc_core, test_ht_hashed);
+    tcase_add_test(tc_core, test_ht_fixed);
+    tcase_add_test(tc_core, test_ht_fixed_inline);
+    tcase_add_test(tc_core, test_ht_scan);
+    tcase_add_test(tc_core, test_ht_capacity);
     suite_add_tcase(s, tc_core);
     return s;
 }
@@ -55,12 +55,201 @@ START_TEST(lru_test) {
 }
 END_TEST
 
+START_TEST(lru_test_many) {
+    lru l = lru_new(100, sizeof(size_t), NULL);
+    size_t i, *get;
+    for (i = 0; i < 1000; ++i) {
+        ck_assert_int_eq(lru_update(&l, &i, sizeof(size_t), &i, NULL), 0);
+        ck_assert_uint_le(l.len, 100);
+    }
+    ck_assert_uint_eq(l.len, 100);
+    for (i = 0; i < 1000; ++i) {
+        get = lru_get(&l, &i, sizeof(size_t));
+        if (i < 900) {
+            ck_assert_ptr_null(get);
+        } else {
+            ck_assert_ptr_nonnull(get);
+            ck_assert_uint_eq(*get, i);
+        }
+    }
+    lru_free(&l, NULL, NULL);
+}
+END_TEST
+
+START_TEST(lru_test_reserve) {
+    lru l = lru_new(1000, sizeof(size_t), NULL);
+    size_t i, cap;
+    ck_assert_int_eq(lru_reserve(&l, 100000), 0);
+    /* no more than the capacity of the lru is reserved */
+    cap = l.lookup.tables[l.lookup.rehash_idx == -1 ? 0 : 1].cap;
+    ck_assert_uint_eq(cap, 2048);
+    for (i = 0; i < 1000; ++i) {
+        ck_assert_int_eq(lru_update(&l, &i, sizeof(size_t), &i, NULL), 0);
+    }
+    ck_assert_int_eq(l.lookup.rehash_idx, -1);
+    ck_assert_uint_eq(l.lookup.tables[0].cap, cap);
+    ck_assert_int_eq(lru_shrink_to_fit(&l), 0);
+    ck_assert_uint_eq(l.lookup.tables[0].cap, cap);
+    lru_free(&l, NULL, NULL);
+}
+END_TEST
+
+START_TEST(lru_test_weighted) {
+    lru l = lru_new_weighted(100, sizeof(int), NULL);
+    int a0 = 1, a1 = 2, a2 = 3;
+
+    ck_assert_int_eq(lru_update_cost(&l, "foo", 3, &a0, 40, NULL), 0);
+    ck_assert_int_eq(lru_update_cost(&l, "bar", 3, &a1, 40, NULL), 0);
+    ck_assert_uint_eq(lru_bytes(&l), 80);
+
+    /* foo is the least recently used, so it is evicted to make room */
+    ck_assert_int_eq(lru_update_cost(&l, "baz", 3, &a2, 30, NULL), 0);
+    ck_assert_uint_eq(lru_bytes(&l), 70);
+    ck_assert_ptr_null(lru_get(&l, "foo", 3));
+    ck_assert_ptr_nonnull(lru_get(&l, "bar", 3));
+
+    /* growing bar evicts baz */
+    ck_assert_int_eq(lru_update_cost(&l, "bar", 3, &a1, 90, NULL), 0);
+    ck_assert_uint_eq(lru_bytes(&l), 90);
+    ck_assert_ptr_null(lru_get(&l, "baz", 3));
+
+    /* an entry over the budget doesn't stay */
+    ck_assert_int_eq(lru_update_cost(&l, "ball", 4, &a0, 200, NULL), 0);
+    ck_assert_ptr_null(lru_get(&l, "ball", 4));
+    ck_assert_uint_eq(lru_bytes(&l), 0);
+
+    ck_assert_int_eq(lru_update(&l, "foo", 3, &a0, NULL), 0);
+    ck_assert_uint_eq(lru_bytes(&l), 3 + sizeof(int));
+
+    lru_free(&l, NULL, NULL);
+}
+END_TEST
+
+START_TEST(lru_test_ttl) {
+    lru l = lru_new_with_ttl(10, sizeof(int), NULL);
+    lru plain = lru_new(10, sizeof(int), NULL);
+    int a0 = 1, a1 = 2, a2 = 3;
+
+    ck_assert_int_eq(lru_update_ttl(&plain, "foo", 3, &a0, 5, NULL), -1);
+
+    ck_assert_int_eq(lru_update_ttl(&l, "foo", 3, &a0, 5, NULL), 0);
+    ck_assert_int_eq(lru_update_ttl(&l, "bar", 3, &a1, 10, NULL), 0);
+    ck_assert_int_eq(lru_update(&l, "baz", 3, &a2, NULL), 0);
+
+    lru_tick(&l, 4, NULL);
+    ck_assert_ptr_nonnull(lru_get(&l, "foo", 3));
+    /* lru_update keeps the ttl of foo */
+    ck_assert_int_eq(lru_update(&l, "foo", 3, &a2, NULL), 0);
+    lru_tick(&l, 1, NULL);
+    ck_assert_ptr_null(lru_get(&l, "foo", 3));
+    ck_assert_uint_eq(l.len, 2);
+
+    /* extending the ttl of bar */
+    ck_assert_int_eq(lru_update_ttl(&l, "bar", 3, &a1, 100, NULL), 0);
+    lru_tick(&l, 99, NULL);
+    ck_assert_ptr_nonnull(lru_get(&l, "bar", 3));
+    lru_tick(&l, 1, NULL);
+    ck_assert_ptr_null(lru_get(&l, "bar", 3));
+
+    /* entries without a ttl never expire */
+    lru_tick(&l, 100000, NULL);
+    ck_assert_ptr_nonnull(lru_get(&l, "baz", 3));
+    ck_assert_uint_eq(l.len, 1);
+    ck_assert_uint_eq(lru_bytes(&l), 3 + sizeof(int));
+
+    lru_free(&plain, NULL, NULL);
+    lru_free(&l, NULL, NULL);
+}
+END_TEST
+
+START_TEST(lru_test_ttl_evict) {
+    lru l = lru_new_with_ttl(100, sizeof(size_t), NULL);
+    size_t i;
+    /* evicted entries must also leave the wheel */
+    for (i = 0; i < 1000; ++i) {
+        ck_assert_int_eq(
+            lru_update_ttl(&l, &i, sizeof(size_t), &i, (i % 300) + 1, NULL), 0);
+    }
+    ck_assert_uint_eq(l.len, 100);
+    ck_assert_uint_eq(l.wheel->len, 100);
+    lru_tick(&l, 300, NULL);
+    ck_assert_uint_eq(l.len, 0);
+    ck_assert_uint_eq(l.wheel->len, 0);
+    lru_free(&l, NULL, NULL);
+}
+END_TEST
+
+START_TEST(tlfu_test) {
+    int a0 = 69, a1 = 420, a2 = 1337;
+    tlfu c = tlfu_new(3, sizeof(int), NULL);
+    int* get;
+
+    ck_assert_ptr_null(tlfu_get(&c, "foo", 3));
+
+    ck_assert_int_eq(tlfu_update(&c, "foo", 3, &a0, NULL), 0);
+    get = tlfu_get(&c, "foo", 3);
+    ck_assert_ptr_nonnull(get);
+    ck_assert_int_eq(*get, 69);
+
+    ck_assert_int_eq(tlfu_update(&c, "bar", 3, &a1, NULL), 0);
+    ck_assert_int_eq(tlfu_update(&c, "baz", 3, &a2, NULL), 0);
+    ck_assert_uint_eq(c.len, 3);
+
+    ck_assert_int_eq(tlfu_update(&c, "foo", 3, &a2, NULL), 0);
+    get = tlfu_get(&c, "foo", 3);
+    ck_assert_ptr_nonnull(get);
+    ck_assert_int_eq(*get, 1337);
+
+    ck_assert_int_eq(tlfu_update(&c, "ball", 4, &a0, NULL), 0);
+    ck_assert_uint_eq(c.len, 3);
+    get = tlfu_get(&c, "foo", 3);
+    ck_assert_ptr_nonnull(get);
+
+    tlfu_free(&c, NULL, NULL);
+}
+END_TEST
+
+START_TEST(tlfu_test_scan) {
+    tlfu c = tlfu_new(100, sizeof(size_t), NULL);
+    size_t i, j, hits = 0;
+    for (j = 0; j < 5; ++j) {
+        for (i = 0; i < 50; ++i) {
+            if (tlfu_get(&c, &i, sizeof(size_t)) == NULL) {
+                ck_assert_int_eq(tlfu_update(&c, &i, sizeof(size_t), &i, NULL),
+                                 0);
+            }
+        }
+    }
+    /* a scan of keys that are only seen once */
+    for (i = 1000; i < 11000; ++i) {
+        ck_assert_int_eq(tlfu_update(&c, &i, sizeof(size_t), &i, NULL), 0);
+        ck_assert_uint_le(c.len, 100);
+    }
+    for (i = 0; i < 50; ++i) {
+        size_t* get = tlfu_get(&c, &i, sizeof(size_t));
+        if (get) {
+            ck_assert_uint_eq(*get, i);
+            hits++;
+        }
+    }
+    ck_assert_uint_ge(hits, 45);
+    tlfu_free(&c, NULL, NULL);
+}
+END_TEST
+
 Suite* ht_suite() {
     Suite* s;
     TCase* tc_core;
     s = suite_create("lru");
     tc_core = tcase_create("Core");
     tcase_add_test(tc_core, lru_test);
+    tcase_add_test(tc_core, lru_test_many);
+    tcase_add_test(tc_core, lru_test_reserve);
+    tcase_add_test(tc_core, lru_test_weighted);
+    tcase_add_test(tc_core, lru_test_ttl);
+    tcase_add_test(tc_core, lru_test_ttl_evict);
+    tcase_add_test(tc_core, tlfu_test);
+    tcase_add_test(tc_core, tlfu_test_scan);
     suite_add_tcase(s, tc_core);
     return s;
 }
@@ -42,12 +42,271 @@ START_TEST(set_test) {
 }
 END_TEST
 
+START_TEST(set_test_many) {
+    set s = set_new_with_hash(NULL, hash_int);
+    size_t i, n = 10000;
+    for (i = 0; i < n; ++i) {
+        ck_assert_int_eq(set_insert(&s, &i, sizeof(size_t)), 0);
+        ck_assert_int_eq(set_has(&s, &i, sizeof(size_t)), true);
+    }
+    ck_assert_uint_eq(set_len(&s), n);
+    for (i = 0; i < n; ++i) {
+        ck_assert_int_eq(set_has(&s, &i, sizeof(size_t)), true);
+        ck_assert_int_eq(set_insert(&s, &i, sizeof(size_t)), -1);
+    }
+    for (i = 0; i < n; i += 3) {
+        ck_assert_int_eq(set_delete(&s, &i, sizeof(size_t), NULL), 0);
+    }
+    for (i = 0; i < n; ++i) {
+        ck_assert_int_eq(set_has(&s, &i, sizeof(size_t)), i % 3 != 0);
+    }
+    ck_assert_uint_eq(set_len(&s), n - ((n + 2) / 3));
+    set_free(&s, NULL);
+}
+END_TEST
+
+START_TEST(set_test_has_many) {
+    set s = set_new(NULL);
+    size_t i, n = 1000, total = 1100, vals[1100], key_lens[1100];
+    void* keys[1100];
+    bool out[1100];
+    for (i = 0; i < total; ++i) {
+        vals[i] = i;
+        keys[i] = &vals[i];
+        key_lens[i] = sizeof(size_t);
+    }
+    for (i = 0; i < n; ++i) {
+        ck_assert_int_eq(set_insert(&s, &vals[i], sizeof(size_t)), 0);
+    }
+    ck_assert_uint_eq(set_has_many(&s, keys, key_lens, total, out), n);
+    for (i = 0; i < total; ++i) {
+        ck_assert_int_eq(out[i], i < n);
+    }
+    ck_assert_uint_eq(set_has_many(&s, keys, key_lens, total, NULL), n);
+    set_free(&s, NULL);
+}
+END_TEST
+
+START_TEST(set_test_fixed) {
+    set s = set_new_fixed(sizeof(uint64_t), NULL);
+    uint64_t i, n = 10000;
+    uint32_t small = 1;
+    for (i = 0; i < n; ++i) {
+        ck_assert_int_eq(set_insert(&s, &i, sizeof(uint64_t)), 0);
+    }
+    ck_assert_int_eq(set_insert(&s, &small, sizeof(uint32_t)), -1);
+    ck_assert_int_eq(set_has(&s, &small, sizeof(uint32_t)), false);
+    ck_assert_uint_eq(set_len(&s), n);
+    for (i = 0; i < n; i += 2) {
+        ck_assert_int_eq(set_delete(&s, &i, sizeof(uint64_t), NULL), 0);
+    }
+    for (i = 0; i < n + 100; ++i) {
+        ck_assert_int_eq(set_has(&s, &i, sizeof(uint64_t)),
+                         (i < n) && (i % 2 == 1));
+    }
+    ck_assert_uint_eq(set_len(&s), n / 2);
+    set_free(&s, NULL);
+}
+END_TEST
+
+/* robin hood moves keys around on insert and delete, check it against a
+ * plain array while the set grows */
+START_TEST(set_test_churn) {
+    set s = set_new_with_hash(NULL, hash_int);
+    set f = set_new_fixed(sizeof(size_t), NULL);
+    bool in[4096] = {0};
+    size_t i, len = 0;
+    srand(7);
+    for (i = 0; i < 200000; ++i) {
+        size_t key = (size_t)rand() % 4096;
+        if (rand() % 3) {
+            int res = set_insert(&s, &key, sizeof(size_t));
+            ck_assert_int_eq(res, in[key] ? -1 : 0);
+            ck_assert_int_eq(set_insert(&f, &key, sizeof(size_t)), res);
+            len += !in[key];
+            in[key] = true;
+        } else {
+            int res = set_delete(&s, &key, sizeof(size_t), NULL);
+            ck_assert_int_eq(res, in[key] ? 0 : -1);
+            ck_assert_int_eq(set_delete(&f, &key, sizeof(size_t), NULL), res);
+            len -= in[key];
+            in[key] = false;
+        }
+        ck_assert_uint_eq(set_len(&s), len);
+        ck_assert_uint_eq(set_len(&f), len);
+    }
+    for (i = 0; i < 4096; ++i) {
+        ck_assert_int_eq(set_has(&s, &i, sizeof(size_t)), in[i]);
+        ck_assert_int_eq(set_has(&f, &i, sizeof(size_t)), in[i]);
+    }
+    set_free(&s, NULL);
+    set_free(&f, NULL);
+}
+END_TEST
+
+START_TEST(set_test_algebra) {
+    set a = set_new(NULL);
+    set b = set_new(NULL);
+    set fa = set_new_fixed(sizeof(size_t), NULL);
+    set fb = set_new_fixed(sizeof(size_t), NULL);
+    set u, in, d, fu, fin, fd;
+    size_t i;
+    /* a holds the multiples of 2 below 3000, b the multiples of 3 below 900 */
+    for (i = 0; i < 3000; i += 2) {
+        ck_assert_int_eq(set_insert(&a, &i, sizeof(size_t)), 0);
+        ck_assert_int_eq(set_insert(&fa, &i, sizeof(size_t)), 0);
+    }
+    for (i = 0; i < 900; i += 3) {
+        ck_assert_int_eq(set_insert(&b, &i, sizeof(size_t)), 0);
+        ck_assert_int_eq(set_insert(&fb, &i, sizeof(size_t)), 0);
+    }
+    ck_assert_int_eq(set_union(&a, &b, &u), 0);
+    ck_assert_int_eq(set_intersect(&b, &a, &in), 0);
+    ck_assert_int_eq(set_difference(&b, &a, &d), 0);
+    ck_assert_int_eq(set_union(&fb, &fa, &fu), 0);
+    ck_assert_int_eq(set_intersect(&fa, &fb, &fin), 0);
+    ck_assert_int_eq(set_difference(&fb, &fa, &fd), 0);
+    for (i = 0; i < 3100; ++i) {
+        bool in_a = (i < 3000) && (i % 2 == 0);
+        bool in_b = (i < 900) && (i % 3 == 0);
+        ck_assert_int_eq(set_has(&u, &i, sizeof(size_t)), in_a || in_b);
+        ck_assert_int_eq(set_has(&in, &i, sizeof(size_t)), in_a && in_b);
+        ck_assert_int_eq(set_has(&d, &i, sizeof(size_t)), in_b && !in_a);
+        ck_assert_int_eq(set_has(&fu, &i, sizeof(size_t)), in_a || in_b);
+        ck_assert_int_eq(set_has(&fin, &i, sizeof(size_t)), in_a && in_b);
+        ck_assert_int_eq(set_has(&fd, &i, sizeof(size_t)), in_b && !in_a);
+    }
+    ck_assert_uint_eq(set_len(&u), 1500 + 150);
+    ck_assert_uint_eq(set_len(&in), 150);
+    ck_assert_uint_eq(set_len(&d), 150);
+    ck_assert_uint_eq(set_len(&fu), 1500 + 150);
+
+    ck_assert(set_is_subset(&in, &a));
+    ck_assert(set_is_subset(&in, &b));
+    ck_assert(set_is_subset(&a, &u));
+    ck_assert(!set_is_subset(&b, &a));
+    ck_assert(!set_is_subset(&u, &a));
+    ck_assert(set_is_subset(&fd, &fb));
+
+    set_free(&a, NULL);
+    set_free(&b, NULL);
+    set_free(&fa, NULL);
+    set_free(&fb, NULL);
+    set_free(&u, NULL);
+    set_free(&in, NULL);
+    set_free(&d, NULL);
+    set_free(&fu, NULL);
+    set_free(&fin, NULL);
+    set_free(&fd, NULL);
+}
+END_TEST
+
+static void mark(void* key, size_t key_len, void* value, void* ctx) {
+    size_t* seen = ctx;
+    ck_assert_uint_eq(key_len, sizeof(size_t));
+    ck_assert_ptr_null(value);
+    seen[*((size_t*)key)]++;
+}
+
+START_TEST(set_test_scan) {
+    set s = set_new(NULL);
+    set f = set_new_fixed(sizeof(size_t), NULL);
+    size_t* seen = calloc(30000, sizeof(size_t));
+    size_t* seen_fixed = calloc(30000, sizeof(size_t));
+    size_t i, cursor = 0, cursor_fixed = 0, next = 10000;
+    ck_assert_ptr_nonnull(seen);
+    ck_assert_ptr_nonnull(seen_fixed);
+    for (i = 0; i < 10000; ++i) {
+        ck_assert_int_eq(set_insert(&s, &i, sizeof(size_t)), 0);
+        ck_assert_int_eq(set_insert(&f, &i, sizeof(size_t)), 0);
+    }
+    /* without changes every key is visited exactly once */
+    do {
+        cursor = set_scan(&s, cursor, 100, mark, seen);
+    } while (cursor != 0);
+    for (i = 0; i < 10000; ++i) {
+        ck_assert_uint_eq(seen[i], 1);
+    }
+    /* keys that stay in the set are visited while it grows and shifts */
+    memset(seen, 0, 30000 * sizeof(size_t));
+    cursor = set_scan(&s, 0, 10, mark, seen);
+    cursor_fixed = set_scan(&f, 0, 10, mark, seen_fixed);
+    while (cursor || cursor_fixed) {
+        size_t j;
+        for (j = 0; (j < 20) && (next < 30000); ++j, ++next) {
+            size_t del = next - 5;
+            ck_assert_int_eq(set_insert(&s, &next, sizeof(size_t)), 0);
+            ck_assert_int_eq(set_insert(&f, &next, sizeof(size_t)), 0);
+            if ((del >= 10000) && (del % 3 == 0)) {
+                ck_assert_int_eq(set_delete(&s, &del, sizeof(size_t), NULL),
+                                 0);
+                ck_assert_int_eq(set_delete(&f, &del, sizeof(size_t), NULL),
+                                 0);
+            }
+        }
+        if (cursor) {
+            cursor = set_scan(&s, cursor, 10, mark, seen);
+        }
+        if (cursor_fixed) {
+            cursor_fixed = set_scan(&f, cursor_fixed, 10, mark, seen_fixed);
+        }
+    }
+    for (i = 0; i < 10000; ++i) {
+        ck_assert_uint_ge(seen[i], 1);
+        ck_assert_uint_ge(seen_fixed[i], 1);
+    }
+    free(seen);
+    free(seen_fixed);
+    set_free(&s, NULL);
+    set_free(&f, NULL);
+}
+END_TEST
+
+START_TEST(set_test_capacity) {
+    set presized = set_new_with_capacity(NULL, 10000);
+    set grown = set_new(NULL);
+    size_t i, cap = presized.tables[0].cap;
+    for (i = 0; i < 10000; ++i) {
+        ck_assert_int_eq(set_insert(&presized, &i, sizeof(size_t)), 0);
+    }
+    ck_assert_uint_eq(presized.tables[0].cap, cap);
+    ck_assert_int_eq(presized.rehash_idx, -1);
+
+    ck_assert_int_eq(set_reserve(&grown, 10000), 0);
+    ck_assert_uint_eq(grown.tables[0].cap, cap);
+    for (i = 0; i < 10000; ++i) {
+        ck_assert_int_eq(set_insert(&grown, &i, sizeof(size_t)), 0);
+    }
+    ck_assert_uint_eq(grown.tables[0].cap, cap);
+    ck_assert_int_eq(grown.rehash_idx, -1);
+
+    for (i = 100; i < 10000; ++i) {
+        ck_assert_int_eq(set_delete(&grown, &i, sizeof(size_t), NULL), 0);
+    }
+    ck_assert_int_eq(set_shrink_to_fit(&grown), 0);
+    ck_assert_int_eq(grown.rehash_idx, -1);
+    ck_assert_uint_eq(grown.tables[0].cap, 128);
+    for (i = 0; i < 200; ++i) {
+        ck_assert_int_eq(set_has(&grown, &i, sizeof(size_t)), i < 100);
+    }
+    set_free(&presized, NULL);
+    set_free(&grown, NULL);
+}
+END_TEST
+
 Suite* ht_suite() {
     Suite* s;
     TCase* tc_core;
     s = suite_create("set");
     tc_core = tcase_create("Core");
     tcase_add_test(tc_core, set_test);
+    tcase_add_test(tc_core, set_test_many);
+    tcase_add_test(tc_core, set_test_has_many);
+    tcase_add_test(tc_core, set_test_fixed);
+    tcase_add_test(tc_core, set_test_churn);
+    tcase_add_test(tc_core, set_test_algebra);
+    tcase_add_test(tc_core, set_test_scan);
+    tcase_add_test(tc_core, set_test_capacity);
     suite_add_tcase(s, tc_core);
     return s;
 }
@@ -0,0 +1,161 @@
+#include "../src/vlib.h"
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_TIMERS 1000
+
+typedef struct {
+    twheel_timer timer;
+    uint64_t deadline;
+    uint64_t fired_at;
+    size_t fired;
+} test_timer;
+
+typedef struct {
+    twheel* tw;
+    size_t fired;
+} fire_ctx;
+
+static void fire(twheel_timer* timer, void* ctx) {
+    test_timer* t = (test_timer*)timer;
+    fire_ctx* c = ctx;
+    t->fired_at = c->tw->now;
+    t->fired++;
+    c->fired++;
+}
+
+START_TEST(test_twheel) {
+    twheel tw = twheel_new();
+    test_timer t0, t1, t2;
+    fire_ctx ctx = {&tw, 0};
+
+    twheel_timer_init(&t0.timer);
+    twheel_timer_init(&t1.timer);
+    twheel_timer_init(&t2.timer);
+    t0.fired = t1.fired = t2.fired = 0;
+    ck_assert(!twheel_timer_pending(&t0.timer));
+
+    twheel_add(&tw, &t0.timer, 3);
+    twheel_add(&tw, &t1.timer, 100);
+    twheel_add(&tw, &t2.timer, 10);
+    ck_assert(twheel_timer_pending(&t0.timer));
+    ck_assert_uint_eq(tw.len, 3);
+
+    twheel_remove(&tw, &t2.timer);
+    ck_assert(!twheel_timer_pending(&t2.timer));
+    ck_assert_uint_eq(tw.len, 2);
+    twheel_remove(&tw, &t2.timer);
+    ck_assert_uint_eq(tw.len, 2);
+
+    twheel_advance(&tw, 2, fire, &ctx);
+    ck_assert_uint_eq(ctx.fired, 0);
+    twheel_advance(&tw, 1, fire, &ctx);
+    ck_assert_uint_eq(ctx.fired, 1);
+    ck_assert_uint_eq(t0.fired, 1);
+    ck_assert_uint_eq(t0.fired_at, 3);
+    ck_assert(!twheel_timer_pending(&t0.timer));
+
+    /* rescheduling moves the timer instead of adding it twice */
+    twheel_add(&tw, &t1.timer, 10);
+    ck_assert_uint_eq(tw.len, 1);
+    twheel_advance(&tw, 200, fire, &ctx);
+    ck_assert_uint_eq(t1.fired, 1);
+    ck_assert_uint_eq(t1.fired_at, 13);
+    ck_assert_uint_eq(tw.len, 0);
+    ck_assert_uint_eq(tw.now, 203);
+}
+END_TEST
+
+START_TEST(test_twheel_random) {
+    twheel tw = twheel_new();
+    test_timer* timers = calloc(NUM_TIMERS, sizeof(test_timer));
+    fire_ctx ctx = {&tw, 0};
+    size_t i, expected = 0;
+    ck_assert_ptr_nonnull(timers);
+    srand(42);
+    /* start away from 0 so the timers straddle wraps of every level */
+    tw.now = 262000;
+    for (i = 0; i < NUM_TIMERS; ++i) {
+        uint64_t ticks;
+        switch (i % 4) {
+        case 0:
+            ticks = (rand() % 64) + 1;
+            break;
+        case 1:
+            ticks = (rand() % 4096) + 1;
+            break;
+        case 2:
+            ticks = (rand() % 262144) + 1;
+            break;
+        default:
+            ticks = ((uint64_t)rand() % 1000000) + 1;
+            break;
+        }
+        twheel_timer_init(&(timers[i].timer));
+        twheel_add(&tw, &(timers[i].timer), ticks);
+        timers[i].deadline = tw.now + ticks;
+    }
+    /* cancel a few */
+    for (i = 0; i < NUM_TIMERS; i += 7) {
+        twheel_remove(&tw, &(timers[i].timer));
+    }
+    while (tw.len) {
+        twheel_advance(&tw, (rand() % 5000) + 1, fire, &ctx);
+    }
+    for (i = 0; i < NUM_TIMERS; ++i) {
+        if (i % 7 == 0) {
+            ck_assert_uint_eq(timers[i].fired, 0);
+            continue;
+        }
+        expected++;
+        ck_assert_uint_eq(timers[i].fired, 1);
+        ck_assert_uint_eq(timers[i].fired_at, timers[i].deadline);
+    }
+    ck_assert_uint_eq(ctx.fired, expected);
+    free(timers);
+}
+END_TEST
+
+START_TEST(test_twheel_far) {
+    twheel tw = twheel_new();
+    test_timer t;
+    fire_ctx ctx = {&tw, 0};
+    uint64_t far = ((uint64_t)1) << (TWHEEL_BITS * TWHEEL_LEVELS);
+    twheel_timer_init(&t.timer);
+    t.fired = 0;
+    /* timers past the range of the wheel are parked until they get closer */
+    twheel_add(&tw, &t.timer, far * 2);
+    twheel_advance(&tw, (far * 2) - 1, fire, &ctx);
+    ck_assert_uint_eq(t.fired, 0);
+    twheel_advance(&tw, 1, fire, &ctx);
+    ck_assert_uint_eq(t.fired, 1);
+    ck_assert_uint_eq(t.fired_at, far * 2);
+}
+END_TEST
+
+Suite* twheel_suite() {
+    Suite* s;
+    TCase* tc_core;
+    s = suite_create("twheel");
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_twheel);
+    tcase_add_test(tc_core, test_twheel_random);
+    tcase_add_test(tc_core, test_twheel_far);
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main() {
+    int number_failed;
+    Suite* s;
+    SRunner* sr;
+    s = twheel_suite();
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,147 @@
+#include "../src/vlib.h"
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int cmp_ints(void* a, void* b) { return *((int*)a) - *((int*)b); }
+
+START_TEST(test_varena) {
+    size_t i;
+    void* ptrs[1000];
+    void *small, *reused, *large;
+    varena arena = varena_new();
+
+    for (i = 0; i < 1000; ++i) {
+        ptrs[i] = varena_alloc(&arena, 40);
+        ck_assert_ptr_nonnull(ptrs[i]);
+        ck_assert_uint_eq(((uintptr_t)ptrs[i]) & 15, 0);
+        memset(ptrs[i], (int)(i & 0xFF), 40);
+    }
+    for (i = 0; i < 1000; ++i) {
+        unsigned char* p = ptrs[i];
+        ck_assert_uint_eq(p[0], i & 0xFF);
+        ck_assert_uint_eq(p[39], i & 0xFF);
+    }
+
+    small = ptrs[500];
+    varena_dealloc(&arena, small);
+    reused = varena_alloc(&arena, 33);
+    ck_assert_ptr_eq(reused, small);
+
+    large = varena_alloc(&arena, 100000);
+    ck_assert_ptr_nonnull(large);
+    ck_assert_uint_eq(((uintptr_t)large) & 15, 0);
+    memset(large, 0xAB, 100000);
+    varena_dealloc(&arena, large);
+
+    /* large objects and slabs freed in any order, or left to varena_free */
+    for (i = 0; i < 100; ++i) {
+        ptrs[i] = varena_alloc(&arena, (i % 2) ? 3000 + i : 16 + i);
+        ck_assert_ptr_nonnull(ptrs[i]);
+        memset(ptrs[i], 0xCD, (i % 2) ? 3000 + i : 16 + i);
+    }
+    for (i = 0; i < 100; i += 3) {
+        varena_dealloc(&arena, ptrs[i]);
+    }
+
+    varena_free(&arena);
+}
+END_TEST
+
+START_TEST(test_varena_null) {
+    void* ptr = varena_alloc(NULL, 64);
+    ck_assert_ptr_nonnull(ptr);
+    varena_dealloc(NULL, ptr);
+}
+END_TEST
+
+START_TEST(test_varena_containers) {
+    int i, out;
+    int* got;
+    varena arena = varena_new();
+    ht ht = ht_new_with_arena(sizeof(int), NULL, &arena);
+    set set = set_new_with_arena(NULL, &arena);
+    list l = list_new_with_arena(sizeof(int), &arena);
+    queue q = queue_new_with_arena(sizeof(int), &arena);
+    avl_tree tree = avl_tree_new_with_arena(sizeof(int), &arena);
+
+    for (i = 0; i < 1000; ++i) {
+        ck_assert_int_eq(ht_insert(&ht, &i, sizeof(int), &i, NULL), 0);
+        ck_assert_int_eq(set_insert(&set, &i, sizeof(int)), 0);
+        ck_assert_int_eq(list_append(&l, &i), 0);
+        ck_assert_int_eq(queue_enque(&q, &i), 0);
+        ck_assert_int_eq(avl_insert(&tree, &i, cmp_ints), 0);
+    }
+    for (i = 0; i < 1000; i += 2) {
+        ck_assert_int_eq(ht_delete(&ht, &i, sizeof(int), NULL, NULL), 0);
+        ck_assert_int_eq(set_delete(&set, &i, sizeof(int), NULL), 0);
+        ck_assert_int_eq(queue_deque(&q, &out), 0);
+        ck_assert_int_eq(out, i / 2);
+    }
+    for (i = 0; i < 1000; ++i) {
+        got = ht_get(&ht, &i, sizeof(int));
+        if (i % 2 == 0) {
+            ck_assert_ptr_null(got);
+            ck_assert(!set_has(&set, &i, sizeof(int)));
+        } else {
+            ck_assert_ptr_nonnull(got);
+            ck_assert_int_eq(*got, i);
+            ck_assert(set_has(&set, &i, sizeof(int)));
+        }
+    }
+    ck_assert_uint_eq(list_len(&l), 1000);
+    ck_assert_int_eq(list_remove_at(&l, 0, &out), 0);
+    ck_assert_int_eq(out, 0);
+    ck_assert_uint_eq(tree.num_el, 1000);
+
+    ht_free(&ht, NULL, NULL);
+    set_free(&set, NULL);
+    list_free(&l, NULL);
+    queue_free(&q, NULL);
+    avl_tree_free(&tree, NULL);
+    varena_free(&arena);
+}
+END_TEST
+
+START_TEST(test_varena_binary_tree) {
+    int a = 1, b = 2, c = 3;
+    varena arena = varena_new();
+    binary_tree tree = {0};
+    tree.arena = &arena;
+    tree.data_size = sizeof(int);
+    tree.root = binary_node_new_with_arena(&a, sizeof(int), &arena);
+    tree.root->left = binary_node_new_with_arena(&b, sizeof(int), &arena);
+    tree.root->right = binary_node_new_with_arena(&c, sizeof(int), &arena);
+    tree.num_el = 3;
+    ck_assert(bt_bfs(&tree, &c, cmp_ints));
+    binary_tree_free(&tree, NULL);
+    varena_free(&arena);
+}
+END_TEST
+
+Suite* varena_suite() {
+    Suite* s;
+    TCase* tc_core;
+    s = suite_create("varena");
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_varena);
+    tcase_add_test(tc_core, test_varena_null);
+    tcase_add_test(tc_core, test_varena_containers);
+    tcase_add_test(tc_core, test_varena_binary_tree);
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main() {
+    int number_failed;
+    Suite* s;
+    SRunner* sr;
+    s = varena_suite();
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
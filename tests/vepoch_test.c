@@ -0,0 +1,103 @@
+#include "../src/vlib.h"
+#include <check.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    vepoch* e;
+    vepoch_reader* r;
+} reader_arg;
+
+static void* enter_exit(void* arg) {
+    reader_arg* a = arg;
+    a->r = vepoch_enter(a->e);
+    vepoch_exit(a->r);
+    return NULL;
+}
+
+START_TEST(test_vepoch_reclaim) {
+    vepoch e = vepoch_new();
+    vepoch_list list = vepoch_list_new();
+    size_t i;
+    ck_assert(e.has_key);
+    for (i = 0; i < 10; ++i) {
+        vepoch_retire(&e, &list, malloc(16));
+    }
+    ck_assert_uint_eq(list.len, 10);
+    /* nobody is reading, so each call moves the epoch on once */
+    vepoch_reclaim(&e, &list);
+    ck_assert_uint_eq(list.len, 10);
+    vepoch_reclaim(&e, &list);
+    ck_assert_uint_eq(list.len, 0);
+    vepoch_list_free(&list);
+    vepoch_free(&e);
+}
+END_TEST
+
+START_TEST(test_vepoch_reader_holds) {
+    vepoch e = vepoch_new();
+    vepoch_list list = vepoch_list_new();
+    vepoch_reader* r = vepoch_enter(&e);
+    size_t i;
+    ck_assert_ptr_nonnull(r);
+    vepoch_retire(&e, &list, malloc(16));
+    for (i = 0; i < 10; ++i) {
+        vepoch_reclaim(&e, &list);
+    }
+    /* the epoch moved on once, then waited for the reader */
+    ck_assert_uint_eq(list.len, 1);
+    vepoch_exit(r);
+    vepoch_reclaim(&e, &list);
+    vepoch_reclaim(&e, &list);
+    ck_assert_uint_eq(list.len, 0);
+    /* entering again reuses the record of the thread */
+    ck_assert_ptr_eq(vepoch_enter(&e), r);
+    vepoch_exit(r);
+    vepoch_list_free(&list);
+    vepoch_free(&e);
+}
+END_TEST
+
+START_TEST(test_vepoch_threads) {
+    vepoch e = vepoch_new();
+    reader_arg arg = {&e, NULL};
+    pthread_t thread;
+    vepoch_reader* first;
+    ck_assert_int_eq(pthread_create(&thread, NULL, enter_exit, &arg), 0);
+    pthread_join(thread, NULL);
+    ck_assert_ptr_nonnull(arg.r);
+    first = arg.r;
+    /* the record of a thread that exited is claimed by the next one */
+    ck_assert_int_eq(pthread_create(&thread, NULL, enter_exit, &arg), 0);
+    pthread_join(thread, NULL);
+    ck_assert_ptr_eq(arg.r, first);
+    vepoch_free(&e);
+}
+END_TEST
+
+Suite* vepoch_suite() {
+    Suite* s;
+    TCase* tc_core;
+    s = suite_create("vepoch");
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_vepoch_reclaim);
+    tcase_add_test(tc_core, test_vepoch_reader_holds);
+    tcase_add_test(tc_core, test_vepoch_threads);
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main() {
+    int number_failed;
+    Suite* s;
+    SRunner* sr;
+    s = vepoch_suite();
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
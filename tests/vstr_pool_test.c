@@ -0,0 +1,88 @@
+#include "../src/vlib.h"
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+START_TEST(test_vstr_pool) {
+    vstr_pool pool = vstr_pool_new();
+    vstr s = vstr_from("content-type");
+    char buf[] = "content-type";
+    const vstr_atom* a = vstr_intern(&pool, "content-type", 12);
+    const vstr_atom* b;
+    ck_assert_ptr_nonnull(a);
+    ck_assert_uint_eq(a->len, 12);
+    ck_assert_uint_eq(a->id, 0);
+    ck_assert_int_eq(memcmp(a->data, "content-type", 12), 0);
+    /* the pool keeps its own copy */
+    ck_assert_ptr_ne(a->data, buf);
+
+    ck_assert_ptr_eq(vstr_intern(&pool, buf, 12), a);
+    ck_assert_ptr_eq(vstr_intern_vstr(&pool, &s), a);
+    ck_assert_ptr_eq(vstr_pool_find(&pool, buf, 12), a);
+    ck_assert_ptr_null(vstr_pool_find(&pool, "host", 4));
+    ck_assert_uint_eq(vstr_pool_len(&pool), 1);
+
+    b = vstr_intern(&pool, "content", 7);
+    ck_assert_ptr_ne(a, b);
+    ck_assert_uint_eq(b->id, 1);
+    ck_assert_ptr_eq(vstr_intern(&pool, "", 0), vstr_intern(&pool, "", 0));
+    ck_assert_ptr_eq(vstr_intern(&pool, "a\0b", 3),
+                     vstr_intern(&pool, "a\0b", 3));
+    ck_assert_ptr_ne(vstr_intern(&pool, "a\0b", 3),
+                     vstr_intern(&pool, "a\0c", 3));
+    ck_assert_uint_eq(vstr_pool_len(&pool), 5);
+    vstr_free(&s);
+    vstr_pool_free(&pool);
+}
+END_TEST
+
+START_TEST(test_vstr_pool_many) {
+    vstr_pool pool = vstr_pool_new();
+    const vstr_atom** atoms = malloc(10000 * sizeof(vstr_atom*));
+    size_t i;
+    ck_assert_ptr_nonnull(atoms);
+    for (i = 0; i < 10000; ++i) {
+        char buf[32];
+        int len = snprintf(buf, sizeof buf, "header-%zu", i);
+        atoms[i] = vstr_intern(&pool, buf, (size_t)len);
+        ck_assert_ptr_nonnull(atoms[i]);
+        ck_assert_uint_eq(atoms[i]->id, i);
+    }
+    /* atoms stay where they are while the pool grows */
+    for (i = 0; i < 10000; ++i) {
+        char buf[32];
+        int len = snprintf(buf, sizeof buf, "header-%zu", i);
+        ck_assert_ptr_eq(vstr_intern(&pool, buf, (size_t)len), atoms[i]);
+        ck_assert_uint_eq(atoms[i]->len, (size_t)len);
+        ck_assert_int_eq(memcmp(atoms[i]->data, buf, (size_t)len), 0);
+    }
+    ck_assert_uint_eq(vstr_pool_len(&pool), 10000);
+    free(atoms);
+    vstr_pool_free(&pool);
+}
+END_TEST
+
+Suite* vstr_pool_suite() {
+    Suite* s;
+    TCase* tc_core;
+    s = suite_create("vstr_pool");
+    tc_core = tcase_create("Core");
+    tcase_add_test(tc_core, test_vstr_pool);
+    tcase_add_test(tc_core, test_vstr_pool_many);
+    suite_add_tcase(s, tc_core);
+    return s;
+}
+
+int main() {
+    int number_failed;
+    Suite* s;
+    SRunner* sr;
+    s = vstr_pool_suite();
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
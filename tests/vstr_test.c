@@ -1,5 +1,6 @@
 #include "../src/vlib.h"
 #include <check.h>
+#include <ctype.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -125,6 +126,326 @@ START_TEST(test_vstr_format_large) {
 }
 END_TEST
 
+START_TEST(test_vstr_grow) {
+    vstr s = vstr_new();
+    size_t i, grows = 0, cap = 0;
+    for (i = 0; i < 10000; ++i) {
+        ck_assert_int_eq(vstr_push_char(&s, (char)('a' + (i % 26))), 0);
+        if (s.is_large && (s.str_data.lg.cap != cap)) {
+            cap = s.str_data.lg.cap;
+            grows++;
+        }
+    }
+    /* the capacity doubles, so it only grows a logarithmic number of times */
+    ck_assert_uint_le(grows, 10);
+    ck_assert_uint_eq(vstr_len(&s), 10000);
+    ck_assert_uint_eq(strlen(vstr_data(&s)), 10000);
+    for (i = 0; i < 10000; ++i) {
+        ck_assert_int_eq(vstr_data(&s)[i], 'a' + (i % 26));
+    }
+    for (i = 0; i < 100; ++i) {
+        ck_assert_int_eq(vstr_push_string(&s, "0123456789"), 0);
+    }
+    ck_assert_uint_eq(strlen(vstr_data(&s)), 11000);
+    ck_assert_int_eq(vstr_shrink_to_fit(&s), 0);
+    ck_assert_uint_eq(s.str_data.lg.cap, 11001);
+    ck_assert_uint_eq(vstr_len(&s), 11000);
+    ck_assert_int_eq(memcmp(vstr_data(&s) + 10990, "0123456789", 11), 0);
+    vstr_free(&s);
+}
+END_TEST
+
+START_TEST(test_vstr_reserve) {
+    vstr s = vstr_from("abc");
+    const char* data;
+    size_t i;
+    ck_assert_int_eq(vstr_reserve(&s, 10), 0);
+    ck_assert_uint_eq(s.is_large, 0);
+    ck_assert_int_eq(vstr_reserve(&s, 1000), 0);
+    ck_assert_uint_eq(s.is_large, 1);
+    ck_assert_uint_eq(s.str_data.lg.cap, 1001);
+    ck_assert_str_eq(vstr_data(&s), "abc");
+    data = vstr_data(&s);
+    for (i = 3; i < 1000; ++i) {
+        ck_assert_int_eq(vstr_push_char(&s, 'x'), 0);
+    }
+    /* nothing was reallocated */
+    ck_assert_ptr_eq(vstr_data(&s), data);
+    ck_assert_uint_eq(vstr_len(&s), 1000);
+    ck_assert_int_eq(vstr_reserve(&s, 10), 0);
+    ck_assert_uint_eq(s.str_data.lg.cap, 1001);
+    vstr_free(&s);
+
+    /* a large string that is short enough goes back to being small */
+    s = vstr_from("abc");
+    ck_assert_int_eq(vstr_reserve(&s, 100), 0);
+    ck_assert_int_eq(vstr_push_string(&s, "def"), 0);
+    ck_assert_int_eq(vstr_shrink_to_fit(&s), 0);
+    ck_assert_uint_eq(s.is_large, 0);
+    ck_assert_uint_eq(vstr_len(&s), 6);
+    ck_assert_str_eq(vstr_data(&s), "abcdef");
+    ck_assert_int_eq(vstr_push_char(&s, 'g'), 0);
+    ck_assert_str_eq(vstr_data(&s), "abcdefg");
+    vstr_free(&s);
+}
+END_TEST
+
+START_TEST(test_vstr_push_len) {
+    vstr s = vstr_new();
+    vstr t = vstr_from("0123456789");
+    vstr parts[3];
+    vstr cat;
+    const char bin[] = {'a', '\0', 'b'};
+    ck_assert_int_eq(vstr_push_len(&s, bin, sizeof bin), 0);
+    ck_assert_uint_eq(vstr_len(&s), 3);
+    ck_assert_int_eq(memcmp(vstr_data(&s), bin, 3), 0);
+    ck_assert_int_eq(vstr_push_len(&s, "xyz", 2), 0);
+    ck_assert_int_eq(memcmp(vstr_data(&s), "a\0bxy", 5), 0);
+
+    /* appending a vstr to itself, small and then large */
+    ck_assert_int_eq(vstr_append(&t, &t), 0);
+    ck_assert_str_eq(vstr_data(&t), "01234567890123456789");
+    ck_assert_int_eq(vstr_append(&t, &t), 0);
+    ck_assert_uint_eq(t.is_large, 1);
+    ck_assert_str_eq(vstr_data(&t), "0123456789012345678901234567890123456789");
+    ck_assert_int_eq(vstr_append(&t, &t), 0);
+    ck_assert_uint_eq(vstr_len(&t), 80);
+    ck_assert_int_eq(memcmp(vstr_data(&t) + 40, vstr_data(&t), 40), 0);
+    ck_assert_int_eq(vstr_append(&s, &t), 0);
+    ck_assert_uint_eq(vstr_len(&s), 85);
+    ck_assert_int_eq(memcmp(vstr_data(&s) + 5, vstr_data(&t), 80), 0);
+
+    parts[0] = vstr_from("abc");
+    parts[1] = s;
+    parts[2] = vstr_from("def");
+    cat = vstr_concat_n(parts, 3);
+    ck_assert_uint_eq(vstr_len(&cat), 91);
+    ck_assert_uint_eq(cat.str_data.lg.cap, 92);
+    ck_assert_int_eq(memcmp(vstr_data(&cat), "abca\0bxy", 8), 0);
+    ck_assert_str_eq(vstr_data(&cat) + 88, "def");
+    vstr_free(&cat);
+    cat = vstr_concat_n(parts, 1);
+    ck_assert_uint_eq(cat.is_large, 0);
+    ck_assert_str_eq(vstr_data(&cat), "abc");
+    vstr_free(&cat);
+    vstr_free(&s);
+    vstr_free(&t);
+}
+END_TEST
+
+static ssize_t naive_find(const char* s, size_t len, const char* needle,
+                          size_t needle_len) {
+    size_t i;
+    for (i = 0; (i + needle_len) <= len; ++i) {
+        if (memcmp(s + i, needle, needle_len) == 0) {
+            return (ssize_t)i;
+        }
+    }
+    return -1;
+}
+
+static int sign(int x) { return (x > 0) - (x < 0); }
+
+START_TEST(test_vstr_find) {
+    char buf[300], needle[8];
+    size_t len, i, trial;
+    srand(11);
+    /* a small alphabet with nulls, so partial matches are common */
+    for (trial = 0; trial < 5000; ++trial) {
+        vstr s;
+        size_t needle_len = (size_t)(rand() % 6) + 1;
+        len = (size_t)(rand() % 300);
+        for (i = 0; i < len; ++i) {
+            buf[i] = "ab\0"[rand() % 3];
+        }
+        for (i = 0; i < needle_len; ++i) {
+            needle[i] = "ab\0"[rand() % 3];
+        }
+        s = vstr_from_len(buf, len);
+        ck_assert_int_eq(vstr_find(&s, needle, needle_len),
+                         naive_find(buf, len, needle, needle_len));
+        ck_assert_int_eq(vstr_find_char(&s, needle[0]),
+                         naive_find(buf, len, needle, 1));
+        vstr_free(&s);
+    }
+    for (len = 0; len < 100; ++len) {
+        vstr s;
+        memset(buf, 'x', len);
+        s = vstr_from_len(buf, len);
+        /* a match that ends on the very last byte */
+        if (len >= 3) {
+            memcpy(buf + len - 3, "abc", 3);
+            vstr_free(&s);
+            s = vstr_from_len(buf, len);
+            ck_assert_int_eq(vstr_find(&s, "abc", 3), (ssize_t)len - 3);
+            ck_assert_int_eq(vstr_find_char(&s, 'c'), (ssize_t)len - 1);
+        }
+        ck_assert_int_eq(vstr_find(&s, "", 0), 0);
+        ck_assert_int_eq(vstr_find(&s, "y", 1), -1);
+        vstr_free(&s);
+    }
+}
+END_TEST
+
+START_TEST(test_vstr_casecmp) {
+    char a[100], b[100];
+    size_t len, i, trial;
+    vstr x = vstr_from("Content-Length");
+    vstr y = vstr_from("content-length");
+    vstr z = vstr_from("content-type");
+    ck_assert_int_eq(vstr_casecmp(&x, &y), 0);
+    ck_assert_int_lt(vstr_casecmp(&x, &z), 0);
+    ck_assert_int_gt(vstr_casecmp(&z, &x), 0);
+    ck_assert_int_ne(vstr_cmp(&x, &y), 0);
+    vstr_free(&x);
+    vstr_free(&y);
+    vstr_free(&z);
+    /* a prefix orders the same way for both compares */
+    x = vstr_from("ab");
+    y = vstr_from("ABC");
+    z = vstr_from("abc");
+    ck_assert_int_gt(vstr_cmp(&x, &z), 0);
+    ck_assert_int_lt(vstr_cmp(&z, &x), 0);
+    ck_assert_int_gt(vstr_casecmp(&x, &y), 0);
+    ck_assert_int_lt(vstr_casecmp(&y, &x), 0);
+    ck_assert_int_eq(sign(vstr_casecmp(&x, &z)), sign(vstr_cmp(&x, &z)));
+    vstr_free(&x);
+    vstr_free(&y);
+    vstr_free(&z);
+    srand(12);
+    for (trial = 0; trial < 5000; ++trial) {
+        int expected = 0;
+        len = (size_t)(rand() % 100);
+        for (i = 0; i < len; ++i) {
+            a[i] = (char)(rand() % 256);
+            b[i] = (rand() % 2) ? (char)toupper((unsigned char)a[i])
+                                : (char)tolower((unsigned char)a[i]);
+        }
+        if (len && (rand() % 2)) {
+            b[rand() % len] = (char)(rand() % 256);
+        }
+        for (i = 0; i < len; ++i) {
+            int ca = tolower((unsigned char)a[i]);
+            int cb = tolower((unsigned char)b[i]);
+            if (ca != cb) {
+                expected = ca - cb;
+                break;
+            }
+        }
+        x = vstr_from_len(a, len);
+        y = vstr_from_len(b, len);
+        ck_assert_int_eq(sign(vstr_casecmp(&x, &y)), sign(expected));
+        vstr_free(&x);
+        vstr_free(&y);
+    }
+}
+END_TEST
+
+START_TEST(test_vstr_split) {
+    vstr s = vstr_from("GET /index.html HTTP/1.1");
+    vstr parts[4];
+    size_t n, i;
+    n = vstr_split(&s, ' ', parts, 4);
+    ck_assert_uint_eq(n, 3);
+    ck_assert_str_eq(vstr_data(&parts[0]), "GET");
+    ck_assert_str_eq(vstr_data(&parts[1]), "/index.html");
+    ck_assert_str_eq(vstr_data(&parts[2]), "HTTP/1.1");
+    for (i = 0; i < n; ++i) {
+        vstr_free(&parts[i]);
+    }
+    /* the last part keeps the rest of the string */
+    n = vstr_split(&s, ' ', parts, 2);
+    ck_assert_uint_eq(n, 2);
+    ck_assert_str_eq(vstr_data(&parts[1]), "/index.html HTTP/1.1");
+    for (i = 0; i < n; ++i) {
+        vstr_free(&parts[i]);
+    }
+    vstr_free(&s);
+    s = vstr_from(",a,,");
+    n = vstr_split(&s, ',', parts, 4);
+    ck_assert_uint_eq(n, 4);
+    ck_assert_uint_eq(vstr_len(&parts[0]), 0);
+    ck_assert_str_eq(vstr_data(&parts[1]), "a");
+    ck_assert_uint_eq(vstr_len(&parts[2]), 0);
+    ck_assert_uint_eq(vstr_len(&parts[3]), 0);
+    for (i = 0; i < n; ++i) {
+        vstr_free(&parts[i]);
+    }
+    ck_assert_uint_eq(vstr_split(&s, ',', parts, 0), 0);
+    vstr_free(&s);
+}
+END_TEST
+
+START_TEST(test_vstr_view) {
+    vstr s = vstr_from("key=value; other=thing");
+    vstr_view v = vstr_view_of(&s), slice, parts[3];
+    vstr copy;
+    ck_assert_ptr_eq(v.data, vstr_data(&s));
+    ck_assert_uint_eq(v.len, vstr_len(&s));
+    slice = vstr_view_slice(v, 4, 5);
+    ck_assert_ptr_eq(slice.data, v.data + 4);
+    ck_assert_int_eq(vstr_view_cmp(slice, vstr_view_from("value", 5)), 0);
+    ck_assert_int_ne(vstr_view_cmp(slice, vstr_view_from("valu", 4)), 0);
+    ck_assert_int_eq(vstr_view_casecmp(slice, vstr_view_from("VALUE", 5)), 0);
+    /* both compares put a prefix after the longer view */
+    ck_assert_int_gt(vstr_view_cmp(vstr_view_slice(slice, 0, 3), slice), 0);
+    ck_assert_int_lt(vstr_view_cmp(slice, vstr_view_slice(slice, 0, 3)), 0);
+    ck_assert_int_gt(vstr_view_casecmp(vstr_view_from("VAL", 3), slice), 0);
+    ck_assert_int_lt(vstr_view_casecmp(slice, vstr_view_from("VAL", 3)), 0);
+    /* empty views may have no data at all */
+    ck_assert_int_eq(
+        vstr_view_cmp(vstr_view_from(NULL, 0), vstr_view_from(NULL, 0)), 0);
+    ck_assert_int_gt(vstr_view_cmp(vstr_view_from(NULL, 0), slice), 0);
+    ck_assert_int_lt(vstr_view_cmp(slice, vstr_view_from(NULL, 0)), 0);
+    ck_assert_int_eq(
+        vstr_view_casecmp(vstr_view_from(NULL, 0), vstr_view_from(NULL, 0)),
+        0);
+    /* slices are clamped to the end of the view */
+    slice = vstr_view_slice(v, 17, 100);
+    ck_assert_uint_eq(slice.len, 5);
+    ck_assert_uint_eq(vstr_view_slice(v, 100, 1).len, 0);
+    ck_assert_int_eq(vstr_view_find(v, "other", 5), 11);
+    ck_assert_int_eq(vstr_view_find(vstr_view_slice(v, 0, 14), "other", 5),
+                     -1);
+    ck_assert_int_eq(vstr_view_find_char(vstr_view_slice(v, 4, 100), '='), 12);
+    ck_assert_uint_eq(vstr_view_split(v, ';', parts, 3), 2);
+    ck_assert_int_eq(vstr_view_cmp(parts[0], vstr_view_from("key=value", 9)),
+                     0);
+    ck_assert_ptr_eq(parts[1].data, v.data + 10);
+    copy = vstr_from_view(parts[1]);
+    ck_assert_str_eq(vstr_data(&copy), " other=thing");
+    vstr_free(&copy);
+    vstr_free(&s);
+}
+END_TEST
+
+START_TEST(test_vstr_view_tokens) {
+    const char* buf = "a,bb,,ccc";
+    const char* expected[] = {"a", "bb", ""};
+    vstr_view rest = vstr_view_from(buf, strlen(buf)), token;
+    ht ht = ht_new(sizeof(size_t), NULL);
+    size_t i = 0, *count;
+    while (vstr_view_next_token(&rest, ',', &token)) {
+        size_t one = 1;
+        ck_assert_uint_lt(i, 3);
+        ck_assert_uint_eq(token.len, strlen(expected[i]));
+        ck_assert_int_eq(memcmp(token.data, expected[i], token.len), 0);
+        ck_assert_int_eq(
+            ht_insert(&ht, (void*)token.data, token.len, &one, NULL), 0);
+        i++;
+    }
+    ck_assert_uint_eq(i, 3);
+    ck_assert_int_eq(vstr_view_cmp(rest, vstr_view_from("ccc", 3)), 0);
+    /* views are looked up by their bytes, without copying them */
+    token = vstr_view_slice(vstr_view_from(buf, strlen(buf)), 2, 2);
+    count = ht_get(&ht, (void*)token.data, token.len);
+    ck_assert_ptr_nonnull(count);
+    ck_assert_uint_eq(*count, 1);
+    ck_assert_ptr_null(ht_get(&ht, (void*)rest.data, rest.len));
+    ht_free(&ht, NULL, NULL);
+}
+END_TEST
+
 Suite* ht_suite() {
     Suite* s;
     TCase* tc_core;
@@ -136,6 +457,14 @@ Suite* ht_suite() {
     tcase_add_test(tc_core, test_vstr_push_string);
     tcase_add_test(tc_core, test_vstr_format_small);
     tcase_add_test(tc_core, test_vstr_format_large);
+    tcase_add_test(tc_core, test_vstr_grow);
+    tcase_add_test(tc_core, test_vstr_reserve);
+    tcase_add_test(tc_core, test_vstr_push_len);
+    tcase_add_test(tc_core, test_vstr_find);
+    tcase_add_test(tc_core, test_vstr_casecmp);
+    tcase_add_test(tc_core, test_vstr_split);
+    tcase_add_test(tc_core, test_vstr_view);
+    tcase_add_test(tc_core, test_vstr_view_tokens);
     suite_add_tcase(s, tc_core);
     return s;
 }